@@ -21,6 +21,7 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
 #define ILD_H
 
 #include <stdint.h>
+#include "libol.h"
 
 typedef struct {
 	float x;
@@ -39,6 +40,7 @@ typedef struct {
 	float min_z;
 	float max_z;
 	IldaPoint *points;
+	uint32_t *colors; // scratch for drawing, allocated on first use
 } IldaFile;
 
 IldaFile *olLoadIlda(const char *filename);
@@ -46,4 +48,7 @@ void olDrawIlda(IldaFile *ild);
 void olDrawIlda3D(IldaFile *ild);
 void olFreeIlda(IldaFile *ild);
 
+void olCtxDrawIlda(OLContext *ctx, IldaFile *ild);
+void olCtxDrawIlda3D(OLContext *ctx, IldaFile *ild);
+
 #endif
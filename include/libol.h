@@ -50,14 +50,42 @@ enum {
 	RENDER_NOREORDER = 2,
 	RENDER_NOREVERSE = 4,
 	RENDER_CULLDARK = 8,
+	RENDER_OPTIMIZE = 16,
+	RENDER_NOREUSE = 32,
 };
 
 #define OL_MAX_OUTPUTS 16
 
+enum {
+	OL_BACKEND_JACK,
+	OL_BACKEND_NULL,
+	OL_BACKEND_FILE,
+};
+
+enum {
+	OL_FILE_RAW,
+	OL_FILE_WAV,
+	OL_FILE_ILDA,
+};
+
+enum {
+	OL_OVERFLOW_DROP,
+	OL_OVERFLOW_DECIMATE,
+};
+
 typedef struct {
 	int buffer_count;
+	// point buffers grow as needed up to this many points, 0 for no limit
 	int max_points;
 	int num_outputs;
+	int backend;
+	const char *filename;
+	int file_format;
+	// JACK backend: if set, start with only this many frames queued ahead
+	// (at least 2, counting the one playing) and queue one more, up to
+	// buffer_count, each time a frame has to be repeated; one less again
+	// after a few seconds without repeats
+	int min_buffer_count;
 } OLConfig;
 
 typedef struct {
@@ -76,7 +104,26 @@ typedef struct {
 	int render_flags;
 	int min_length;
 	int max_framelen;
+	// olVertex3() line strips are clipped where clip space w (the eye
+	// distance, with olPerspective()) drops below this; 0 clips just in
+	// front of the eye
 	float z_near;
+	// RENDER_OPTIMIZE: seconds each output may spend per frame refining the
+	// object order; 0 for the default of 2 ms
+	float optimize_time;
+	// what to do with objects that would go over max_points: drop them, or
+	// thin out the frame rendered so far to make room
+	int overflow;
+	// if set, the detail of each frame is lowered as far as needed for the
+	// previous frame's point count to fit in rate / target_fps samples, and
+	// raised again once there is room
+	float target_fps;
+	// if set, moves speed up and slow down by at most this much per sample
+	// (in the units of on_speed, on each axis) instead of jumping to full
+	// speed, and line strip corners are taken at a speed this allows in
+	// place of corner_dwell and curve_dwell; however small it is, moves
+	// reach full speed within 256 samples
+	float max_accel;
 } OLRenderParams;
 
 typedef struct {
@@ -85,8 +132,65 @@ typedef struct {
 	int resampled_points;
 	int resampled_blacks;
 	int padding_points;
+	int blank_points;
+	int blank_points_saved;
+	int dropped_objects;
+	int dropped_points;
+	// objects thrown away for being entirely off screen or outside the scissor
+	int culled_objects;
+	// detail level picked for the next frame (0 is full detail, see
+	// target_fps) and how many times coarser it samples lines and curves;
+	// tracers can decimate by the same factor
+	int detail_level;
+	float detail_scale;
+	// outputs whose frame was the same as last time and copied from it
+	// (unless RENDER_NOREUSE), and outputs that were rendered afresh
+	int reuse_hits;
+	int reuse_misses;
+	// Seconds spent on the frame, by stage: drawing since the previous
+	// olRenderFrame() returned (including the application's own work),
+	// pixel shaders within that, planning the object order, turning objects
+	// into samples (including the nearest object lookups when reordering),
+	// resampling, padding and copying into the output ring (including reuse
+	// checks and file output), and the audio callback. With several outputs
+	// the middle four are summed over them.
+	float draw_time;
+	float shader_time;
+	float reorder_time;
+	float render_time;
+	float resample_time;
+	float output_time;
+	float audio_time;
+	// JACK backend only: frames queued for output once this one was
+	// submitted, counting the one playing, how many it may queue (between
+	// min_buffer_count and buffer_count), and seconds olRenderFrame() spent
+	// waiting for a free slot
+	int queue_depth;
+	int queue_lead;
+	float queue_wait;
+	// JACK backend only, since the previous frame: times a frame had to be
+	// played again because the next one was not ready, and the longest
+	// process() callback in seconds
+	int repeated_frames;
+	float callback_time;
 } OLFrameInfo;
 
+// Totals kept by the JACK process() callback since olInit()
+typedef struct {
+	unsigned int callbacks;
+	// callbacks that played silence because no frame had been queued yet
+	unsigned int dummy_callbacks;
+	// times a frame was played again because the next one was not ready
+	unsigned int repeated_frames;
+	unsigned long long samples;
+	// total and longest process() time in seconds
+	double callback_time;
+	float max_callback_time;
+} OLOutputStats;
+
+typedef struct OLContext OLContext;
+typedef struct OLDisplayList OLDisplayList;
+
 int olInit(int buffer_count, int max_points);
 int olInit2(const OLConfig *config);
 
@@ -99,6 +203,23 @@ typedef void (*AudioCallbackFunc)(float *leftbuf, float *rightbuf, int samples);
 
 void olSetAudioCallback(AudioCallbackFunc f);
 
+typedef struct {
+	int samples;
+	int num_outputs;
+	const float *x[OL_MAX_OUTPUTS];
+	const float *y[OL_MAX_OUTPUTS];
+	const float *r[OL_MAX_OUTPUTS];
+	const float *g[OL_MAX_OUTPUTS];
+	const float *b[OL_MAX_OUTPUTS];
+	const float *audio_l;
+	const float *audio_r;
+} OLOutputFrame;
+
+typedef void (*FrameCallbackFunc)(const OLOutputFrame *frame);
+
+// Only called by the offline (null/file) backends, from olRenderFrame()
+void olSetFrameCallback(FrameCallbackFunc f);
+
 void olLoadIdentity(void);
 void olPushMatrix(void);
 void olPopMatrix(void);
@@ -133,9 +254,24 @@ void olVertex3(float x, float y, float z, uint32_t color);
 void olVertex2Z(float x, float y, float z, uint32_t color);
 void olEnd(void);
 
+// Vertex arrays: point libol at x/y(/z) and color data and draw a range of it
+// as one object, as if by olBegin(), olVertex()/olVertex3() per element and
+// olEnd(). size is 2 or 3 floats per vertex, strides are in bytes (0 for
+// tightly packed) and a NULL color array draws in white. Without vertex
+// shaders set, the transforms are done in batches. The getters return the
+// current arrays, so they can be put back after drawing from others.
+void olVertexArray(int size, int stride, const float *pointer);
+void olColorArray(int stride, const uint32_t *pointer);
+void olGetVertexArray(int *size, int *stride, const float **pointer);
+void olGetColorArray(int *stride, const uint32_t **pointer);
+void olDrawArrays(int prim, int first, int count);
+
 void olTransformVertex(float *x, float *y);
 void olTransformVertex3(float *x, float *y, float *z);
 void olTransformVertex4(float *x, float *y, float *z, float *w);
+// In place on arrays of coordinates, using the fastest SIMD code for the CPU
+void olTransformVertices(float *x, float *y, int count);
+void olTransformVertices3(float *x, float *y, float *z, int count);
 
 typedef void (*ShaderFunc)(float *x, float *y, uint32_t *color);
 typedef void (*Shader3Func)(float *x, float *y, float *z, uint32_t *color);
@@ -154,11 +290,89 @@ void olDot(float x, float y, int points, uint32_t color);
 float olRenderFrame(int max_fps);
 
 void olGetFrameInfo(OLFrameInfo *info);
+// May be called from any thread
+void olGetOutputStats(OLOutputStats *stats);
 
 void olShutdown(void);
 
 void olSetScissor (float x0, float y0, float x1, float y1);
 
+OLDisplayList *olNewList(void);
+void olDeleteList(OLDisplayList *list);
+// Records the following olBegin()/olVertex()/olEnd() calls instead of drawing
+void olBeginList(OLDisplayList *list);
+void olEndList(void);
+void olCallList(OLDisplayList *list);
+
+/*
+Every function above has a variant taking an explicit context. The plain
+versions operate on the default context created by olInit()/olInit2().
+Contexts are independent of each other and may be used from different
+threads, but a single context must only be used from one thread at a time.
+*/
+
+int olCtxInit(OLContext **ctx, const OLConfig *config);
+OLContext *olGetDefaultContext(void);
+
+void olCtxSetRenderParams(OLContext *ctx, OLRenderParams *params);
+void olCtxGetRenderParams(OLContext *ctx, OLRenderParams *params);
+void olCtxSetOutput(OLContext *ctx, int output);
+void olCtxSetAudioCallback(OLContext *ctx, AudioCallbackFunc f);
+void olCtxSetFrameCallback(OLContext *ctx, FrameCallbackFunc f);
+void olCtxLoadIdentity(OLContext *ctx);
+void olCtxPushMatrix(OLContext *ctx);
+void olCtxPopMatrix(OLContext *ctx);
+void olCtxMultMatrix(OLContext *ctx, float m[9]);
+void olCtxRotate(OLContext *ctx, float theta);
+void olCtxTranslate(OLContext *ctx, float x, float y);
+void olCtxScale(OLContext *ctx, float sx, float sy);
+void olCtxLoadIdentity3(OLContext *ctx);
+void olCtxPushMatrix3(OLContext *ctx);
+void olCtxPopMatrix3(OLContext *ctx);
+void olCtxMultMatrix3(OLContext *ctx, float m[16]);
+void olCtxRotate3X(OLContext *ctx, float theta);
+void olCtxRotate3Y(OLContext *ctx, float theta);
+void olCtxRotate3Z(OLContext *ctx, float theta);
+void olCtxTranslate3(OLContext *ctx, float x, float y, float z);
+void olCtxScale3(OLContext *ctx, float sx, float sy, float sz);
+void olCtxFrustum(OLContext *ctx, float left, float right, float bot, float ttop, float near, float far);
+void olCtxPerspective(OLContext *ctx, float fovy, float aspect, float zNear, float zFar);
+void olCtxResetColor(OLContext *ctx);
+void olCtxMultColor(OLContext *ctx, uint32_t color);
+void olCtxPushColor(OLContext *ctx);
+void olCtxPopColor(OLContext *ctx);
+void olCtxBegin(OLContext *ctx, int prim);
+void olCtxVertex(OLContext *ctx, float x, float y, uint32_t color);
+void olCtxVertex3(OLContext *ctx, float x, float y, float z, uint32_t color);
+void olCtxVertex2Z(OLContext *ctx, float x, float y, float z, uint32_t color);
+void olCtxEnd(OLContext *ctx);
+void olCtxVertexArray(OLContext *ctx, int size, int stride, const float *pointer);
+void olCtxColorArray(OLContext *ctx, int stride, const uint32_t *pointer);
+void olCtxGetVertexArray(OLContext *ctx, int *size, int *stride, const float **pointer);
+void olCtxGetColorArray(OLContext *ctx, int *stride, const uint32_t **pointer);
+void olCtxDrawArrays(OLContext *ctx, int prim, int first, int count);
+void olCtxTransformVertex(OLContext *ctx, float *x, float *y);
+void olCtxTransformVertex3(OLContext *ctx, float *x, float *y, float *z);
+void olCtxTransformVertex4(OLContext *ctx, float *x, float *y, float *z, float *w);
+void olCtxTransformVertices(OLContext *ctx, float *x, float *y, int count);
+void olCtxTransformVertices3(OLContext *ctx, float *x, float *y, float *z, int count);
+void olCtxSetVertexPreShader(OLContext *ctx, ShaderFunc f);
+void olCtxSetVertexShader(OLContext *ctx, ShaderFunc f);
+void olCtxSetVertex3Shader(OLContext *ctx, Shader3Func f);
+void olCtxSetPixelShader(OLContext *ctx, ShaderFunc f);
+void olCtxSetPixel3Shader(OLContext *ctx, Shader3Func f);
+void olCtxRect(OLContext *ctx, float x1, float y1, float x2, float y2, uint32_t color);
+void olCtxLine(OLContext *ctx, float x1, float y1, float x2, float y2, uint32_t color);
+void olCtxDot(OLContext *ctx, float x, float y, int points, uint32_t color);
+float olCtxRenderFrame(OLContext *ctx, int max_fps);
+void olCtxGetFrameInfo(OLContext *ctx, OLFrameInfo *info);
+void olCtxGetOutputStats(OLContext *ctx, OLOutputStats *stats);
+void olCtxShutdown(OLContext *ctx);
+void olCtxSetScissor(OLContext *ctx, float x0, float y0, float x1, float y1);
+void olCtxBeginList(OLContext *ctx, OLDisplayList *list);
+void olCtxEndList(OLContext *ctx);
+void olCtxCallList(OLContext *ctx, OLDisplayList *list);
+
 void olLog(const char *fmt, ...);
 
 typedef void (*LogCallbackFunc)(const char *msg);
@@ -22,6 +22,7 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
 
 #include <stdint.h>
 #include <stddef.h>
+#include "libol.h"
 
 typedef struct {
 	int flag;
@@ -47,4 +48,7 @@ float olGetCharOverlap(Font *font, float height);
 float olDrawChar(Font *fnt, float x, float y, float height, uint32_t color, int c);
 float olDrawString(Font *fnt, float x, float y, float height, uint32_t color, const char *s);
 
+float olCtxDrawChar(OLContext *ctx, Font *fnt, float x, float y, float height, uint32_t color, int c);
+float olCtxDrawString(OLContext *ctx, Font *fnt, float x, float y, float height, uint32_t color, const char *s);
+
 #endif
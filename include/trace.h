@@ -35,6 +35,13 @@ typedef struct {
 	float sigma;
 	unsigned int threshold;
 	unsigned int threshold2;
+	// threads to run edge detection on (one horizontal band each), counting
+	// the one calling olTrace(); 0 is the same as 1
+	unsigned int threads;
+	// only redo the parts of the image that changed since the previous
+	// olTrace() call, in 16x16 pixel tiles; contours that only cross
+	// unchanged tiles are returned again as they were
+	int incremental;
 } OLTraceParams;
 
 typedef struct {
@@ -57,6 +64,9 @@ int olTraceReInit(OLTraceCtx *ctx, OLTraceParams *params);
 int olTrace(OLTraceCtx *ctx, uint8_t *src, icoord stride, OLTraceResult *result);
 void olTraceFree(OLTraceResult *result);
 
+// Name of the image kernels in use ("c", "sse2", "avx2", "avx512", "neon")
+const char *olTraceKernels(OLTraceCtx *ctx);
+
 void olTraceDeinit(OLTraceCtx *ctx);
 
 #endif
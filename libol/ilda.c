@@ -186,44 +186,56 @@ IldaFile *olLoadIlda(const char *filename)
 	return ild;
 }
 
-void olDrawIlda(IldaFile *ild)
+// Draws the file as one vertex array of size 2 or 3, straight out of the
+// IldaPoint records, and puts the caller's arrays back afterwards
+static void draw_ilda(OLContext *ctx, IldaFile *ild, int size)
 {
-	if (!ild)
-		return;
-	IldaPoint *p = ild->points;
+	int va_size, va_stride, ca_stride;
+	const float *va_pointer;
+	const uint32_t *ca_pointer;
 	int i;
-	olBegin(OL_POINTS);
-	for (i = 0; i < ild->count; i++) {
-		//olLog("%f %f %f %d\n", p->x, p->y, p->z, p->is_blank);
-		if (p->is_blank)
-			olVertex(p->x, p->y, C_BLACK);
-		else
-			olVertex(p->x, p->y, C_WHITE);
-		p++;
-	}
-	olEnd();
+
+	if (!ild || !ild->count)
+		return;
+	if (!ild->colors)
+		ild->colors = malloc(ild->count * sizeof(uint32_t));
+	for (i = 0; i < ild->count; i++)
+		ild->colors[i] = ild->points[i].is_blank ? C_BLACK : C_WHITE;
+
+	olCtxGetVertexArray(ctx, &va_size, &va_stride, &va_pointer);
+	olCtxGetColorArray(ctx, &ca_stride, &ca_pointer);
+	olCtxVertexArray(ctx, size, sizeof(IldaPoint), &ild->points[0].x);
+	olCtxColorArray(ctx, 0, ild->colors);
+	olCtxDrawArrays(ctx, OL_POINTS, 0, ild->count);
+	olCtxVertexArray(ctx, va_size, va_stride, va_pointer);
+	olCtxColorArray(ctx, ca_stride, ca_pointer);
+}
+
+void olCtxDrawIlda(OLContext *ctx, IldaFile *ild)
+{
+	draw_ilda(ctx, ild, 2);
+}
+
+void olCtxDrawIlda3D(OLContext *ctx, IldaFile *ild)
+{
+	draw_ilda(ctx, ild, 3);
+}
+
+void olDrawIlda(IldaFile *ild)
+{
+	olCtxDrawIlda(olGetDefaultContext(), ild);
 }
 
 void olDrawIlda3D(IldaFile *ild)
 {
-	if (!ild)
-		return;
-	IldaPoint *p = ild->points;
-	int i;
-	olBegin(OL_POINTS);
-	for (i = 0; i < ild->count; i++) {
-		if (p->is_blank)
-			olVertex3(p->x, p->y, p->z, C_BLACK);
-		else
-			olVertex3(p->x, p->y, p->z, C_WHITE);
-		p++;
-	}
-	olEnd();
+	olCtxDrawIlda3D(olGetDefaultContext(), ild);
 }
 
 void olFreeIlda(IldaFile *ild)
 {
 	if(ild->points)
 		free(ild->points);
+	if(ild->colors)
+		free(ild->colors);
 	free(ild);
 }
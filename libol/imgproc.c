@@ -0,0 +1,400 @@
+/*
+        OpenLase - a realtime laser graphics toolkit
+
+Copyright (C) 2009-2011 Hector Martin "marcan" <hector@marcansoft.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 2.1 or version 3.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include "config.h"
+#include "imgproc.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+# define HAVE_X86_KERNELS
+# include <immintrin.h>
+#endif
+
+#if defined(__aarch64__)
+// armv7 has its own assembly; this is for AArch64 only
+# define HAVE_NEON_KERNELS
+# include <arm_neon.h>
+#endif
+
+#ifdef HAVE_IMGPROC_ASM
+/* Assembly versions (imgproc_sse2.asm, or imgproc_neon.S on ARM) */
+
+void ol_conv_sse2(uint8_t *src, uint8_t *dst, size_t w, size_t h, uint16_t *kern, size_t ksize);
+void ol_transpose_2x8x8(uint8_t *p, size_t stride);
+#endif
+
+/* Portable versions. The loops have a fixed length or unit stride and work
+   on local arrays, so compilers vectorise them for whatever SIMD the target
+   has. */
+
+#define ABS(x) (((x)<0)?-(x):(x))
+
+#define TAN45 0.41421356
+#define ITAN45 ((int32_t)(TAN45*0x10000))
+
+static void conv_c(uint8_t *src, uint8_t *dst, size_t w, size_t h, uint16_t *kern, size_t ksize)
+{
+	uint16_t a[16] = {0}, b[16] = {0};
+	size_t i;
+	int x;
+
+	for (i = 0; i < ksize; i++) {
+		const uint8_t *r0 = src + i*w;
+		const uint8_t *r1 = r0 + w;
+		uint32_t k = kern[i*8];
+		// pmulhuw of the pixel times 257
+		for (x = 0; x < 16; x++) {
+			a[x] += (r0[x] * 257 * k) >> 16;
+			b[x] += (r1[x] * 257 * k) >> 16;
+		}
+	}
+	for (x = 0; x < 8; x++) {
+		dst[x] = a[x] >> 8;
+		dst[h + x] = b[x] >> 8;
+		dst[8*h + x] = a[8 + x] >> 8;
+		dst[9*h + x] = b[8 + x] >> 8;
+	}
+}
+
+static void transpose_2x8x8_c(uint8_t *p, size_t stride)
+{
+	uint8_t t[8][16];
+	int i, j;
+
+	for (i = 0; i < 8; i++)
+		memcpy(t[i], p + i*stride, 16);
+	for (i = 0; i < 8; i++)
+		for (j = 0; j < 8; j++) {
+			p[i*stride + j] = t[j][i];
+			p[i*stride + 8 + j] = t[j][8 + i];
+		}
+}
+
+// Gradients of the middle one of three rows with the 3x3 Sobel operator, and
+// their L1 magnitude, which fits in 16 bits
+static inline void sobel_row_body(const uint8_t *src, size_t stride, int16_t *restrict gx,
+                                  int16_t *restrict gy, uint16_t *restrict mag, size_t w)
+{
+	const uint8_t *a = src, *b = src + stride, *c = src + 2*stride;
+	size_t x;
+
+	for (x = 1; x < w - 1; x++) {
+		int dx = (a[x-1] + 2*b[x-1] + c[x-1]) - (a[x+1] + 2*b[x+1] + c[x+1]);
+		int dy = (a[x-1] - c[x-1]) + 2*(a[x] - c[x]) + (a[x+1] - c[x+1]);
+		gx[x] = dx;
+		gy[x] = dy;
+		mag[x] = ABS(dx) + ABS(dy);
+	}
+}
+
+// All neighbours are loaded and then picked with selects, so the direction
+// test vectorises instead of branching per pixel.
+static inline void nms_row_body(const int16_t *gx, const int16_t *gy, uint16_t *const mag[3],
+                                uint8_t *restrict edges, size_t w, unsigned int low, unsigned int high)
+{
+	const uint16_t *m0 = mag[0], *m1 = mag[1], *m2 = mag[2];
+	size_t x;
+
+	for (x = 2; x < w - 2; x++) {
+		int dx = gx[x], dy = gy[x];
+		int ax = ABS(dx), ay = ABS(dy);
+		int32_t kgy = ITAN45 * ay;
+		unsigned int m = m1[x];
+		unsigned int ul = m0[x-1], u = m0[x], ur = m0[x+1];
+		unsigned int l = m1[x-1], r = m1[x+1];
+		unsigned int dl = m2[x-1], d = m2[x], dr = m2[x+1];
+		// horizontal edge [-], vertical [|], then the diagonals [\] and [/]
+		int horiz = (ax << 16) < kgy;
+		int vert = (ax << 16) > kgy + (ay << 17);
+		int back = (dx ^ dy) < 0;
+		unsigned int n0 = horiz ? u : vert ? l : back ? ur : ul;
+		unsigned int n1 = horiz ? d : vert ? r : back ? dl : dr;
+		int edge = (m > low) & (m > n0) & (m > n1);
+		edges[x] = edge + (edge & (m > high));
+	}
+}
+
+static void sobel_row_c(const uint8_t *src, size_t stride, int16_t *gx, int16_t *gy,
+                        uint16_t *mag, size_t w)
+{
+	sobel_row_body(src, stride, gx, gy, mag, w);
+}
+
+static void nms_row_c(const int16_t *gx, const int16_t *gy, uint16_t *const mag[3],
+                      uint8_t *edges, size_t w, unsigned int low, unsigned int high)
+{
+	nms_row_body(gx, gy, mag, edges, w, low, high);
+}
+
+#ifdef HAVE_X86_KERNELS
+
+/* AVX2. A row of 16 pixels fits in one register as words, where SSE2 needs
+   two. */
+
+// bytes to words times 257, like punpcklbw of a register with itself
+__attribute__((target("avx2")))
+static inline __m256i expand_avx2(const uint8_t *p)
+{
+	__m256i v = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)p));
+	return _mm256_or_si256(v, _mm256_slli_epi16(v, 8));
+}
+
+__attribute__((target("avx2")))
+static inline __m256i load2_avx2(const void *lo, const void *hi)
+{
+	__m256i v = _mm256_castsi128_si256(_mm_loadu_si128((const __m128i *)lo));
+	return _mm256_inserti128_si256(v, _mm_loadu_si128((const __m128i *)hi), 1);
+}
+
+__attribute__((target("avx2")))
+static inline void store2_avx2(void *lo, void *hi, __m256i v)
+{
+	_mm_storeu_si128((__m128i *)lo, _mm256_castsi256_si128(v));
+	_mm_storeu_si128((__m128i *)hi, _mm256_extracti128_si256(v, 1));
+}
+
+// a: pixels 0-7 of row 0 then of row 1, b: pixels 8-15 of both
+__attribute__((target("avx2")))
+static inline void conv_store(uint8_t *dst, size_t h, __m128i a, __m128i b)
+{
+	_mm_storel_epi64((__m128i *)dst, a);
+	_mm_storel_epi64((__m128i *)(dst + h), _mm_unpackhi_epi64(a, a));
+	_mm_storel_epi64((__m128i *)(dst + 8*h), b);
+	_mm_storel_epi64((__m128i *)(dst + 9*h), _mm_unpackhi_epi64(b, b));
+}
+
+__attribute__((target("avx2")))
+static void conv_avx2(uint8_t *src, uint8_t *dst, size_t w, size_t h, uint16_t *kern, size_t ksize)
+{
+	__m256i a = _mm256_setzero_si256();
+	__m256i b = _mm256_setzero_si256();
+	__m256i cur = expand_avx2(src);
+	size_t i;
+
+	for (i = 0; i < ksize; i++) {
+		__m256i k = _mm256_set1_epi16(kern[i*8]);
+		__m256i next = expand_avx2(src + (i+1)*w);
+		a = _mm256_add_epi16(a, _mm256_mulhi_epu16(cur, k));
+		b = _mm256_add_epi16(b, _mm256_mulhi_epu16(next, k));
+		cur = next;
+	}
+	a = _mm256_srli_epi16(a, 8);
+	b = _mm256_srli_epi16(b, 8);
+	// packs within each 128-bit lane: pixels 0-7 of a and b, then 8-15
+	__m256i out = _mm256_packus_epi16(a, b);
+	conv_store(dst, h, _mm256_castsi256_si128(out), _mm256_extracti128_si256(out, 1));
+}
+
+// Rows 0-3 go in the low lanes and rows 4-7 in the high ones, so each
+// unpack step works on all 8 rows and the last step leaves two finished
+// output rows per register.
+__attribute__((target("avx2")))
+static void transpose_2x8x8_avx2(uint8_t *p, size_t stride)
+{
+	const __m256i rows = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+	__m256i y0 = load2_avx2(p, p + 4*stride);
+	__m256i y1 = load2_avx2(p + stride, p + 5*stride);
+	__m256i y2 = load2_avx2(p + 2*stride, p + 6*stride);
+	__m256i y3 = load2_avx2(p + 3*stride, p + 7*stride);
+
+	__m256i t0 = _mm256_unpacklo_epi8(y0, y1);
+	__m256i t1 = _mm256_unpackhi_epi8(y0, y1);
+	__m256i t2 = _mm256_unpacklo_epi8(y2, y3);
+	__m256i t3 = _mm256_unpackhi_epi8(y2, y3);
+
+	// columns 0-3 and 4-7 of the left block, then of the right one
+	__m256i u0 = _mm256_unpacklo_epi16(t0, t2);
+	__m256i u1 = _mm256_unpackhi_epi16(t0, t2);
+	__m256i u2 = _mm256_unpacklo_epi16(t1, t3);
+	__m256i u3 = _mm256_unpackhi_epi16(t1, t3);
+
+	store2_avx2(p, p + stride,
+	            _mm256_permutevar8x32_epi32(_mm256_unpacklo_epi32(u0, u2), rows));
+	store2_avx2(p + 2*stride, p + 3*stride,
+	            _mm256_permutevar8x32_epi32(_mm256_unpackhi_epi32(u0, u2), rows));
+	store2_avx2(p + 4*stride, p + 5*stride,
+	            _mm256_permutevar8x32_epi32(_mm256_unpacklo_epi32(u1, u3), rows));
+	store2_avx2(p + 6*stride, p + 7*stride,
+	            _mm256_permutevar8x32_epi32(_mm256_unpackhi_epi32(u1, u3), rows));
+}
+
+// The portable row kernels, vectorised by the compiler for AVX2
+__attribute__((target("avx2")))
+static void sobel_row_avx2(const uint8_t *src, size_t stride, int16_t *gx, int16_t *gy,
+                           uint16_t *mag, size_t w)
+{
+	sobel_row_body(src, stride, gx, gy, mag, w);
+}
+
+__attribute__((target("avx2")))
+static void nms_row_avx2(const int16_t *gx, const int16_t *gy, uint16_t *const mag[3],
+                         uint8_t *edges, size_t w, unsigned int low, unsigned int high)
+{
+	nms_row_body(gx, gy, mag, edges, w, low, high);
+}
+
+/* AVX-512BW. Both output rows of a convolution, or two rows of Sobel
+   output, share one register. */
+
+__attribute__((target("avx512f,avx512bw")))
+static void conv_avx512(uint8_t *src, uint8_t *dst, size_t w, size_t h, uint16_t *kern, size_t ksize)
+{
+	__m512i acc = _mm512_setzero_si512();
+	size_t i;
+
+	for (i = 0; i < ksize; i++) {
+		__m512i v = _mm512_cvtepu8_epi16(load2_avx2(src + i*w, src + (i+1)*w));
+		v = _mm512_or_si512(v, _mm512_slli_epi16(v, 8));
+		acc = _mm512_add_epi16(acc, _mm512_mulhi_epu16(v, _mm512_set1_epi16(kern[i*8])));
+	}
+	// row 0 then row 1, 16 pixels each, all already below 256
+	__m256i out = _mm512_cvtepi16_epi8(_mm512_srli_epi16(acc, 8));
+	__m128i r0 = _mm256_castsi256_si128(out);
+	__m128i r1 = _mm256_extracti128_si256(out, 1);
+	conv_store(dst, h, _mm_unpacklo_epi64(r0, r1), _mm_unpackhi_epi64(r0, r1));
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static void sobel_row_avx512(const uint8_t *src, size_t stride, int16_t *gx, int16_t *gy,
+                             uint16_t *mag, size_t w)
+{
+	sobel_row_body(src, stride, gx, gy, mag, w);
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static void nms_row_avx512(const int16_t *gx, const int16_t *gy, uint16_t *const mag[3],
+                           uint8_t *edges, size_t w, unsigned int low, unsigned int high)
+{
+	nms_row_body(gx, gy, mag, edges, w, low, high);
+}
+
+#endif
+
+#ifdef HAVE_NEON_KERNELS
+
+/* AArch64 NEON */
+
+// high half of a 16x16 bit unsigned multiply, like pmulhuw
+static inline uint16x8_t mulhi_neon(uint16x8_t a, uint16x8_t b)
+{
+	uint32x4_t lo = vmull_u16(vget_low_u16(a), vget_low_u16(b));
+	uint32x4_t hi = vmull_high_u16(a, b);
+	return vshrn_high_n_u32(vshrn_n_u32(lo, 16), hi, 16);
+}
+
+static void conv_neon(uint8_t *src, uint8_t *dst, size_t w, size_t h, uint16_t *kern, size_t ksize)
+{
+	uint16x8_t a0 = vdupq_n_u16(0), a1 = a0, b0 = a0, b1 = a0;
+	uint8x16_t cur = vld1q_u8(src);
+	size_t i;
+
+	for (i = 0; i < ksize; i++) {
+		uint16x8_t k = vdupq_n_u16(kern[i*8]);
+		uint8x16_t next = vld1q_u8(src + (i+1)*w);
+		// zipping a row with itself gives the pixels times 257
+		a0 = vaddq_u16(a0, mulhi_neon(vreinterpretq_u16_u8(vzip1q_u8(cur, cur)), k));
+		a1 = vaddq_u16(a1, mulhi_neon(vreinterpretq_u16_u8(vzip2q_u8(cur, cur)), k));
+		b0 = vaddq_u16(b0, mulhi_neon(vreinterpretq_u16_u8(vzip1q_u8(next, next)), k));
+		b1 = vaddq_u16(b1, mulhi_neon(vreinterpretq_u16_u8(vzip2q_u8(next, next)), k));
+		cur = next;
+	}
+	vst1_u8(dst, vshrn_n_u16(a0, 8));
+	vst1_u8(dst + h, vshrn_n_u16(b0, 8));
+	vst1_u8(dst + 8*h, vshrn_n_u16(a1, 8));
+	vst1_u8(dst + 9*h, vshrn_n_u16(b1, 8));
+}
+
+// The trn steps never cross the middle of a register, so both 8x8 blocks
+// are transposed at once.
+static void transpose_2x8x8_neon(uint8_t *p, size_t stride)
+{
+	uint8x16_t r[8];
+	uint16x8_t t[8];
+	uint32x4_t u[8];
+	int i;
+
+	for (i = 0; i < 8; i++)
+		r[i] = vld1q_u8(p + i*stride);
+	for (i = 0; i < 8; i += 2) {
+		t[i] = vreinterpretq_u16_u8(vtrn1q_u8(r[i], r[i+1]));
+		t[i+1] = vreinterpretq_u16_u8(vtrn2q_u8(r[i], r[i+1]));
+	}
+	for (i = 0; i < 8; i += 4) {
+		u[i] = vreinterpretq_u32_u16(vtrn1q_u16(t[i], t[i+2]));
+		u[i+1] = vreinterpretq_u32_u16(vtrn1q_u16(t[i+1], t[i+3]));
+		u[i+2] = vreinterpretq_u32_u16(vtrn2q_u16(t[i], t[i+2]));
+		u[i+3] = vreinterpretq_u32_u16(vtrn2q_u16(t[i+1], t[i+3]));
+	}
+	for (i = 0; i < 4; i++) {
+		vst1q_u8(p + i*stride, vreinterpretq_u8_u32(vtrn1q_u32(u[i], u[i+4])));
+		vst1q_u8(p + (i+4)*stride, vreinterpretq_u8_u32(vtrn2q_u32(u[i], u[i+4])));
+	}
+}
+
+#endif
+
+static const ImgprocKernels kernels[] = {
+	{"c", conv_c, transpose_2x8x8_c, sobel_row_c, nms_row_c},
+#ifdef HAVE_IMGPROC_ASM
+#if defined(__arm__)
+	{"neon", ol_conv_sse2, ol_transpose_2x8x8, sobel_row_c, nms_row_c},
+#else
+	{"sse2", ol_conv_sse2, ol_transpose_2x8x8, sobel_row_c, nms_row_c},
+#endif
+#endif
+#ifdef HAVE_NEON_KERNELS
+	// NEON is always there on AArch64, so the C row kernels already use it
+	{"neon", conv_neon, transpose_2x8x8_neon, sobel_row_c, nms_row_c},
+#endif
+#ifdef HAVE_X86_KERNELS
+	{"avx2", conv_avx2, transpose_2x8x8_avx2, sobel_row_avx2, nms_row_avx2},
+	{"avx512", conv_avx512, transpose_2x8x8_avx2, sobel_row_avx512, nms_row_avx512},
+#endif
+};
+
+static int supported(const ImgprocKernels *k)
+{
+#ifdef HAVE_X86_KERNELS
+	__builtin_cpu_init();
+	if (!strcmp(k->name, "avx2"))
+		return __builtin_cpu_supports("avx2");
+	if (!strcmp(k->name, "avx512"))
+		return __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw");
+#endif
+	return 1;
+}
+
+const ImgprocKernels *ol_imgproc_kernels(void)
+{
+	const char *cap = getenv("OL_SIMD");
+	const ImgprocKernels *best = &kernels[0];
+	int i;
+
+	// the table is in order of preference; take the last usable one
+	for (i = 0; i < sizeof(kernels) / sizeof(kernels[0]); i++) {
+		if (!supported(&kernels[i]))
+			break;
+		best = &kernels[i];
+		if (cap && !strcmp(cap, kernels[i].name))
+			break;
+	}
+	return best;
+}
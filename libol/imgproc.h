@@ -0,0 +1,52 @@
+/*
+        OpenLase - a realtime laser graphics toolkit
+
+Copyright (C) 2009-2011 Hector Martin "marcan" <hector@marcansoft.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 2.1 or version 3.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#ifndef IMGPROC_H
+#define IMGPROC_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+Tracer image kernels, picked at runtime for the CPU. All variants produce
+exactly the same output, including the transposed layouts of the blur.
+*/
+
+typedef struct {
+	const char *name;
+	// ksize rows of 16 pixels convolved into two output rows, each stored
+	// as two runs of 8 pixels 8 rows of h apart
+	void (*conv)(uint8_t *src, uint8_t *dst, size_t w, size_t h, uint16_t *kern, size_t ksize);
+	// in place, stride in bytes
+	void (*transpose_2x8x8)(uint8_t *p, size_t stride);
+	// Sobel gradients of the middle one of three rows, and |gx|+|gy|, for
+	// pixels 1 to w-2
+	void (*sobel_row)(const uint8_t *src, size_t stride, int16_t *gx, int16_t *gy,
+	                  uint16_t *mag, size_t w);
+	// non-maximum suppression of mag[1] for pixels 2 to w-3: 0 if not an
+	// edge, 1 if above low, 2 if also above high
+	void (*nms_row)(const int16_t *gx, const int16_t *gy, uint16_t *const mag[3],
+	                uint8_t *edges, size_t w, unsigned int low, unsigned int high);
+} ImgprocKernels;
+
+// The best kernels this CPU can run. The OL_SIMD environment variable (sse2,
+// avx2, avx512) caps the choice; it is read on every call.
+const ImgprocKernels *ol_imgproc_kernels(void);
+
+#endif
@@ -119,55 +119,6 @@ INIT_XMM
 %endif
 %endmacro
 
-%macro TRANSPOSE8x8W 9-11
-%if ARCH_X86_64
-    SBUTTERFLY wd,  %1, %2, %9
-    SBUTTERFLY wd,  %3, %4, %9
-    SBUTTERFLY wd,  %5, %6, %9
-    SBUTTERFLY wd,  %7, %8, %9
-    SBUTTERFLY dq,  %1, %3, %9
-    SBUTTERFLY dq,  %2, %4, %9
-    SBUTTERFLY dq,  %5, %7, %9
-    SBUTTERFLY dq,  %6, %8, %9
-    SBUTTERFLY qdq, %1, %5, %9
-    SBUTTERFLY qdq, %2, %6, %9
-    SBUTTERFLY qdq, %3, %7, %9
-    SBUTTERFLY qdq, %4, %8, %9
-    SWAP %2, %5
-    SWAP %4, %7
-%else
-; in:  m0..m7, unless %11 in which case m6 is in %9
-; out: m0..m7, unless %11 in which case m4 is in %10
-; spills into %9 and %10
-%if %0<11
-    movdqa %9, m%7
-%endif
-    SBUTTERFLY wd,  %1, %2, %7
-    movdqa %10, m%2
-    movdqa m%7, %9
-    SBUTTERFLY wd,  %3, %4, %2
-    SBUTTERFLY wd,  %5, %6, %2
-    SBUTTERFLY wd,  %7, %8, %2
-    SBUTTERFLY dq,  %1, %3, %2
-    movdqa %9, m%3
-    movdqa m%2, %10
-    SBUTTERFLY dq,  %2, %4, %3
-    SBUTTERFLY dq,  %5, %7, %3
-    SBUTTERFLY dq,  %6, %8, %3
-    SBUTTERFLY qdq, %1, %5, %3
-    SBUTTERFLY qdq, %2, %6, %3
-    movdqa %10, m%2
-    movdqa m%3, %9
-    SBUTTERFLY qdq, %3, %7, %2
-    SBUTTERFLY qdq, %4, %8, %2
-    SWAP %2, %5
-    SWAP %4, %7
-%if %0<11
-    movdqa m%5, %10
-%endif
-%endif
-%endmacro
-
 ;*****************************************************************************
 ;* SSE2 Gaussian Blur (convolution)
 ;* input: u8
@@ -247,95 +198,6 @@ cglobal conv_sse2, 6,6,8
 
     RET
 
-;*****************************************************************************
-;* SSE2 Sobel (hardcoded convolutions)
-;* input: u8 or s16
-;* output: s16
-;* Runs Sobel transform on 10 input rows producing 8 output rows, 16 pixels at
-;* a time (16x8 input), transposing the two 8x8 blocks into 8x16 that will
-;* later be internally transposed
-;*****************************************************************************
-;* void ol_sobel_sse2_gx_v(uint8_t *src, int16_t *dst, size_t w, size_t h);
-;* void ol_sobel_sse2_gx_h(int16_t *src, int16_t *dst, size_t w, size_t h);
-;* void ol_sobel_sse2_gy_v(uint8_t *src, int16_t *dst, size_t w, size_t h);
-;* void ol_sobel_sse2_gy_h(int16_t *src, int16_t *dst, size_t w, size_t h);
-;*****************************************************************************
-
-; there are four variants generated from a single macro
-%macro SOBEL 4
-cglobal sobel_sse2_%1_%2, 4,4,7
-    shl     r3, 1
-
-    ; prime m0-1 amd m2-3 with first two rows
-%if %4 == 1
-    ; u8 input, load two 16-byte rows and unpack
-    pxor    m6, m6
-    mova    m0, [r0]
-    mova    m2, [r0+r2]
-    mova    m1, m0
-    mova    m3, m2
-    punpcklbw m0, m6
-    punpckhbw m1, m6
-    punpcklbw m2, m6
-    punpckhbw m3, m6
-%elif %4 == 2
-    ; s16 input, load two 2x8-short rows
-    shl     r2, 1
-    mova    m0, [r0]
-    mova    m1, [r0+16]
-    mova    m2, [r0+r2]
-    mova    m3, [r0+r2+16]
-%endif
-
-    ; do 8 rows
-%rep 8
-    ; load the third row
-    mova    m4, [r0+2*r2]
-%if %4 == 1
-    mova    m5, m4
-    punpcklbw m4, m6
-    punpckhbw m5, m6
-%elif %4 == 2
-    mova    m5, [r0+2*r2+16]
-%endif
-    add     r0, r2
-
-    ; perform the kernel operation
-%if %3 == 0
-    ; [1, 2, 1]
-    paddw   m0, m2
-    paddw   m1, m3
-    paddw   m0, m2
-    paddw   m1, m3
-    paddw   m0, m4
-    paddw   m1, m5
-%elif %3 == 1
-    ; [1, 0, -1]
-    psubw   m0, m4
-    psubw   m1, m5
-%endif
-
-    ; store
-    mova    [r1], m0
-    mova    [r1+8*r3], m1
-    add     r1, r3
-
-    ; shift rows for the next iteration
-    SWAP    m0, m2
-    SWAP    m1, m3
-    SWAP    m2, m4
-    SWAP    m3, m5
-%endrep
-
-    RET
-%endmacro
-
-; generate the Sobel variants
-SOBEL gx, v, 0, 1
-SOBEL gx, h, 1, 2
-SOBEL gy, v, 1, 1
-SOBEL gy, h, 0, 2
-
 ;*****************************************************************************
 ;* SSE2 2x8x8 Transpose
 ;* input: u8
@@ -382,50 +244,3 @@ cglobal transpose_2x8x8, 2,5,9
     mov     esp, r4
 %endif
     RET
-
-;*****************************************************************************
-;* SSE2 8x8 Transpose
-;* input: s16
-;* output: s16
-;* Transposes 8x8 shorts
-;*****************************************************************************
-;* void ol_transpose_8x8w(u16 *p);
-;*****************************************************************************
-
-cglobal transpose_8x8w, 2,5,9
-%if ARCH_X86_64
-    %define t0 8
-    %define t1 9
-%else
-    %define t0 [rsp-mmsize]
-    %define t1 [rsp-2*mmsize]
-    mov     r4, esp
-    and     esp, ~15
-%endif
-
-    lea     r2, [r0+r1]
-    lea     r3, [r1+2*r1]
-    mova    m0, [r0]
-    mova    m1, [r2]
-    mova    m2, [r0+2*r1]
-    mova    m3, [r2+2*r1]
-    mova    m4, [r0+4*r1]
-    mova    m5, [r2+4*r1]
-    mova    m6, [r0+2*r3]
-    mova    m7, [r2+2*r3]
-
-    TRANSPOSE8x8W 0, 1, 2, 3, 4, 5, 6, 7, t0, t1
-
-    mova    [r0], m0
-    mova    [r2], m1
-    mova    [r0+2*r1], m2
-    mova    [r2+2*r1], m3
-    mova    [r0+4*r1], m4
-    mova    [r2+4*r1], m5
-    mova    [r0+2*r3], m6
-    mova    [r2+2*r3], m7
-
-%if ARCH_X86_64 == 0
-    mov     esp, r4
-%endif
-    RET
@@ -18,6 +18,7 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
 */
 
 #include "libol.h"
+#include "transform.h"
 #include <jack/jack.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -25,21 +26,23 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
 #include <string.h>
 #include <math.h>
 #include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdatomic.h>
+#include <errno.h>
 
 typedef jack_default_audio_sample_t sample_t;
 typedef jack_nframes_t nframes_t;
 
-static jack_port_t *out_x[OL_MAX_OUTPUTS];
-static jack_port_t *out_y[OL_MAX_OUTPUTS];
-static jack_port_t *out_r[OL_MAX_OUTPUTS];
-static jack_port_t *out_g[OL_MAX_OUTPUTS];
-static jack_port_t *out_b[OL_MAX_OUTPUTS];
-static jack_port_t *out_al;
-static jack_port_t *out_ar;
+#define SMALL_Z 0.00001f
 
-static jack_client_t *client;
+#define MAX_DETAIL_LEVEL 16
+// stepping back to a finer level needs it to fit in this much of the budget
+#define DETAIL_HEADROOM 0.9f
 
-#define SMALL_Z 0.00001f
+// seconds without repeated frames before queueing one frame less ahead
+#define LEAD_SETTLE 5.0
 
 typedef struct {
 	float x,y,z;
@@ -48,10 +51,68 @@ typedef struct {
 
 typedef struct {
 	int pointcnt;
+	// points culled outside the scissor; they still count for min_length
+	int skipped;
 	Point *points;
 	float bbox[2][2];
 } Object;
 
+// Uniform grid over object endpoints, used to find the next nearest object
+// when reordering. Entries are object index * 2 + reversed flag.
+typedef struct {
+	int gw, gh;
+	float x0, y0;
+	float icw, ich;
+	float cmin;
+	int cellmax;
+	int *cell_start;
+	int *cell_cnt;
+	int entmax;
+	int *entries;
+	int built;
+	int live;
+} ObjGrid;
+
+typedef struct {
+	int pointcnt;
+	float sx, sy;
+	float ex, ey;
+} TourKey;
+
+// An optimized order and the start point it was planned from. Plans cut
+// short by the time budget are refined further each time they are reused.
+typedef struct {
+	int valid;
+	int converged;
+	int pos, move; // where refinement stopped
+	int quiet; // objects looked at since a move last helped
+	float start_x, start_y;
+	int n;
+	int greedy_cost;
+	int saved;
+	int *ord;
+	uint8_t *inv;
+} TourPlan;
+
+// Object order for RENDER_OPTIMIZE, plus the last optimized orders and what
+// they were computed for, so static scenes are optimized once. Each frame
+// starts where the previous one ended, which for a static scene alternates
+// between the two ends of the tour, so two plans are kept.
+typedef struct {
+	int max;
+	TourKey *keys;
+	int n;
+	int *ord;
+	uint8_t *inv;
+	int cache_objcnt;
+	TourKey *cache_keys;
+	int cache_flags;
+	float cache_off_speed;
+	int cache_start_wait, cache_end_wait;
+	TourPlan plans[2];
+	int next_plan;
+} Tour;
+
 typedef struct {
 	int objcnt;
 	int objmax;
@@ -59,25 +120,44 @@ typedef struct {
 	int psmax;
 	int psnext;
 	Point *points;
+	int rpmax;
+	int rpnext;
+	Point *rpoints;
+	int dropped;
+	int culled;
+	ObjGrid grid;
+	Tour tour;
+	// what the last frame rendered from: if the next one hashes the same,
+	// its samples are copied from ring slot reuse_slot instead
+	int reuse_valid;
+	uint64_t reuse_hash;
+	int reuse_slot;
+	int reuse_count;
+	OLFrameInfo reuse_info;
 } Frame;
 
+// Ready to play samples, one float plane per channel. All planes of one
+// output share a single allocation, x first.
 typedef struct {
-	int pmax;
 	int pnext;
-	Point *points[OL_MAX_OUTPUTS];
+	int pmax[OL_MAX_OUTPUTS];
+	float *x[OL_MAX_OUTPUTS];
+	float *y[OL_MAX_OUTPUTS];
+	float *r[OL_MAX_OUTPUTS];
+	float *g[OL_MAX_OUTPUTS];
+	float *b[OL_MAX_OUTPUTS];
+	int amax;
 	float *audio_l;
 	float *audio_r;
 } RenderedFrame;
 
-static OLConfig g_config;
-
-static RenderedFrame *frames;
-static nframes_t jack_rate;
-
-static OLFrameInfo last_info;
-
-static Frame wframes[OL_MAX_OUTPUTS];
-static Frame *wframe;
+typedef struct {
+	int (*open)(OLContext *ctx);
+	void (*close)(OLContext *ctx);
+	// synchronous backends consume each frame as soon as it is rendered,
+	// asynchronous ones (NULL) drain the frame ring on their own
+	void (*write)(OLContext *ctx, RenderedFrame *frame);
+} OutputBackend;
 
 typedef struct {
 	Object *curobj;
@@ -87,47 +167,190 @@ typedef struct {
 	int prim;
 	int state;
 	int points;
+	int overflow;
+	// segments entirely outside the scissor are not interpolated; off when
+	// a pixel shader could move points back in
+	int cull;
+	float extent[2][2];
+	// last olVertex3() in clip space, for clipping line strips against the
+	// near plane
+	float clip[4];
+	int clip_valid;
+	// motion planner: the line from last_slope to last_point is held back
+	// until the next vertex says how fast it may leave its end; speed is how
+	// fast it starts
+	int pending;
+	float speed;
 } DrawState;
 
-static DrawState dstate;
+typedef struct {
+	sample_t *x[OL_MAX_OUTPUTS];
+	sample_t *y[OL_MAX_OUTPUTS];
+	sample_t *r[OL_MAX_OUTPUTS];
+	sample_t *g[OL_MAX_OUTPUTS];
+	sample_t *b[OL_MAX_OUTPUTS];
+	sample_t *al;
+	sample_t *ar;
+} SampleBuffers;
+
+typedef struct {
+	OLContext *ctx;
+	int output;
+	pthread_t thread;
+} RenderWorker;
+
+#define MTX_STACK_DEPTH 16
+
+typedef struct {
+	float x, y, z;
+	uint32_t color;
+	int is3d;
+} ListVertex;
 
-static OLRenderParams params;
+typedef struct {
+	int prim;
+	int vfirst;
+	int vcount;
+	int pfirst;
+	int pcount;
+} ListObject;
+
+// Recorded olBegin()/olVertex()/olEnd() calls, plus the tessellated points of
+// the 2D objects in list coordinates. The tessellation is only valid for the
+// render parameters and matrix scale it was made with.
+struct OLDisplayList {
+	int objcnt;
+	int objmax;
+	ListObject *objects;
+	int vcnt;
+	int vmax;
+	ListVertex *vertices;
+	int has3d;
+	int open;
+
+	int cached;
+	float scale[2];
+	OLRenderParams params;
+	int pcnt;
+	int pmax;
+	Point *points;
+};
+
+struct OLContext {
+	OLConfig config;
+	const OutputBackend *backend;
+
+	jack_client_t *client;
+	jack_port_t *out_x[OL_MAX_OUTPUTS];
+	jack_port_t *out_y[OL_MAX_OUTPUTS];
+	jack_port_t *out_r[OL_MAX_OUTPUTS];
+	jack_port_t *out_g[OL_MAX_OUTPUTS];
+	jack_port_t *out_b[OL_MAX_OUTPUTS];
+	jack_port_t *out_al;
+	jack_port_t *out_ar;
+	nframes_t jack_rate;
+
+	FILE *out_file;
+	long out_file_samples;
+	int out_file_frames;
+	// set once the format cannot describe any more, frames are dropped after
+	int out_file_full;
+
+	// Single producer (olRenderFrame) single consumer (process) frame ring.
+	// crbuf is only written by the consumer, cwbuf only by the producer;
+	// frame_free is posted whenever the consumer releases a slot.
+	RenderedFrame *frames;
+	atomic_int crbuf;
+	atomic_int cwbuf;
+	atomic_int first_time_full;
+	// Only written by the consumer: process() calls, the silent ones before
+	// the first frame, frames replayed, samples written, and time spent in
+	// ns in total, at most, and at most since olRenderFrame() last took it
+	atomic_uint rt_callbacks;
+	atomic_uint rt_dummies;
+	atomic_uint rt_repeats;
+	atomic_ullong rt_samples;
+	atomic_ullong rt_total_ns;
+	atomic_uint rt_peak_ns;
+	atomic_uint rt_max_ns;
+	sem_t frame_free;
+	int fbufs;
+	// frames the producer may have queued (see min_buffer_count) and when
+	// that last changed; repeats seen so far, and not yet logged since when
+	int buflag;
+	double lead_time;
+	unsigned int seen_repeats;
+	unsigned int log_repeats;
+	double log_time;
+	int out_point;
+	int first_output_frame;
+
+	OLFrameInfo last_info;
+	OLFrameInfo out_info[OL_MAX_OUTPUTS];
+
+	Frame wframes[OL_MAX_OUTPUTS];
+	Frame *wframe;
+	DrawState dstate;
+	// what objects are drawn with: user_params (as set by the application)
+	// coarsened to the current detail level
+	OLRenderParams params;
+	OLRenderParams user_params;
+	int detail_level;
+	// points needed by the last frame drawn at each level, and when
+	int detail_points[MAX_DETAIL_LEVEL + 1];
+	unsigned int detail_seen[MAX_DETAIL_LEVEL + 1];
+	unsigned int detail_frames;
+	Point last_render_point[OL_MAX_OUTPUTS];
 
-static Point last_render_point[OL_MAX_OUTPUTS];
+	float bbox[2][2];
 
-static volatile int crbuf;
-static volatile int cwbuf;
-static int fbufs;
-static int buflag;
-static int out_point;
-static int first_time_full;
-static int first_output_frame;
+	int mtx2dp;
+	float mtx2ds[MTX_STACK_DEPTH][3][3];
+	float mtx2d[3][3];
 
-float bbox[2][2];
+	int mtx3dp;
+	float mtx3ds[MTX_STACK_DEPTH][4][4];
+	float mtx3d[4][4];
 
-#define MTX_STACK_DEPTH 16
+	int coldp;
+	uint32_t cols[MTX_STACK_DEPTH];
+	uint32_t curcol;
 
-int mtx2dp = 0;
-float mtx2ds[MTX_STACK_DEPTH][3][3];
-float mtx2d[3][3];
+	ShaderFunc vpreshader;
+	ShaderFunc vshader;
+	Shader3Func v3shader;
+	ShaderFunc pshader;
+	Shader3Func p3shader;
 
-int mtx3dp = 0;
-float mtx3ds[MTX_STACK_DEPTH][4][4];
-float mtx3d[4][4];
+	AudioCallbackFunc audiocb;
+	FrameCallbackFunc framecb;
 
-int coldp = 0;
-uint32_t cols[MTX_STACK_DEPTH];
-uint32_t curcol;
+	OLDisplayList *recording;
+	int nocull;
 
-#define POINT(x, y, z, color) ((Point){x,y,z,color})
+	int va_size, va_stride;
+	const float *va_pointer;
+	int ca_stride;
+	const uint32_t *ca_pointer;
 
-ShaderFunc vpreshader;
-ShaderFunc vshader;
-Shader3Func v3shader;
-ShaderFunc pshader;
-Shader3Func p3shader;
+	RenderWorker workers[OL_MAX_OUTPUTS];
+	pthread_mutex_t render_lock;
+	pthread_cond_t render_start;
+	pthread_cond_t render_done;
+	unsigned int render_gen;
+	int render_busy;
+	int render_quit;
+	int render_fps;
+	int render_counts[OL_MAX_OUTPUTS];
 
-AudioCallbackFunc audiocb;
+	// when the last olRenderFrame() returned, and pixel shader time since
+	double draw_start;
+	double shader_time;
+};
+
+static OLContext *default_ctx;
+
+#define POINT(x, y, z, color) ((Point){x,y,z,color})
 
 LogCallbackFunc log_cb;
 
@@ -140,15 +363,68 @@ static uint32_t colmul(uint32_t a, uint32_t b)
     return out;
 }
 
-static Point *ps_alloc(int count)
+static double get_time(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Adds the time since *t to *stage and moves *t on to now
+static inline void lap(double *t, float *stage)
+{
+	double now = get_time();
+	*stage += now - *t;
+	*t = now;
+}
+
+#define INITIAL_POINTS 1024
+
+// Point buffers start small and double as needed, up to config.max_points
+// (if set). They are never shrunk, so a running show stops allocating once
+// it has seen its largest frame. Returns the new size, or 0 if need is over
+// the limit.
+static int grow_size(OLContext *ctx, int cur, int need, int limited)
+{
+	int limit = limited ? ctx->config.max_points : 0;
+	int size = cur ? cur : INITIAL_POINTS;
+
+	if (limit && need > limit)
+		return 0;
+	while (size < need)
+		size *= 2;
+	if (limit && size > limit)
+		size = limit;
+	return size;
+}
+
+static int ps_grow(OLContext *ctx, Frame *frame, int need)
+{
+	int size = grow_size(ctx, frame->psmax, need, 1);
+	Point *points;
+
+	if (!size || !(points = malloc(size * sizeof(Point))))
+		return -1;
+	if (frame->psnext)
+		memcpy(points, frame->points, frame->psnext * sizeof(Point));
+	// objects point into the buffer, including the one being drawn
+	int objcnt = frame->objcnt + (ctx->dstate.curobj != NULL);
+	for (int i = 0; i < objcnt; i++)
+		frame->objects[i].points = points + (frame->objects[i].points - frame->points);
+	free(frame->points);
+	frame->points = points;
+	frame->psmax = size;
+	return 0;
+}
+
+static Point *ps_alloc(OLContext *ctx, int count)
 {
 	Point *ret;
-	if ((count + wframe->psnext) > wframe->psmax) {
-		olLog("Point buffer overflow (temp): need %d points, have %d\n", count + wframe->psnext, wframe->psmax);
-		exit(1);
-	}
-	ret = wframe->points + wframe->psnext;
-	wframe->psnext += count;
+	if ((count + ctx->wframe->psnext) > ctx->wframe->psmax &&
+		ps_grow(ctx, ctx->wframe, count + ctx->wframe->psnext) < 0)
+		return NULL;
+	ret = ctx->wframe->points + ctx->wframe->psnext;
+	ctx->wframe->psnext += count;
 	return ret;
 }
 
@@ -160,8 +436,9 @@ static int bufsize (nframes_t nframes, void *arg)
 
 static int srate (nframes_t nframes, void *arg)
 {
-	jack_rate = nframes;
-	olLog ("Playing back at %u Hz\n", jack_rate);
+	OLContext *ctx = arg;
+	ctx->jack_rate = nframes;
+	olLog ("Playing back at %u Hz\n", ctx->jack_rate);
 	return 0;
 }
 
@@ -170,1085 +447,3455 @@ static void jack_shutdown (void *arg)
 	olLog ("jack_shutdown\n");
 }
 
+// Copies count samples starting at start into the output buffers, advancing
+// the buffer pointers past them
+static void copy_samples(OLContext *ctx, SampleBuffers *sb, RenderedFrame *frame, int start, int count)
+{
+	size_t size = count * sizeof(sample_t);
+
+	for (int i = 0; i < ctx->config.num_outputs; i++) {
+		memcpy(sb->x[i], frame->x[i] + start, size);
+		memcpy(sb->y[i], frame->y[i] + start, size);
+		memcpy(sb->r[i], frame->r[i] + start, size);
+		memcpy(sb->g[i], frame->g[i] + start, size);
+		memcpy(sb->b[i], frame->b[i] + start, size);
+		sb->x[i] += count;
+		sb->y[i] += count;
+		sb->r[i] += count;
+		sb->g[i] += count;
+		sb->b[i] += count;
+	}
+	memcpy(sb->al, frame->audio_l + start, size);
+	memcpy(sb->ar, frame->audio_r + start, size);
+	sb->al += count;
+	sb->ar += count;
+}
+
+static void atomic_max(atomic_uint *max, unsigned int value)
+{
+	unsigned int cur = atomic_load_explicit(max, memory_order_relaxed);
+	while (value > cur && !atomic_compare_exchange_weak_explicit(max, &cur, value,
+	                                                             memory_order_relaxed, memory_order_relaxed));
+}
+
+static void rt_account(OLContext *ctx, double start, nframes_t nframes)
+{
+	unsigned int ns = (get_time() - start) * 1e9;
+
+	atomic_fetch_add_explicit(&ctx->rt_callbacks, 1, memory_order_relaxed);
+	atomic_fetch_add_explicit(&ctx->rt_samples, nframes, memory_order_relaxed);
+	atomic_fetch_add_explicit(&ctx->rt_total_ns, ns, memory_order_relaxed);
+	atomic_max(&ctx->rt_peak_ns, ns);
+	atomic_max(&ctx->rt_max_ns, ns);
+}
+
 static int process (nframes_t nframes, void *arg)
 {
-	sample_t *o_x[OL_MAX_OUTPUTS], *o_y[OL_MAX_OUTPUTS];
-	sample_t *o_r[OL_MAX_OUTPUTS], *o_g[OL_MAX_OUTPUTS], *o_b[OL_MAX_OUTPUTS];
+	OLContext *ctx = arg;
+	SampleBuffers sb;
+	double start = get_time();
+	nframes_t total = nframes;
 
-	sample_t *o_al = (sample_t *) jack_port_get_buffer (out_al, nframes);
-	sample_t *o_ar = (sample_t *) jack_port_get_buffer (out_ar, nframes);
+	sb.al = (sample_t *) jack_port_get_buffer (ctx->out_al, nframes);
+	sb.ar = (sample_t *) jack_port_get_buffer (ctx->out_ar, nframes);
 
-	for (int i = 0; i < g_config.num_outputs; i++) {
-		o_x[i] = (sample_t *) jack_port_get_buffer (out_x[i], nframes);
-		o_y[i] = (sample_t *) jack_port_get_buffer (out_y[i], nframes);
-		o_r[i] = (sample_t *) jack_port_get_buffer (out_r[i], nframes);
-		o_g[i] = (sample_t *) jack_port_get_buffer (out_g[i], nframes);
-		o_b[i] = (sample_t *) jack_port_get_buffer (out_b[i], nframes);
+	for (int i = 0; i < ctx->config.num_outputs; i++) {
+		sb.x[i] = (sample_t *) jack_port_get_buffer (ctx->out_x[i], nframes);
+		sb.y[i] = (sample_t *) jack_port_get_buffer (ctx->out_y[i], nframes);
+		sb.r[i] = (sample_t *) jack_port_get_buffer (ctx->out_r[i], nframes);
+		sb.g[i] = (sample_t *) jack_port_get_buffer (ctx->out_g[i], nframes);
+		sb.b[i] = (sample_t *) jack_port_get_buffer (ctx->out_b[i], nframes);
 	}
 
-	if (!first_time_full) {
+	if (!atomic_load_explicit(&ctx->first_time_full, memory_order_acquire)) {
 		//olLog("Dummy frame!\n");
-		for (int i = 0; i < g_config.num_outputs; i++) {
-			memset(o_x[i], 0, nframes * sizeof(sample_t));
-			memset(o_y[i], 0, nframes * sizeof(sample_t));
-			memset(o_r[i], 0, nframes * sizeof(sample_t));
-			memset(o_g[i], 0, nframes * sizeof(sample_t));
-			memset(o_b[i], 0, nframes * sizeof(sample_t));
+		atomic_fetch_add_explicit(&ctx->rt_dummies, 1, memory_order_relaxed);
+		for (int i = 0; i < ctx->config.num_outputs; i++) {
+			memset(sb.x[i], 0, nframes * sizeof(sample_t));
+			memset(sb.y[i], 0, nframes * sizeof(sample_t));
+			memset(sb.r[i], 0, nframes * sizeof(sample_t));
+			memset(sb.g[i], 0, nframes * sizeof(sample_t));
+			memset(sb.b[i], 0, nframes * sizeof(sample_t));
 		}
-		memset(o_al, 0, nframes * sizeof(sample_t));
-		memset(o_ar, 0, nframes * sizeof(sample_t));
+		memset(sb.al, 0, nframes * sizeof(sample_t));
+		memset(sb.ar, 0, nframes * sizeof(sample_t));
+		rt_account(ctx, start, total);
 		return 0;
 	}
 
+	int rd = atomic_load_explicit(&ctx->crbuf, memory_order_relaxed);
+
 	while(nframes) {
-		if (out_point == -1) {
-			if (!first_output_frame) {
-				//olLog("First frame! %d\n", crbuf);
-				first_output_frame = 1;
+		if (ctx->out_point == -1) {
+			if (!ctx->first_output_frame) {
+				//olLog("First frame! %d\n", rd);
+				ctx->first_output_frame = 1;
 			} else {
-				if ((crbuf+1)%fbufs == cwbuf) {
-					//olLog("Duplicated frame! %d\n", crbuf);
+				if ((rd+1)%ctx->fbufs == atomic_load_explicit(&ctx->cwbuf, memory_order_acquire)) {
+					//olLog("Duplicated frame! %d\n", rd);
+					atomic_fetch_add_explicit(&ctx->rt_repeats, 1, memory_order_relaxed);
 				} else {
-					crbuf = (crbuf+1)%fbufs;
-					//olLog("Normal frame! %d\n", crbuf);
+					rd = (rd+1)%ctx->fbufs;
+					atomic_store_explicit(&ctx->crbuf, rd, memory_order_release);
+					sem_post(&ctx->frame_free);
+					//olLog("Normal frame! %d\n", rd);
 				}
 			}
-			out_point = 0;
+			ctx->out_point = 0;
 		}
 		int count = nframes;
-		int left = frames[crbuf].pnext - out_point;
+		int left = ctx->frames[rd].pnext - ctx->out_point;
 		if (count > left)
 			count = left;
-		int i;
-		for (i=0; i<count; i++) {
-			for (int i = 0; i < g_config.num_outputs; i++) {
-				Point *p = &frames[crbuf].points[i][out_point];
-				*o_x[i]++ = p->x;
-				*o_y[i]++ = p->y;
-
-				*o_r[i]++ = ((p->color >> 16) & 0xff) / 255.0f;
-				*o_g[i]++ = ((p->color >> 8) & 0xff) / 255.0f;
-				*o_b[i]++ = (p->color & 0xff) / 255.0f;
-			}
-
-			*o_al++ = frames[crbuf].audio_l[out_point];
-			*o_ar++ = frames[crbuf].audio_r[out_point];
-			out_point++;
-			//olLog("%06x %f %f\n", p->x, p->y, p->color);
-		}
-		if (out_point == frames[crbuf].pnext)
-			out_point = -1;
+		copy_samples(ctx, &sb, &ctx->frames[rd], ctx->out_point, count);
+		ctx->out_point += count;
+		if (ctx->out_point == ctx->frames[rd].pnext)
+			ctx->out_point = -1;
 		nframes -= count;
 	}
+	rt_account(ctx, start, total);
 	return 0;
 }
 
-int olInit(int buffer_count, int max_points)
-{
-	OLConfig config = {
-		.buffer_count = buffer_count,
-		.max_points = max_points,
-		.num_outputs = 1,
-	};
-
-	return olInit2(&config);
-}
-
-int olInit2(const OLConfig *config)
+static int jack_open(OLContext *ctx)
 {
+	const OLConfig *config = &ctx->config;
 	int i;
 	static const char jack_client_name[] = "libol";
 	jack_status_t jack_status;
 
-	if (config->buffer_count < 2)
-		return -1;
-
-	g_config = *config;
-
-	memset(&dstate, 0, sizeof(dstate));
-	memset(&last_render_point, 0, sizeof(last_render_point));
-
-	buflag = config->buffer_count;
-	fbufs = config->buffer_count+1;
-
-	cwbuf = 0;
-	crbuf = 0;
-	out_point = -1;
-	first_time_full = 0;
-	first_output_frame = 0;
-	
-	for (i=0; i<config->num_outputs; i++) {
-		wframe = &wframes[i];
-		memset(wframe, 0, sizeof(Frame));
-		wframe->objmax = 16;
-		wframe->objects = malloc(wframe->objmax * sizeof(Object));
-		wframe->psmax = config->max_points;
-		wframe->points = malloc(wframe->psmax * sizeof(Point));
-	}
-	wframe = &wframes[0];
-
-	frames = malloc(fbufs * sizeof(RenderedFrame));
-	for (i=0; i<fbufs; i++) {
-		memset(&frames[i], 0, sizeof(RenderedFrame));
-		frames[i].pmax = config->max_points;
-		for (int j=0; j<config->num_outputs; j++) {
-			frames[i].points[j] = malloc(frames[i].pmax * sizeof(Point));
-		}
-		frames[i].audio_l = malloc(frames[i].pmax * sizeof(float));
-		frames[i].audio_r = malloc(frames[i].pmax * sizeof(float));
-	}
-
-	if ((client = jack_client_open(jack_client_name, JackNullOption, &jack_status)) == 0) {
+	if ((ctx->client = jack_client_open(jack_client_name, JackNullOption, &jack_status)) == 0) {
 		olLog ("jack server not running?\n");
 		return -1;
 	}
 
-	jack_set_process_callback (client, process, 0);
-	jack_set_buffer_size_callback (client, bufsize, 0);
-	jack_set_sample_rate_callback (client, srate, 0);
-	jack_on_shutdown (client, jack_shutdown, 0);
+	jack_set_process_callback (ctx->client, process, ctx);
+	jack_set_buffer_size_callback (ctx->client, bufsize, ctx);
+	jack_set_sample_rate_callback (ctx->client, srate, ctx);
+	jack_on_shutdown (ctx->client, jack_shutdown, ctx);
 
-	out_x[0] = jack_port_register (client, "out_x", JACK_DEFAULT_AUDIO_TYPE, JackPortIsOutput, 0);
-	out_y[0] = jack_port_register (client, "out_y", JACK_DEFAULT_AUDIO_TYPE, JackPortIsOutput, 0);
-	out_r[0] = jack_port_register (client, "out_r", JACK_DEFAULT_AUDIO_TYPE, JackPortIsOutput, 0);
-	out_g[0] = jack_port_register (client, "out_g", JACK_DEFAULT_AUDIO_TYPE, JackPortIsOutput, 0);
-	out_b[0] = jack_port_register (client, "out_b", JACK_DEFAULT_AUDIO_TYPE, JackPortIsOutput, 0);
+	ctx->out_x[0] = jack_port_register (ctx->client, "out_x", JACK_DEFAULT_AUDIO_TYPE, JackPortIsOutput, 0);
+	ctx->out_y[0] = jack_port_register (ctx->client, "out_y", JACK_DEFAULT_AUDIO_TYPE, JackPortIsOutput, 0);
+	ctx->out_r[0] = jack_port_register (ctx->client, "out_r", JACK_DEFAULT_AUDIO_TYPE, JackPortIsOutput, 0);
+	ctx->out_g[0] = jack_port_register (ctx->client, "out_g", JACK_DEFAULT_AUDIO_TYPE, JackPortIsOutput, 0);
+	ctx->out_b[0] = jack_port_register (ctx->client, "out_b", JACK_DEFAULT_AUDIO_TYPE, JackPortIsOutput, 0);
 	for (i=1; i<config->num_outputs; i++) {
 		char buf[32];
 		snprintf(buf, 32, "out%d_x", i);
-		out_x[i] = jack_port_register (client, buf, JACK_DEFAULT_AUDIO_TYPE, JackPortIsOutput, 0);
+		ctx->out_x[i] = jack_port_register (ctx->client, buf, JACK_DEFAULT_AUDIO_TYPE, JackPortIsOutput, 0);
 		snprintf(buf, 32, "out%d_y", i);
-		out_y[i] = jack_port_register (client, buf, JACK_DEFAULT_AUDIO_TYPE, JackPortIsOutput, 0);
+		ctx->out_y[i] = jack_port_register (ctx->client, buf, JACK_DEFAULT_AUDIO_TYPE, JackPortIsOutput, 0);
 		snprintf(buf, 32, "out%d_r", i);
-		out_r[i] = jack_port_register (client, buf, JACK_DEFAULT_AUDIO_TYPE, JackPortIsOutput, 0);
+		ctx->out_r[i] = jack_port_register (ctx->client, buf, JACK_DEFAULT_AUDIO_TYPE, JackPortIsOutput, 0);
 		snprintf(buf, 32, "out%d_g", i);
-		out_g[i] = jack_port_register (client, buf, JACK_DEFAULT_AUDIO_TYPE, JackPortIsOutput, 0);
+		ctx->out_g[i] = jack_port_register (ctx->client, buf, JACK_DEFAULT_AUDIO_TYPE, JackPortIsOutput, 0);
 		snprintf(buf, 32, "out%d_b", i);
-		out_b[i] = jack_port_register (client, buf, JACK_DEFAULT_AUDIO_TYPE, JackPortIsOutput, 0);
+		ctx->out_b[i] = jack_port_register (ctx->client, buf, JACK_DEFAULT_AUDIO_TYPE, JackPortIsOutput, 0);
 	}
-	out_al = jack_port_register (client, "out_al", JACK_DEFAULT_AUDIO_TYPE, JackPortIsOutput, 0);
-	out_ar = jack_port_register (client, "out_ar", JACK_DEFAULT_AUDIO_TYPE, JackPortIsOutput, 0);
+	ctx->out_al = jack_port_register (ctx->client, "out_al", JACK_DEFAULT_AUDIO_TYPE, JackPortIsOutput, 0);
+	ctx->out_ar = jack_port_register (ctx->client, "out_ar", JACK_DEFAULT_AUDIO_TYPE, JackPortIsOutput, 0);
 
-	if (jack_activate (client)) {
+	if (jack_activate (ctx->client)) {
 		olLog ("cannot activate client");
 		return -1;
 	}
 
-	olLoadIdentity();
-	for(i=0; i<MTX_STACK_DEPTH; i++)
-		olPushMatrix();
-	mtx2dp = 0;
-
-	olLoadIdentity3();
-	for(i=0; i<MTX_STACK_DEPTH; i++)
-		olPushMatrix3();
-	mtx3dp = 0;
-
-	olResetColor();
-	for(i=0; i<MTX_STACK_DEPTH; i++)
-		olPushColor();
-	coldp = 0;
-
-	bbox[0][0] = -1;
-	bbox[0][1] = -1;
-	bbox[1][0] = 1;
-	bbox[1][1] = 1;
-
-	vpreshader = NULL;
-	vshader = NULL;
-	v3shader = NULL;
-	pshader = NULL;
-	audiocb = NULL;
-
 	return 0;
 }
 
-void olSetRenderParams(OLRenderParams *sp)
+static void jack_close(OLContext *ctx)
 {
-	params = *sp;
+	jack_client_close (ctx->client);
 }
 
-void olGetRenderParams(OLRenderParams *sp)
+/*
+Offline backends: frames are consumed synchronously from olRenderFrame() as
+soon as they are rendered, so rendering runs as fast as the CPU allows and the
+output is fully deterministic. The null backend only hands the samples to the
+frame callback; the file backend also writes them out.
+*/
+
+static void put_le16(uint8_t *p, uint16_t v)
 {
-	*sp = params;
+	p[0] = v;
+	p[1] = v >> 8;
 }
 
-void olShutdown(void)
+static void put_le32(uint8_t *p, uint32_t v)
 {
-	jack_client_close (client);
+	p[0] = v;
+	p[1] = v >> 8;
+	p[2] = v >> 16;
+	p[3] = v >> 24;
 }
 
-void olBegin(int prim)
+static void put_be16(uint8_t *p, uint16_t v)
 {
-	if (dstate.curobj)
-		return;
-	if (wframe->objmax == wframe->objcnt) {
-		wframe->objmax *= 2;
-		wframe->objects = realloc(wframe->objects, wframe->objmax * sizeof(Object));
-	}
-	dstate.curobj = wframe->objects + wframe->objcnt;
-	memset(dstate.curobj, 0, sizeof(Object));
-	memcpy(dstate.curobj->bbox, bbox, sizeof(bbox));
-	dstate.curobj->points = wframe->points + wframe->psnext;
-	dstate.prim = prim;
-	dstate.state = 0;
-	dstate.points = 0;
+	p[0] = v >> 8;
+	p[1] = v;
 }
 
-static int near(Point a, Point b)
+// RIFF sizes are 32 bits and count the 36 header bytes after them
+#define WAV_MAX_DATA (0xffffffffUL - 36)
+// ILDA frame numbers and counts are 16 bits
+#define ILDA_MAX_FRAMES 0xffff
+
+static int file_channels(OLContext *ctx)
 {
-	float dx = a.x - b.x;
-	float dy = a.y - b.y;
-	return sqrtf(dx*dx+dy*dy) <= params.snap;
+	return 5 * ctx->config.num_outputs + 2;
 }
 
-static void addpoint(float x, float y, float z, uint32_t color)
+static void write_wav_header(OLContext *ctx)
 {
-	Point *pnt = ps_alloc(1);
-	pnt->x = x;
-	pnt->y = y;
-	pnt->z = z;
-	pnt->color = color;
-	dstate.curobj->pointcnt++;
+	uint8_t hdr[44];
+	int channels = file_channels(ctx);
+	uint32_t data_size = ctx->out_file_samples * channels * sizeof(float);
+
+	memcpy(hdr, "RIFF", 4);
+	put_le32(hdr + 4, 36 + data_size);
+	memcpy(hdr + 8, "WAVEfmt ", 8);
+	put_le32(hdr + 16, 16);
+	put_le16(hdr + 20, 3); // IEEE float
+	put_le16(hdr + 22, channels);
+	put_le32(hdr + 24, ctx->params.rate);
+	put_le32(hdr + 28, ctx->params.rate * channels * sizeof(float));
+	put_le16(hdr + 32, channels * sizeof(float));
+	put_le16(hdr + 34, 8 * sizeof(float));
+	memcpy(hdr + 36, "data", 4);
+	put_le32(hdr + 40, data_size);
+
+	fwrite(hdr, sizeof(hdr), 1, ctx->out_file);
 }
 
-static int get_dwell(float x, float y)
+// One ILDA format 5 (2D true color) section per output, output number in the
+// scanner field. Frames longer than an ILDA section can hold are truncated.
+static void write_ilda_section(OLContext *ctx, int output, int frameno, RenderedFrame *frame, int count)
 {
-	if (dstate.points == 1) {
-		return params.start_dwell;
-	} else {
-		float ex = dstate.last_point.x;
-		float ey = dstate.last_point.y;
-		float ecx = dstate.last_slope.x;
-		float ecy = dstate.last_slope.y;
-		float sx = ex;
-		float sy = ey;
-		float scx = x;
-		float scy = y;
-		float dex = ecx-ex;
-		float dey = ecy-ey;
-		float dsx = sx-scx;
-		float dsy = sy-scy;
-		float dot = dex*dsx + dey*dsy;
-		float lens = sqrtf(dex*dex+dey*dey) * sqrtf(dsx*dsx+dsy*dsy);
-		//olLog("%f,%f -> %f,%f -> %f,%f\n", ecx,ecy,ex,ey,x,y);
-		if (lens == 0) {
-			//olLog("deg cor\n");
-			return params.corner_dwell;
-		} else {
-			dot = dot / lens;
-			if (dot > params.curve_angle) {
-				//olLog("curve\n");
-				return params.curve_dwell;
-			} else {
-				//olLog("cor\n");
-				return params.corner_dwell;
-			}
-		}
+	uint8_t hdr[32];
+	uint8_t rec[8];
+
+	if (count > 0xffff) {
+		olLog("ILDA: truncating %d point frame\n", count);
+		count = 0xffff;
+	}
+
+	memset(hdr, 0, sizeof(hdr));
+	memcpy(hdr, "ILDA", 4);
+	hdr[7] = 5;
+	memcpy(hdr + 8, "libol", 5);
+	memcpy(hdr + 16, "OpenLase", 8);
+	put_be16(hdr + 24, count);
+	put_be16(hdr + 26, frameno);
+	put_be16(hdr + 28, 0);
+	hdr[30] = output;
+	fwrite(hdr, sizeof(hdr), 1, ctx->out_file);
+
+	for (int i = 0; i < count; i++) {
+		put_be16(rec, (int16_t)(CLAMP(frame->x[output][i], -1.0f, 1.0f) * 32767));
+		put_be16(rec + 2, (int16_t)(CLAMP(frame->y[output][i], -1.0f, 1.0f) * 32767));
+		rec[5] = lrintf(frame->b[output][i] * 255.0f);
+		rec[6] = lrintf(frame->g[output][i] * 255.0f);
+		rec[7] = lrintf(frame->r[output][i] * 255.0f);
+		rec[4] = (!rec[5] && !rec[6] && !rec[7]) ? 0x40 : 0;
+		if (i == count - 1)
+			rec[4] |= 0x80;
+		fwrite(rec, sizeof(rec), 1, ctx->out_file);
 	}
 }
 
-static void line_to(float x, float y, float z, uint32_t color)
+// The total frame count in every section header is only known at the end, so
+// walk the sections and fill it in
+static void patch_ilda_totals(OLContext *ctx)
 {
-	int dwell, i;
+	uint8_t hdr[32];
+	long pos = 0;
 
-	if (dstate.points == 0) {
-		addpoint(x,y,z,color);
-		dstate.points++;
-		dstate.last_point = POINT(x,y,z,color);
-		return;
-	}
-	dwell = get_dwell(x, y);
-	Point last = dstate.last_point;
-	for (i=0; i<dwell; i++)
-		addpoint(last.x,last.y,last.z,last.color);
-	float dx = x - last.x;
-	float dy = y - last.y;
-	float dz = z - last.z;
-	float distance = fmaxf(fabsf(dx),fabsf(dy));
-	int points = ceilf(distance/params.on_speed);
-	for (i=1; i<=points; i++) {
-		addpoint(last.x + (dx/(float)points) * i,
-				 last.y + (dy/(float)points) * i,
-				 last.z + (dz/(float)points) * i,
-				 color);
+	put_be16(hdr + 28, ctx->out_file_frames);
+	while (!fseek(ctx->out_file, pos, SEEK_SET) &&
+	       fread(hdr, 28, 1, ctx->out_file) == 1) {
+		int count = (hdr[24] << 8) | hdr[25];
+		fseek(ctx->out_file, pos + 28, SEEK_SET);
+		fwrite(hdr + 28, 2, 1, ctx->out_file);
+		pos += sizeof(hdr) + count * 8;
 	}
-	dstate.last_slope = dstate.last_point;
-	dstate.last_point = POINT(x,y,z,color);
-	dstate.points++;
 }
 
-static void recurse_bezier(float x1, float y1, float x2, float y2, float x3, float y3, uint32_t color, int depth)
+static int offline_open(OLContext *ctx)
 {
-	float x0 = dstate.last_point.x;
-	float y0 = dstate.last_point.y;
-	int subdivide = 0;
+	const OLConfig *config = &ctx->config;
 
-	if (depth > 100) {
-		olLog("Bezier recurse error: %f,%f %f,%f %f,%f %f,%f\n", x0, y0, x1, y1, x2, y2, x3, y3);
-		return;
+	ctx->out_file = NULL;
+	ctx->out_file_samples = 0;
+	ctx->out_file_frames = 0;
+	ctx->out_file_full = 0;
+
+	if (config->backend != OL_BACKEND_FILE)
+		return 0;
+
+	if (!config->filename) {
+		olLog("No output file given\n");
+		return -1;
 	}
-	
-	float dx = x3-x0;
-	float dy = y3-y0;
-	float distance = fmaxf(fabsf(dx),fabsf(dy));
-	if (distance > params.on_speed) {
-		subdivide = 1;
-	} else {
-		float ux = (3.0*x1 - 2.0*x0 - x3); ux = ux * ux;
-		float uy = (3.0*y1 - 2.0*y0 - y3); uy = uy * uy;
-		float vx = (3.0*x2 - 2.0*x3 - x0); vx = vx * vx;
-		float vy = (3.0*y2 - 2.0*y3 - y0); vy = vy * vy;
-		if (ux < vx)
-			ux = vx;
-		if (uy < vy)
-			uy = vy;
-		if ((ux+uy) > params.flatness)
-			subdivide = 1;
-	}
-
-	if (subdivide) {
-		//de Casteljau at t=0.5
-		float mcx = (x1 + x2) * 0.5;
-		float mcy = (y1 + y2) * 0.5;
-		float ax1 = (x0 + x1) * 0.5;
-		float ay1 = (y0 + y1) * 0.5;
-		float ax2 = (ax1 + mcx) * 0.5;
-		float ay2 = (ay1 + mcy) * 0.5;
-		float bx2 = (x2 + x3) * 0.5;
-		float by2 = (y2 + y3) * 0.5;
-		float bx1 = (bx2 + mcx) * 0.5;
-		float by1 = (by2 + mcy) * 0.5;
-		float xm = (ax2 + bx1) * 0.5;
-		float ym = (ay2 + by1) * 0.5;
-		recurse_bezier(ax1, ay1, ax2, ay2, xm, ym, color, depth+1);
-		recurse_bezier(bx1, by1, bx2, by2, x3, y3, color, depth+1);
-	} else {
-		addpoint(x3, y3, 0, color);
-		dstate.last_point = POINT(x3,y3,0,color);
+	// read back on close to patch the ILDA headers
+	if (!(ctx->out_file = fopen(config->filename, "w+b"))) {
+		olLog("Cannot open output file %s\n", config->filename);
+		return -1;
 	}
+	// placeholder, rewritten with the final sizes on shutdown
+	if (config->file_format == OL_FILE_WAV)
+		write_wav_header(ctx);
+	return 0;
 }
 
-static void bezier_to(float x, float y, uint32_t color)
+static void offline_close(OLContext *ctx)
 {
-	int dwell, i;
-
-	if (dstate.points == 0) {
-		addpoint(x,y,0,color);
-		dstate.points++;
-		dstate.last_point = POINT(x,y,0,color);
-		return;
+	if (ctx->out_file) {
+		if (ctx->config.file_format == OL_FILE_WAV) {
+			fseek(ctx->out_file, 0, SEEK_SET);
+			write_wav_header(ctx);
+		} else if (ctx->config.file_format == OL_FILE_ILDA) {
+			write_ilda_section(ctx, 0, ctx->out_file_frames, NULL, 0);
+			patch_ilda_totals(ctx);
+		}
+		fclose(ctx->out_file);
+		ctx->out_file = NULL;
 	}
+}
 
-	switch(dstate.state) {
-		case 0:
-			dstate.c1 = POINT(x,y,0,color);
-			dstate.state++;
-			return;
-		case 1:
-			dstate.c2 = POINT(x,y,0,color);
-			dstate.state++;
+static void offline_write(OLContext *ctx, RenderedFrame *frame)
+{
+	int count = frame->pnext;
+
+	if (ctx->config.file_format == OL_FILE_ILDA && ctx->out_file) {
+		if (ctx->out_file_frames == ILDA_MAX_FRAMES && !ctx->out_file_full) {
+			olLog("ILDA: %s has %d frames, the most it can hold; not writing any more\n",
+			      ctx->config.filename, ILDA_MAX_FRAMES);
+			ctx->out_file_full = 1;
+		}
+		if (!ctx->out_file_full) {
+			for (int i = 0; i < ctx->config.num_outputs; i++)
+				write_ilda_section(ctx, i, ctx->out_file_frames, frame, count);
+			ctx->out_file_frames++;
+		}
+		if (!ctx->framecb)
 			return;
-		case 2:
-			break;
 	}
 
-	if (near(dstate.last_point, dstate.c1))
-		dwell = get_dwell(dstate.c2.x, dstate.c2.y);
-	else
-		dwell = get_dwell(dstate.c1.x, dstate.c1.y);
-
-	Point last = dstate.last_point;
-	for (i=0; i<dwell; i++)
-		addpoint(last.x,last.y,last.z,last.color);
+	if (ctx->framecb) {
+		OLOutputFrame of;
+		of.samples = count;
+		of.num_outputs = ctx->config.num_outputs;
+		for (int i = 0; i < ctx->config.num_outputs; i++) {
+			of.x[i] = frame->x[i];
+			of.y[i] = frame->y[i];
+			of.r[i] = frame->r[i];
+			of.g[i] = frame->g[i];
+			of.b[i] = frame->b[i];
+		}
+		of.audio_l = frame->audio_l;
+		of.audio_r = frame->audio_r;
+		ctx->framecb(&of);
+	}
 
-	recurse_bezier(dstate.c1.x, dstate.c1.y, dstate.c2.x, dstate.c2.y, x, y, color, 0);
+	if (!ctx->out_file || ctx->config.file_format == OL_FILE_ILDA)
+		return;
 
-	dstate.last_point = POINT(x,y,0,color);
-	if (near(dstate.c2, dstate.last_point))
-		dstate.last_slope = dstate.c1;
-	else
-		dstate.last_slope = dstate.c2;
-	dstate.points++;
-	dstate.state = 0;
+	// interleaved, x/y/r/g/b for each output followed by audio l/r
+	int channels = file_channels(ctx);
+	if (ctx->config.file_format == OL_FILE_WAV && !ctx->out_file_full &&
+	    (uint64_t)(ctx->out_file_samples + count) * channels * sizeof(float) > WAV_MAX_DATA) {
+		olLog("WAV: %s would go over 4 GiB; not writing any more frames\n",
+		      ctx->config.filename);
+		ctx->out_file_full = 1;
+	}
+	if (ctx->out_file_full)
+		return;
+	float *ibuf = malloc(count * channels * sizeof(float));
+	float *p = ibuf;
+	for (int i = 0; i < count; i++) {
+		for (int j = 0; j < ctx->config.num_outputs; j++) {
+			*p++ = frame->x[j][i];
+			*p++ = frame->y[j][i];
+			*p++ = frame->r[j][i];
+			*p++ = frame->g[j][i];
+			*p++ = frame->b[j][i];
+		}
+		*p++ = frame->audio_l[i];
+		*p++ = frame->audio_r[i];
+	}
+	fwrite(ibuf, sizeof(float) * channels, count, ctx->out_file);
+	free(ibuf);
+	ctx->out_file_samples += count;
 }
 
+static const OutputBackend backends[] = {
+	[OL_BACKEND_JACK] = { jack_open, jack_close, NULL },
+	[OL_BACKEND_NULL] = { offline_open, offline_close, offline_write },
+	[OL_BACKEND_FILE] = { offline_open, offline_close, offline_write },
+};
 
-static void point_to(float x, float y, float z, uint32_t color)
-{
-	int i;
-	addpoint(x,y,z,color);
-	if (dstate.points == 0)
-		for (i=0; i<params.start_dwell; i++)
-			addpoint(x,y,z,color);
+static void start_render_threads(OLContext *ctx);
+static void stop_render_threads(OLContext *ctx);
 
-	dstate.points++;
-	return;
-}
 
-void olTransformVertex(float *x, float *y)
+int olInit(int buffer_count, int max_points)
 {
-	float nx = mtx2d[0][0] * *x + mtx2d[0][1] * *y + mtx2d[0][2];
-	float ny = mtx2d[1][0] * *x + mtx2d[1][1] * *y + mtx2d[1][2];
-	float nw = mtx2d[2][0] * *x + mtx2d[2][1] * *y + mtx2d[2][2];
+	OLConfig config = {
+		.buffer_count = buffer_count,
+		.max_points = max_points,
+		.num_outputs = 1,
+	};
 
-	*x = nx / nw;
-	*y = ny / nw;
+	return olInit2(&config);
 }
 
-void olVertex2Z(float x, float y, float z, uint32_t color)
+int olInit2(const OLConfig *config)
 {
-	if (!dstate.curobj)
-		return;
-
-	if(vpreshader)
-		vpreshader(&x, &y, &color);
-
-	color = colmul(color,curcol);
+	return olCtxInit(&default_ctx, config);
+}
 
-	olTransformVertex(&x, &y);
+OLContext *olGetDefaultContext(void)
+{
+	return default_ctx;
+}
 
-	if(vshader)
-		vshader(&x, &y, &color);
+static void free_context(OLContext *ctx)
+{
+	int i, j;
 
-	switch (dstate.prim) {
-		case OL_LINESTRIP:
-			line_to(x,y,z,color);
-			break;
-		case OL_BEZIERSTRIP:
-			bezier_to(x,y,color);
-			break;
-		case OL_POINTS:
-			point_to(x,y,z,color);
-			break;
+	for (i=0; i<ctx->config.num_outputs; i++) {
+		Frame *frame = &ctx->wframes[i];
+		free(frame->objects);
+		free(frame->points);
+		free(frame->rpoints);
+		free(frame->grid.cell_start);
+		free(frame->grid.cell_cnt);
+		free(frame->grid.entries);
+		free(frame->tour.keys);
+		free(frame->tour.ord);
+		free(frame->tour.inv);
+		free(frame->tour.cache_keys);
+		for (j=0; j<2; j++) {
+			free(frame->tour.plans[j].ord);
+			free(frame->tour.plans[j].inv);
+		}
 	}
-}
+	for (i=0; i<ctx->fbufs; i++) {
+		for (j=0; j<ctx->config.num_outputs; j++)
+			free(ctx->frames[i].x[j]);
+		free(ctx->frames[i].audio_l);
+		free(ctx->frames[i].audio_r);
+	}
+	free(ctx->frames);
 
-void olVertex(float x, float y, uint32_t color)
-{
-	olVertex2Z(x, y, 0, color);
+	pthread_mutex_destroy(&ctx->render_lock);
+	pthread_cond_destroy(&ctx->render_start);
+	pthread_cond_destroy(&ctx->render_done);
+	sem_destroy(&ctx->frame_free);
+	free(ctx);
 }
 
-void olEnd(void)
+int olCtxInit(OLContext **pctx, const OLConfig *config)
 {
+	OLContext *ctx;
 	int i;
-	if (!dstate.curobj)
-		return;
-	if (dstate.points < 2) {
-		dstate.curobj = NULL;
-		return;
-	}
-	Point *last = dstate.curobj->points + dstate.curobj->pointcnt - 1;
-	for (i=0; i<params.end_dwell; i++)
-		addpoint(last->x,last->y,last->z,last->color);
 
-	if (pshader) {
-		for (i=0; i<dstate.curobj->pointcnt; i++) {
-			pshader(&dstate.curobj->points[i].x, &dstate.curobj->points[i].y, &dstate.curobj->points[i].color);
-		}
+	if (config->backend < 0 || config->backend > OL_BACKEND_FILE)
+		return -1;
+	if (config->backend == OL_BACKEND_JACK && config->buffer_count < 2)
+		return -1;
+
+	ol_transform_init();
+
+	ctx = calloc(1, sizeof(*ctx));
+	ctx->config = *config;
+	pthread_mutex_init(&ctx->render_lock, NULL);
+	pthread_cond_init(&ctx->render_start, NULL);
+	pthread_cond_init(&ctx->render_done, NULL);
+	sem_init(&ctx->frame_free, 0, 0);
+
+	memset(&ctx->dstate, 0, sizeof(ctx->dstate));
+	memset(&ctx->last_render_point, 0, sizeof(ctx->last_render_point));
+
+	ctx->buflag = config->buffer_count;
+	ctx->fbufs = config->buffer_count+1;
+	if (config->backend != OL_BACKEND_JACK) {
+		ctx->config.min_buffer_count = 0;
+	} else if (config->min_buffer_count) {
+		if (ctx->config.min_buffer_count < 2)
+			ctx->config.min_buffer_count = 2;
+		if (ctx->config.min_buffer_count > ctx->config.buffer_count)
+			ctx->config.min_buffer_count = ctx->config.buffer_count;
+		ctx->buflag = ctx->config.min_buffer_count;
 	}
 
-	if (p3shader) {
-		for (i=0; i<dstate.curobj->pointcnt; i++) {
-			p3shader(&dstate.curobj->points[i].x,
-					&dstate.curobj->points[i].y,
-					&dstate.curobj->points[i].z,
-					&dstate.curobj->points[i].color);
-		}
+	atomic_init(&ctx->cwbuf, 0);
+	atomic_init(&ctx->crbuf, 0);
+	atomic_init(&ctx->first_time_full, 0);
+	atomic_init(&ctx->rt_callbacks, 0);
+	atomic_init(&ctx->rt_dummies, 0);
+	atomic_init(&ctx->rt_repeats, 0);
+	atomic_init(&ctx->rt_samples, 0);
+	atomic_init(&ctx->rt_total_ns, 0);
+	atomic_init(&ctx->rt_peak_ns, 0);
+	atomic_init(&ctx->rt_max_ns, 0);
+	ctx->draw_start = get_time();
+	ctx->lead_time = ctx->log_time = ctx->draw_start;
+	ctx->out_point = -1;
+	ctx->first_output_frame = 0;
+	ctx->last_info.detail_scale = 1;
+	
+	for (i=0; i<config->num_outputs; i++) {
+		ctx->wframe = &ctx->wframes[i];
+		memset(ctx->wframe, 0, sizeof(Frame));
+		ctx->wframe->objmax = 16;
+		ctx->wframe->objects = malloc(ctx->wframe->objmax * sizeof(Object));
+		ps_grow(ctx, ctx->wframe, 1);
 	}
+	ctx->wframe = &ctx->wframes[0];
 
-	int nl=0,nr=0,nu=0,nd=0;
-	for (i=0; i<dstate.curobj->pointcnt; i++) {
-		if (!dstate.curobj->points[i].color)
-			continue;
-		if (dstate.curobj->points[i].x > -1)
-			nl = 1;
-		if (dstate.curobj->points[i].x < 1)
-			nr = 1;
-		if (dstate.curobj->points[i].y > -1)
-			nd = 1;
-		if (dstate.curobj->points[i].y < 1)
-			nu = 1;
+	// point buffers are allocated on first use
+	ctx->frames = calloc(ctx->fbufs, sizeof(RenderedFrame));
 
-		if (nl && nr && nu && nd)
-			break;
+	ctx->backend = &backends[config->backend];
+	if (ctx->backend->open(ctx) < 0) {
+		free_context(ctx);
+		return -1;
 	}
-	if (nl && nr && nu && nd)
-		wframe->objcnt++;
-	dstate.curobj = NULL;
+
+	if (config->num_outputs > 1)
+		start_render_threads(ctx);
+
+	olCtxLoadIdentity(ctx);
+	for(i=0; i<MTX_STACK_DEPTH; i++)
+		olCtxPushMatrix(ctx);
+	ctx->mtx2dp = 0;
+
+	olCtxLoadIdentity3(ctx);
+	for(i=0; i<MTX_STACK_DEPTH; i++)
+		olCtxPushMatrix3(ctx);
+	ctx->mtx3dp = 0;
+
+	olCtxResetColor(ctx);
+	for(i=0; i<MTX_STACK_DEPTH; i++)
+		olCtxPushColor(ctx);
+	ctx->coldp = 0;
+
+	ctx->bbox[0][0] = -1;
+	ctx->bbox[0][1] = -1;
+	ctx->bbox[1][0] = 1;
+	ctx->bbox[1][1] = 1;
+
+	ctx->vpreshader = NULL;
+	ctx->vshader = NULL;
+	ctx->v3shader = NULL;
+	ctx->pshader = NULL;
+	ctx->audiocb = NULL;
+	ctx->framecb = NULL;
+
+	olCtxVertexArray(ctx, 2, 0, NULL);
+	olCtxColorArray(ctx, 0, NULL);
+
+	*pctx = ctx;
+	return 0;
 }
 
-static void chkpts(int count)
+static float detail_scale(int level)
 {
-	if (frames[cwbuf].pnext + count > frames[cwbuf].pmax) {
-		olLog("Point buffer overflow (final): need %d points, have %d\n",
-				count + frames[cwbuf].pnext, frames[cwbuf].pmax);
-		exit(1);
-	}
+	return powf(2, level / 4.0f);
 }
 
-static void addrndpoint(int output, float x, float y, uint32_t color)
+static int scale_dwell(int dwell, float scale)
 {
-	frames[cwbuf].points[output][frames[cwbuf].pnext].x = x;
-	frames[cwbuf].points[output][frames[cwbuf].pnext].y = y;
-	frames[cwbuf].points[output][frames[cwbuf].pnext].color = color;
-	frames[cwbuf].pnext++;
+	if (dwell <= 0)
+		return dwell;
+	dwell = dwell / scale + 0.5f;
+	return dwell ? dwell : 1;
 }
 
-static int render_object(int output, Object *obj)
+// At detail level n, lines and curves are sampled 2^(n/4) times coarser,
+// dwells are shortened to match and objects under n points are dropped
+static void apply_detail(OLContext *ctx)
+{
+	OLRenderParams *p = &ctx->params;
+	int level = ctx->detail_level;
+	float scale = detail_scale(level);
+
+	*p = ctx->user_params;
+	if (!level)
+		return;
+	p->on_speed *= scale;
+	// curve step counts go with the fourth root of the flatness
+	p->flatness *= scale * scale * scale * scale;
+	p->start_dwell = scale_dwell(p->start_dwell, scale);
+	p->curve_dwell = scale_dwell(p->curve_dwell, scale);
+	p->corner_dwell = scale_dwell(p->corner_dwell, scale);
+	p->end_dwell = scale_dwell(p->end_dwell, scale);
+	if (p->min_length < level)
+		p->min_length = level;
+}
+
+// Whether a level was drawn at within the last second
+static int detail_recent(OLContext *ctx, int level)
+{
+	return ctx->detail_seen[level] &&
+		ctx->detail_frames - ctx->detail_seen[level] < ctx->user_params.target_fps;
+}
+
+// Picks the detail level for the next frame from how many points this one
+// needed. Over budget it jumps straight to the level that should fit, under
+// budget it only steps back when the finer level would still leave some
+// headroom. What a level cost the last time it ran beats the estimate, since
+// min_length can bring back many objects at once.
+static void update_detail(OLContext *ctx, int points)
+{
+	float target_fps = ctx->user_params.target_fps;
+	int level = ctx->detail_level;
+	int cur = level;
+	float budget, finer;
+
+	if (target_fps <= 0)
+		return;
+	budget = ctx->user_params.rate / target_fps;
+	ctx->detail_frames++;
+	ctx->detail_points[level] = points;
+	ctx->detail_seen[level] = ctx->detail_frames;
+
+	if (points > budget) {
+		level += ceilf(4 * log2f(points / budget));
+		if (level > MAX_DETAIL_LEVEL)
+			level = MAX_DETAIL_LEVEL;
+		while (level - 1 > cur && detail_recent(ctx, level - 1) &&
+			   ctx->detail_points[level - 1] <= budget)
+			level--;
+	} else if (level) {
+		finer = points * detail_scale(1);
+		if (detail_recent(ctx, level - 1))
+			finer = ctx->detail_points[level - 1];
+		if (finer < DETAIL_HEADROOM * budget)
+			level--;
+	}
+
+	if (level != ctx->detail_level) {
+		ctx->detail_level = level;
+		apply_detail(ctx);
+	}
+}
+
+void olCtxSetRenderParams(OLContext *ctx, OLRenderParams *sp)
+{
+	ctx->user_params = *sp;
+	if (sp->target_fps <= 0)
+		ctx->detail_level = 0;
+	apply_detail(ctx);
+}
+
+void olCtxGetRenderParams(OLContext *ctx, OLRenderParams *sp)
+{
+	*sp = ctx->user_params;
+}
+
+void olCtxShutdown(OLContext *ctx)
+{
+	if (ctx->config.num_outputs > 1)
+		stop_render_threads(ctx);
+	ctx->backend->close(ctx);
+	free_context(ctx);
+}
+
+static void list_begin(OLDisplayList *list, int prim)
+{
+	if (list->open)
+		return;
+	if (list->objmax == list->objcnt) {
+		list->objmax = list->objmax ? list->objmax * 2 : 16;
+		list->objects = realloc(list->objects, list->objmax * sizeof(ListObject));
+	}
+	ListObject *lo = &list->objects[list->objcnt++];
+	memset(lo, 0, sizeof(*lo));
+	lo->prim = prim;
+	lo->vfirst = list->vcnt;
+	list->open = 1;
+}
+
+static void list_vertex(OLDisplayList *list, float x, float y, float z, uint32_t color, int is3d)
+{
+	if (!list->open)
+		return;
+	if (list->vmax == list->vcnt) {
+		list->vmax = list->vmax ? list->vmax * 2 : 64;
+		list->vertices = realloc(list->vertices, list->vmax * sizeof(ListVertex));
+	}
+	ListVertex *v = &list->vertices[list->vcnt++];
+	v->x = x;
+	v->y = y;
+	v->z = z;
+	v->color = color;
+	v->is3d = is3d;
+	list->objects[list->objcnt - 1].vcount++;
+	list->has3d |= is3d;
+}
+
+void olCtxBegin(OLContext *ctx, int prim)
+{
+	if (ctx->recording) {
+		list_begin(ctx->recording, prim);
+		return;
+	}
+	if (ctx->dstate.curobj)
+		return;
+	if (ctx->wframe->objmax == ctx->wframe->objcnt) {
+		ctx->wframe->objmax *= 2;
+		ctx->wframe->objects = realloc(ctx->wframe->objects, ctx->wframe->objmax * sizeof(Object));
+	}
+	ctx->dstate.curobj = ctx->wframe->objects + ctx->wframe->objcnt;
+	memset(ctx->dstate.curobj, 0, sizeof(Object));
+	memcpy(ctx->dstate.curobj->bbox, ctx->bbox, sizeof(ctx->bbox));
+	ctx->dstate.curobj->points = ctx->wframe->points + ctx->wframe->psnext;
+	ctx->dstate.prim = prim;
+	ctx->dstate.state = 0;
+	ctx->dstate.points = 0;
+	ctx->dstate.overflow = 0;
+	ctx->dstate.cull = !ctx->pshader && !ctx->p3shader && !ctx->nocull;
+	ctx->dstate.extent[0][0] = ctx->dstate.extent[0][1] = INFINITY;
+	ctx->dstate.extent[1][0] = ctx->dstate.extent[1][1] = -INFINITY;
+	ctx->dstate.clip_valid = 0;
+	ctx->dstate.pending = 0;
+	ctx->dstate.speed = 0;
+}
+
+// Abandons the object being drawn and returns its points to the buffer
+static void drop_object(OLContext *ctx)
+{
+	ctx->wframe->psnext = ctx->dstate.curobj->points - ctx->wframe->points;
+	ctx->dstate.curobj = NULL;
+}
+
+static int near(OLContext *ctx, Point a, Point b)
+{
+	float dx = a.x - b.x;
+	float dy = a.y - b.y;
+	return sqrtf(dx*dx+dy*dy) <= ctx->params.snap;
+}
+
+static void addpoint(OLContext *ctx, float x, float y, float z, uint32_t color)
+{
+	Point *pnt = ps_alloc(ctx, 1);
+	if (!pnt) {
+		ctx->dstate.overflow = 1;
+		return;
+	}
+	pnt->x = x;
+	pnt->y = y;
+	pnt->z = z;
+	pnt->color = color;
+	ctx->dstate.curobj->pointcnt++;
+}
+
+// True if the box from (x0,y0) to (x1,y1) misses the scissor of the object
+// being drawn, so nothing inside it can ever be output
+static inline int outside_scissor(OLContext *ctx, float x0, float y0, float x1, float y1)
+{
+	float (*bbox)[2] = ctx->dstate.curobj->bbox;
+	return x1 < bbox[0][0] || x0 > bbox[1][0] || y1 < bbox[0][1] || y0 > bbox[1][1];
+}
+
+static inline void extend(OLContext *ctx, float x, float y)
+{
+	ctx->dstate.extent[0][0] = fminf(ctx->dstate.extent[0][0], x);
+	ctx->dstate.extent[0][1] = fminf(ctx->dstate.extent[0][1], y);
+	ctx->dstate.extent[1][0] = fmaxf(ctx->dstate.extent[1][0], x);
+	ctx->dstate.extent[1][1] = fmaxf(ctx->dstate.extent[1][1], y);
+}
+
+static int get_dwell(OLContext *ctx, float x, float y)
+{
+	if (ctx->dstate.points == 1) {
+		return ctx->params.start_dwell;
+	} else {
+		float ex = ctx->dstate.last_point.x;
+		float ey = ctx->dstate.last_point.y;
+		float ecx = ctx->dstate.last_slope.x;
+		float ecy = ctx->dstate.last_slope.y;
+		float sx = ex;
+		float sy = ey;
+		float scx = x;
+		float scy = y;
+		float dex = ecx-ex;
+		float dey = ecy-ey;
+		float dsx = sx-scx;
+		float dsy = sy-scy;
+		float dot = dex*dsx + dey*dsy;
+		float lens = sqrtf(dex*dex+dey*dey) * sqrtf(dsx*dsx+dsy*dsy);
+		//olLog("%f,%f -> %f,%f -> %f,%f\n", ecx,ecy,ex,ey,x,y);
+		if (lens == 0) {
+			//olLog("deg cor\n");
+			return ctx->params.corner_dwell;
+		} else {
+			dot = dot / lens;
+			if (dot > ctx->params.curve_angle) {
+				//olLog("curve\n");
+				return ctx->params.curve_dwell;
+			} else {
+				//olLog("cor\n");
+				return ctx->params.corner_dwell;
+			}
+		}
+	}
+}
+
+/*
+With max_accel set, moves follow a trapezoidal velocity profile instead of
+going at a constant speed: the speed changes by at most max_accel per sample
+on either axis and never goes over on_speed (off_speed for blanking). Speeds
+and distances are measured along the faster axis, like the step counts
+elsewhere. Corners are taken at the speed whose change of direction stays
+within max_accel, which replaces the corner and curve dwells. However small
+max_accel is, getting to full speed takes at most PLAN_MAX_RAMP samples, so
+every move takes a bounded number of them.
+*/
+
+#define PLAN_MAX_RAMP 256
+
+// Advances *s and *v by one sample along a move of length len that has to
+// be down to v_end by its end. Returns 0 instead once the end is reached.
+static int plan_step(float accel, float vmax, float v_end, float len, float *s, float *v)
+{
+	float stop;
+
+	accel = fmaxf(accel, vmax / PLAN_MAX_RAMP);
+	stop = sqrtf(v_end * v_end + 2 * accel * (len - *s));
+	*v = fminf(fminf(*v + accel, vmax), stop);
+	*s += *v;
+	return *s < len;
+}
+
+// Largest speed at which a line strip can turn at b from a->b to b->c, also
+// low enough to stop before c whatever comes after it
+static float corner_speed(OLContext *ctx, Point a, Point b, float cx, float cy)
+{
+	float accel = ctx->params.max_accel;
+	float l1 = fmaxf(fabsf(b.x - a.x), fabsf(b.y - a.y));
+	float l2 = fmaxf(fabsf(cx - b.x), fabsf(cy - b.y));
+	float dv = fmaxf(fabsf((cx - b.x) / l2 - (b.x - a.x) / l1),
+					 fabsf((cy - b.y) / l2 - (b.y - a.y) / l1));
+	float v = fminf(ctx->params.on_speed, sqrtf(2 * accel * l2));
+	if (dv * v > accel)
+		v = accel / dv;
+	return v;
+}
+
+// Samples the held back line, leaving its end at speed v_end
+static void plan_line(OLContext *ctx, float v_end)
+{
+	Point a = ctx->dstate.last_slope;
+	Point b = ctx->dstate.last_point;
+	float len = fmaxf(fabsf(b.x - a.x), fabsf(b.y - a.y));
+	float s = 0, v = ctx->dstate.speed;
+
+	while (plan_step(ctx->params.max_accel, ctx->params.on_speed, v_end, len, &s, &v)) {
+		float t = s / len;
+		addpoint(ctx, a.x + (b.x - a.x) * t, a.y + (b.y - a.y) * t,
+				 a.z + (b.z - a.z) * t, b.color);
+	}
+	addpoint(ctx, b.x, b.y, b.z, b.color);
+	ctx->dstate.speed = v_end;
+	ctx->dstate.pending = 0;
+}
+
+static void line_to_planned(OLContext *ctx, float x, float y, float z, uint32_t color)
+{
+	Point last = ctx->dstate.last_point;
+	int i;
+
+	if (x == last.x && y == last.y)
+		return;
+	if (ctx->dstate.cull && outside_scissor(ctx, fminf(x, last.x), fminf(y, last.y),
+											fmaxf(x, last.x), fmaxf(y, last.y))) {
+		float distance = fmaxf(fabsf(x - last.x), fabsf(y - last.y));
+		if (ctx->dstate.pending)
+			plan_line(ctx, 0);
+		ctx->dstate.curobj->skipped += (int)ceilf(distance/ctx->params.on_speed) - 1;
+		addpoint(ctx, x,y,z,color);
+		ctx->dstate.speed = 0;
+	} else if (ctx->dstate.pending) {
+		plan_line(ctx, corner_speed(ctx, ctx->dstate.last_slope, last, x, y));
+		ctx->dstate.pending = 1;
+	} else {
+		if (ctx->dstate.points == 1)
+			for (i=0; i<ctx->params.start_dwell; i++)
+				addpoint(ctx, last.x,last.y,last.z,last.color);
+		ctx->dstate.pending = 1;
+	}
+	ctx->dstate.last_slope = ctx->dstate.last_point;
+	ctx->dstate.last_point = POINT(x,y,z,color);
+	ctx->dstate.points++;
+}
+
+static void line_to(OLContext *ctx, float x, float y, float z, uint32_t color)
+{
+	int dwell, i;
+
+	extend(ctx, x, y);
+	if (ctx->dstate.points == 0) {
+		addpoint(ctx, x,y,z,color);
+		ctx->dstate.points++;
+		ctx->dstate.last_point = POINT(x,y,z,color);
+		return;
+	}
+	if (ctx->params.max_accel > 0) {
+		line_to_planned(ctx, x, y, z, color);
+		return;
+	}
+	Point last = ctx->dstate.last_point;
+	if (ctx->dstate.cull && outside_scissor(ctx, fminf(x, last.x), fminf(y, last.y),
+											fmaxf(x, last.x), fmaxf(y, last.y))) {
+		// only the endpoint matters, for the next segment and the end dwell
+		float distance = fmaxf(fabsf(x - last.x), fabsf(y - last.y));
+		ctx->dstate.curobj->skipped += get_dwell(ctx, x, y) + (int)ceilf(distance/ctx->params.on_speed) - 1;
+		addpoint(ctx, x,y,z,color);
+		ctx->dstate.last_slope = ctx->dstate.last_point;
+		ctx->dstate.last_point = POINT(x,y,z,color);
+		ctx->dstate.points++;
+		return;
+	}
+	dwell = get_dwell(ctx, x, y);
+	for (i=0; i<dwell; i++)
+		addpoint(ctx, last.x,last.y,last.z,last.color);
+	float dx = x - last.x;
+	float dy = y - last.y;
+	float dz = z - last.z;
+	float distance = fmaxf(fabsf(dx),fabsf(dy));
+	int points = ceilf(distance/ctx->params.on_speed);
+	for (i=1; i<=points; i++) {
+		addpoint(ctx, last.x + (dx/(float)points) * i,
+				 last.y + (dy/(float)points) * i,
+				 last.z + (dz/(float)points) * i,
+				 color);
+	}
+	ctx->dstate.last_slope = ctx->dstate.last_point;
+	ctx->dstate.last_point = POINT(x,y,z,color);
+	ctx->dstate.points++;
+}
+
+#define BEZIER_MAX_STEPS 65536
+
+// Peak of |p'(t)| on [0,1] for one coordinate of a cubic. p' is a quadratic,
+// so it is reached at an end or at its single extremum.
+static inline float bezier_speed(float p0, float p1, float p2, float p3)
+{
+	float d0 = p1 - p0, d1 = p2 - p1, d2 = p3 - p2;
+	float speed = fmaxf(fabsf(d0), fabsf(d2));
+	float den = d0 - 2.0f * d1 + d2;
+
+	if (den != 0.0f) {
+		float t = (d0 - d1) / den;
+		if (t > 0.0f && t < 1.0f) {
+			float mt = 1.0f - t;
+			speed = fmaxf(speed, fabsf(mt * mt * d0 + 2.0f * t * mt * d1 + t * t * d2));
+		}
+	}
+	return 3.0f * speed;
+}
+
+// Number of equal parameter steps to flatten a cubic in: the smallest that
+// keeps every step within on_speed and meets the flatness criterion, which
+// falls 16x each time the step is halved
+static int bezier_steps(OLContext *ctx, float x0, float y0, float x1, float y1, float x2, float y2, float x3, float y3)
+{
+	float speed = fmaxf(bezier_speed(x0, x1, x2, x3), bezier_speed(y0, y1, y2, y3));
+	float ux = 3.0f*x1 - 2.0f*x0 - x3; ux = ux * ux;
+	float uy = 3.0f*y1 - 2.0f*y0 - y3; uy = uy * uy;
+	float vx = 3.0f*x2 - 2.0f*x3 - x0; vx = vx * vx;
+	float vy = 3.0f*y2 - 2.0f*y3 - y0; vy = vy * vy;
+	float flat = fmaxf(ux, vx) + fmaxf(uy, vy);
+
+	float n = fmaxf(ceilf(speed / ctx->params.on_speed),
+					ceilf(sqrtf(sqrtf(flat / ctx->params.flatness))));
+	if (!(n <= BEZIER_MAX_STEPS)) {
+		olLog("Bezier flatten error: %f,%f %f,%f %f,%f %f,%f\n", x0, y0, x1, y1, x2, y2, x3, y3);
+		n = BEZIER_MAX_STEPS;
+	}
+	return n < 1 ? 1 : n;
+}
+
+// Flattens the cubic from the last point through (x1,y1), (x2,y2) to (x3,y3),
+// writing all points in one span
+static void flatten_bezier(OLContext *ctx, float x1, float y1, float x2, float y2, float x3, float y3, uint32_t color)
+{
+	float x0 = ctx->dstate.last_point.x;
+	float y0 = ctx->dstate.last_point.y;
+	int i, steps = bezier_steps(ctx, x0, y0, x1, y1, x2, y2, x3, y3);
+
+	Point *pts = ps_alloc(ctx, steps);
+	if (!pts) {
+		ctx->dstate.overflow = 1;
+		return;
+	}
+
+	// power basis, p(t) = ((a*t + b)*t + c)*t + p0
+	float ax = x3 - 3.0f*x2 + 3.0f*x1 - x0;
+	float bx = 3.0f * (x2 - 2.0f*x1 + x0);
+	float cx = 3.0f * (x1 - x0);
+	float ay = y3 - 3.0f*y2 + 3.0f*y1 - y0;
+	float by = 3.0f * (y2 - 2.0f*y1 + y0);
+	float cy = 3.0f * (y1 - y0);
+	float dt = 1.0f / steps;
+
+	for (i = 0; i < steps - 1; i++) {
+		float t = (i + 1) * dt;
+		pts[i].x = ((ax * t + bx) * t + cx) * t + x0;
+		pts[i].y = ((ay * t + by) * t + cy) * t + y0;
+		pts[i].z = 0;
+		pts[i].color = color;
+	}
+	pts[steps - 1] = POINT(x3, y3, 0, color);
+	ctx->dstate.curobj->pointcnt += steps;
+}
+
+static void bezier_to(OLContext *ctx, float x, float y, uint32_t color)
+{
+	int dwell, i;
+
+	extend(ctx, x, y);
+	if (ctx->dstate.points == 0) {
+		addpoint(ctx, x,y,0,color);
+		ctx->dstate.points++;
+		ctx->dstate.last_point = POINT(x,y,0,color);
+		return;
+	}
+
+	switch(ctx->dstate.state) {
+		case 0:
+			ctx->dstate.c1 = POINT(x,y,0,color);
+			ctx->dstate.state++;
+			return;
+		case 1:
+			ctx->dstate.c2 = POINT(x,y,0,color);
+			ctx->dstate.state++;
+			return;
+		case 2:
+			break;
+	}
+
+	Point last = ctx->dstate.last_point;
+	Point c1 = ctx->dstate.c1, c2 = ctx->dstate.c2;
+	// the curve stays inside the box around its control points
+	if (ctx->dstate.cull &&
+		outside_scissor(ctx, fminf(fminf(last.x, c1.x), fminf(c2.x, x)),
+						fminf(fminf(last.y, c1.y), fminf(c2.y, y)),
+						fmaxf(fmaxf(last.x, c1.x), fmaxf(c2.x, x)),
+						fmaxf(fmaxf(last.y, c1.y), fmaxf(c2.y, y)))) {
+		if (near(ctx, last, c1))
+			dwell = get_dwell(ctx, c2.x, c2.y);
+		else
+			dwell = get_dwell(ctx, c1.x, c1.y);
+		ctx->dstate.curobj->skipped += dwell +
+			bezier_steps(ctx, last.x, last.y, c1.x, c1.y, c2.x, c2.y, x, y) - 1;
+		addpoint(ctx, x,y,0,color);
+	} else {
+		if (near(ctx, last, c1))
+			dwell = get_dwell(ctx, c2.x, c2.y);
+		else
+			dwell = get_dwell(ctx, c1.x, c1.y);
+
+		for (i=0; i<dwell; i++)
+			addpoint(ctx, last.x,last.y,last.z,last.color);
+
+		flatten_bezier(ctx, c1.x, c1.y, c2.x, c2.y, x, y, color);
+	}
+
+	ctx->dstate.last_point = POINT(x,y,0,color);
+	if (near(ctx, ctx->dstate.c2, ctx->dstate.last_point))
+		ctx->dstate.last_slope = ctx->dstate.c1;
+	else
+		ctx->dstate.last_slope = ctx->dstate.c2;
+	ctx->dstate.points++;
+	ctx->dstate.state = 0;
+}
+
+
+static void point_to(OLContext *ctx, float x, float y, float z, uint32_t color)
+{
+	int i;
+	extend(ctx, x, y);
+	addpoint(ctx, x,y,z,color);
+	if (ctx->dstate.points == 0)
+		for (i=0; i<ctx->params.start_dwell; i++)
+			addpoint(ctx, x,y,z,color);
+
+	ctx->dstate.points++;
+	return;
+}
+
+void olCtxTransformVertex(OLContext *ctx, float *x, float *y)
+{
+	float nx = ctx->mtx2d[0][0] * *x + ctx->mtx2d[0][1] * *y + ctx->mtx2d[0][2];
+	float ny = ctx->mtx2d[1][0] * *x + ctx->mtx2d[1][1] * *y + ctx->mtx2d[1][2];
+	float nw = ctx->mtx2d[2][0] * *x + ctx->mtx2d[2][1] * *y + ctx->mtx2d[2][2];
+
+	*x = nx / nw;
+	*y = ny / nw;
+}
+
+static void vertex2z(OLContext *ctx, float x, float y, float z, uint32_t color)
+{
+	if(ctx->vpreshader)
+		ctx->vpreshader(&x, &y, &color);
+
+	color = colmul(color,ctx->curcol);
+
+	olCtxTransformVertex(ctx, &x, &y);
+
+	if(ctx->vshader)
+		ctx->vshader(&x, &y, &color);
+
+	switch (ctx->dstate.prim) {
+		case OL_LINESTRIP:
+			line_to(ctx, x,y,z,color);
+			break;
+		case OL_BEZIERSTRIP:
+			bezier_to(ctx, x,y,color);
+			break;
+		case OL_POINTS:
+			point_to(ctx, x,y,z,color);
+			break;
+	}
+}
+
+void olCtxVertex2Z(OLContext *ctx, float x, float y, float z, uint32_t color)
+{
+	if (ctx->recording) {
+		list_vertex(ctx->recording, x, y, z, color, 0);
+		return;
+	}
+	if (!ctx->dstate.curobj)
+		return;
+
+	ctx->dstate.clip_valid = 0;
+	vertex2z(ctx, x, y, z, color);
+}
+
+void olCtxVertex(OLContext *ctx, float x, float y, uint32_t color)
+{
+	olCtxVertex2Z(ctx, x, y, 0, color);
+}
+
+// Adds the end dwell to the object being drawn. Returns 0 if it had to be
+// dropped instead.
+static int close_object(OLContext *ctx)
+{
+	int i;
+	if (ctx->dstate.pending)
+		plan_line(ctx, 0);
+	if (ctx->dstate.points < 2 || !ctx->dstate.curobj->pointcnt) {
+		drop_object(ctx);
+		return 0;
+	}
+	Point last = ctx->dstate.curobj->points[ctx->dstate.curobj->pointcnt - 1];
+	for (i=0; i<ctx->params.end_dwell; i++)
+		addpoint(ctx, last.x,last.y,last.z,last.color);
+
+	if (ctx->dstate.overflow) {
+		// over max_points, drop it whole rather than render a partial object
+		ctx->wframe->dropped++;
+		drop_object(ctx);
+		return 0;
+	}
+	return 1;
+}
+
+// Runs the pixel shaders on a complete object and adds it to the frame
+// unless it is entirely offscreen
+static void finish_object(OLContext *ctx)
+{
+	int i;
+	double t = 0;
+
+	if (ctx->pshader || ctx->p3shader)
+		t = get_time();
+	if (ctx->pshader) {
+		for (i=0; i<ctx->dstate.curobj->pointcnt; i++) {
+			ctx->pshader(&ctx->dstate.curobj->points[i].x, &ctx->dstate.curobj->points[i].y, &ctx->dstate.curobj->points[i].color);
+		}
+	}
+
+	if (ctx->p3shader) {
+		for (i=0; i<ctx->dstate.curobj->pointcnt; i++) {
+			ctx->p3shader(&ctx->dstate.curobj->points[i].x,
+					&ctx->dstate.curobj->points[i].y,
+					&ctx->dstate.curobj->points[i].z,
+					&ctx->dstate.curobj->points[i].color);
+		}
+	}
+	if (t)
+		ctx->shader_time += get_time() - t;
+
+	int nl=0,nr=0,nu=0,nd=0;
+	for (i=0; i<ctx->dstate.curobj->pointcnt; i++) {
+		if (!ctx->dstate.curobj->points[i].color)
+			continue;
+		if (ctx->dstate.curobj->points[i].x > -1)
+			nl = 1;
+		if (ctx->dstate.curobj->points[i].x < 1)
+			nr = 1;
+		if (ctx->dstate.curobj->points[i].y > -1)
+			nd = 1;
+		if (ctx->dstate.curobj->points[i].y < 1)
+			nu = 1;
+
+		if (nl && nr && nu && nd)
+			break;
+	}
+	if (nl && nr && nu && nd) {
+		ctx->wframe->objcnt++;
+		ctx->dstate.curobj = NULL;
+	} else {
+		ctx->wframe->culled++;
+		drop_object(ctx);
+	}
+}
+
+void olCtxEnd(OLContext *ctx)
+{
+	if (ctx->recording) {
+		ctx->recording->open = 0;
+		return;
+	}
+	if (!ctx->dstate.curobj)
+		return;
+	if (ctx->dstate.cull && ctx->dstate.points &&
+		outside_scissor(ctx, ctx->dstate.extent[0][0], ctx->dstate.extent[0][1],
+						ctx->dstate.extent[1][0], ctx->dstate.extent[1][1])) {
+		ctx->wframe->culled++;
+		drop_object(ctx);
+		return;
+	}
+	if (close_object(ctx))
+		finish_object(ctx);
+}
+
+// The ring slot being rendered into; only the producer side moves cwbuf
+static inline RenderedFrame *write_frame(OLContext *ctx)
+{
+	return &ctx->frames[atomic_load_explicit(&ctx->cwbuf, memory_order_relaxed)];
+}
+
+// Makes room for count more rendered points
+static int rp_reserve(OLContext *ctx, Frame *frame, int count)
+{
+	int size;
+	Point *rpoints;
+
+	if (frame->rpnext + count <= frame->rpmax)
+		return 0;
+	size = grow_size(ctx, frame->rpmax, frame->rpnext + count, 1);
+	if (!size || !(rpoints = realloc(frame->rpoints, size * sizeof(Point))))
+		return -1;
+	frame->rpoints = rpoints;
+	frame->rpmax = size;
+	return 0;
+}
+
+// Drops every other lit point rendered so far, keeping blanking and the last
+// point, and returns how many points were removed
+static int decimate(OLContext *ctx, int output)
+{
+	Frame *frame = &ctx->wframes[output];
+	Point *p = frame->rpoints;
+	int i, n = 0, lit = 0;
+
+	for (i=0; i<frame->rpnext; i++) {
+		if (p[i].color != C_BLACK && (lit++ & 1) && i != frame->rpnext - 1)
+			continue;
+		p[n++] = p[i];
+	}
+	i = frame->rpnext - n;
+	frame->rpnext = n;
+	ctx->out_info[output].dropped_points += i;
+	return i;
+}
+
+// Makes room for an object of up to count rendered points, applying the
+// overflow policy when max_points is reached. Returns 0 if the object has to
+// be skipped.
+static int chkpts(OLContext *ctx, int output, int count)
+{
+	Frame *frame = &ctx->wframes[output];
+
+	if (rp_reserve(ctx, frame, count) == 0)
+		return 1;
+	if (ctx->params.overflow == OL_OVERFLOW_DECIMATE) {
+		while (decimate(ctx, output))
+			if (rp_reserve(ctx, frame, count) == 0)
+				return 1;
+	}
+	return 0;
+}
+
+static void addrndpoint(OLContext *ctx, int output, float x, float y, uint32_t color)
+{
+	Frame *frame = &ctx->wframes[output];
+	// only reachable if the estimate in render_object() was too low
+	if (rp_reserve(ctx, frame, 1) < 0) {
+		ctx->out_info[output].dropped_points++;
+		return;
+	}
+	Point *p = &frame->rpoints[frame->rpnext++];
+	p->x = x;
+	p->y = y;
+	p->color = color;
+}
+
+static int render_object(OLContext *ctx, int output, Object *obj)
 {
 	int i,j;
 	// heuristic... might overflow in pathological cases
-	chkpts(3 * (obj->pointcnt + params.start_wait + params.end_wait));
+	if (!chkpts(ctx, output, 3 * (obj->pointcnt + ctx->params.start_wait + ctx->params.end_wait))) {
+		ctx->out_info[output].dropped_objects++;
+		return 0;
+	}
+
+	Point *ip = obj->points;
+	for (i=0; i<obj->pointcnt; i++, ip++) {
+		if (ip->x < obj->bbox[0][0] || ip->x > obj->bbox[1][0] ||
+			ip->y < obj->bbox[0][1] || ip->y > obj->bbox[1][1])
+			continue;
+		if (ip->color != C_BLACK)
+			break;
+	}
+	if (i == obj->pointcnt) { // null object
+		ctx->out_info[output].culled_objects++;
+		return 0;
+	}
+
+	ip = obj->points;
+	int prev_inside = 0;
+	for (i=0; i<obj->pointcnt; i++, ip++) {
+		int inside = 1;
+		if (ip->x < obj->bbox[0][0] || ip->x > obj->bbox[1][0] ||
+			ip->y < obj->bbox[0][1] || ip->y > obj->bbox[1][1])
+			inside = 0;
+		if (ip->color == 0 && (ctx->params.render_flags & RENDER_CULLDARK))
+			inside = 0;
+		if (inside && !prev_inside) {
+			float dx = ip->x - ctx->last_render_point[output].x;
+			float dy = ip->y - ctx->last_render_point[output].y;
+			float distance = fmaxf(fabsf(dx),fabsf(dy));
+			int points = ceilf(distance/ctx->params.off_speed);
+			if (distance > ctx->params.snap) {
+				for (j=0; j<ctx->params.end_wait; j++) {
+					addrndpoint(ctx, output, ctx->last_render_point[output].x, ctx->last_render_point[output].y, C_BLACK);
+				}
+				if (ctx->params.max_accel > 0) {
+					// from standstill to standstill
+					float s = 0, v = 0;
+					points = 1;
+					addrndpoint(ctx, output, ctx->last_render_point[output].x, ctx->last_render_point[output].y, C_BLACK);
+					while (plan_step(ctx->params.max_accel, ctx->params.off_speed, 0, distance, &s, &v)) {
+						addrndpoint(ctx, output, ctx->last_render_point[output].x + dx * (s / distance),
+									ctx->last_render_point[output].y + dy * (s / distance),
+									C_BLACK);
+						points++;
+					}
+				} else {
+					for (j=0; j<points; j++) {
+						addrndpoint(ctx, output, ctx->last_render_point[output].x + (dx/(float)points) * j,
+									ctx->last_render_point[output].y + (dy/(float)points) * j,
+									C_BLACK);
+					}
+				}
+				ctx->out_info[output].blank_points += ctx->params.end_wait + points + ctx->params.start_wait;
+				for (j=0; j<ctx->params.start_wait; j++) {
+					addrndpoint(ctx, output, ip->x, ip->y, C_BLACK);
+				}
+			}
+		}
+		if (inside) {
+			ctx->last_render_point[output] = *ip;
+			addrndpoint(ctx, output, ip->x, ip->y, ip->color);
+		}
+		prev_inside = inside;
+	}
+	return 1;
+}
+
+static inline float obj_distance(Point *p, Point *to)
+{
+	float dx = p->x - to->x;
+	float dy = p->y - to->y;
+	return fmaxf(fabsf(dx),fabsf(dy)) + 0.01*(fabsf(dx)+fabsf(dy));
+}
+
+static inline int obj_eligible(OLContext *ctx, Object *obj)
+{
+	return obj->pointcnt && obj->pointcnt + obj->skipped >= ctx->params.min_length;
+}
+
+static inline Point *obj_endpoint(Object *obj, int inv)
+{
+	return inv ? &obj->points[obj->pointcnt-1] : &obj->points[0];
+}
+
+static inline int grid_cell_x(ObjGrid *grid, float x)
+{
+	int cx = (x - grid->x0) * grid->icw;
+	return CLAMP(cx, 0, grid->gw - 1);
+}
+
+static inline int grid_cell_y(ObjGrid *grid, float y)
+{
+	int cy = (y - grid->y0) * grid->ich;
+	return CLAMP(cy, 0, grid->gh - 1);
+}
+
+static void grid_build(OLContext *ctx, ObjGrid *grid, Frame *frame)
+{
+	int i, j;
+	int ends = (ctx->params.render_flags & RENDER_NOREVERSE) ? 1 : 2;
+	int nent = 0;
+	float x0 = 0, y0 = 0, x1 = 0, y1 = 0;
+
+	for (i=0; i<frame->objcnt; i++) {
+		Object *obj = &frame->objects[i];
+		if (!obj_eligible(ctx, obj))
+			continue;
+		for (j=0; j<ends; j++) {
+			Point *p = obj_endpoint(obj, j);
+			if (!nent) {
+				x0 = x1 = p->x;
+				y0 = y1 = p->y;
+			}
+			x0 = fminf(x0, p->x);
+			x1 = fmaxf(x1, p->x);
+			y0 = fminf(y0, p->y);
+			y1 = fmaxf(y1, p->y);
+			nent++;
+		}
+	}
+
+	// aim for a couple of endpoints per cell
+	int gdim = sqrtf(nent / 2);
+	if (gdim < 1)
+		gdim = 1;
+	grid->gw = grid->gh = gdim;
+	grid->x0 = x0;
+	grid->y0 = y0;
+	float cw = (x1 - x0) / gdim;
+	float ch = (y1 - y0) / gdim;
+	if (cw <= 0)
+		cw = 1;
+	if (ch <= 0)
+		ch = 1;
+	grid->icw = 1 / cw;
+	grid->ich = 1 / ch;
+	grid->cmin = fminf(cw, ch);
+
+	int ncells = gdim * gdim;
+	if (ncells > grid->cellmax) {
+		grid->cellmax = ncells;
+		grid->cell_start = realloc(grid->cell_start, ncells * sizeof(int));
+		grid->cell_cnt = realloc(grid->cell_cnt, ncells * sizeof(int));
+	}
+	if (nent > grid->entmax) {
+		grid->entmax = nent;
+		grid->entries = realloc(grid->entries, nent * sizeof(int));
+	}
+
+	memset(grid->cell_cnt, 0, ncells * sizeof(int));
+	for (i=0; i<frame->objcnt; i++) {
+		Object *obj = &frame->objects[i];
+		if (!obj_eligible(ctx, obj))
+			continue;
+		for (j=0; j<ends; j++) {
+			Point *p = obj_endpoint(obj, j);
+			grid->cell_cnt[grid_cell_y(grid, p->y) * gdim + grid_cell_x(grid, p->x)]++;
+		}
+	}
+	int pos = 0;
+	for (i=0; i<ncells; i++) {
+		grid->cell_start[i] = pos;
+		pos += grid->cell_cnt[i];
+		grid->cell_cnt[i] = 0;
+	}
+	grid->built = 0;
+	for (i=0; i<frame->objcnt; i++) {
+		Object *obj = &frame->objects[i];
+		if (!obj_eligible(ctx, obj))
+			continue;
+		for (j=0; j<ends; j++) {
+			Point *p = obj_endpoint(obj, j);
+			int cell = grid_cell_y(grid, p->y) * gdim + grid_cell_x(grid, p->x);
+			grid->entries[grid->cell_start[cell] + grid->cell_cnt[cell]++] = 2*i + j;
+		}
+		grid->built++;
+	}
+	grid->live = grid->built;
+}
+
+// Same choice as a linear scan over all objects in index order, testing the
+// start point before the end point and keeping the first strictly closer one.
+static int grid_nearest(ObjGrid *grid, Frame *frame, Point *to, int *inv)
+{
+	int best = -1;
+	float dbest = 0;
+	int cx = grid_cell_x(grid, to->x);
+	int cy = grid_cell_y(grid, to->y);
+	int rmax = grid->gw > grid->gh ? grid->gw : grid->gh;
+
+	for (int r=0; r<=rmax; r++) {
+		// points in ring r are at least r-1 cells away; allow one more
+		// cell of slack for rounding in the cell assignment
+		if (best >= 0 && (r - 2) * grid->cmin > dbest)
+			break;
+		for (int y=cy-r; y<=cy+r; y++) {
+			if (y < 0 || y >= grid->gh)
+				continue;
+			int step = (y == cy-r || y == cy+r) ? 1 : 2*r;
+			if (!step)
+				step = 1;
+			for (int x=cx-r; x<=cx+r; x+=step) {
+				if (x < 0 || x >= grid->gw)
+					continue;
+				int cell = y * grid->gw + x;
+				int *ent = grid->entries + grid->cell_start[cell];
+				int *cnt = &grid->cell_cnt[cell];
+				for (int i=0; i<*cnt; i++) {
+					Object *obj = &frame->objects[ent[i] >> 1];
+					if (!obj->pointcnt) {
+						// already rendered, drop it from the cell
+						ent[i--] = ent[--*cnt];
+						continue;
+					}
+					float d = obj_distance(obj_endpoint(obj, ent[i] & 1), to);
+					if (best < 0 || d < dbest || (d == dbest && ent[i] < best)) {
+						best = ent[i];
+						dbest = d;
+					}
+				}
+			}
+		}
+	}
+
+	if (best < 0)
+		return -1;
+	*inv = best & 1;
+	return best >> 1;
+}
+
+// Blank samples render_object() spends travelling between two objects
+static inline int blank_cost(OLContext *ctx, float x0, float y0, float x1, float y1)
+{
+	float distance = fmaxf(fabsf(x1 - x0), fabsf(y1 - y0));
+	if (distance <= ctx->params.snap)
+		return 0;
+	return ctx->params.end_wait + (int)ceilf(distance/ctx->params.off_speed) + ctx->params.start_wait;
+}
+
+#define TOUR_SX(t, k) ((t)->inv[k] ? (t)->keys[(t)->ord[k]].ex : (t)->keys[(t)->ord[k]].sx)
+#define TOUR_SY(t, k) ((t)->inv[k] ? (t)->keys[(t)->ord[k]].ey : (t)->keys[(t)->ord[k]].sy)
+#define TOUR_EX(t, k) ((t)->inv[k] ? (t)->keys[(t)->ord[k]].sx : (t)->keys[(t)->ord[k]].ex)
+#define TOUR_EY(t, k) ((t)->inv[k] ? (t)->keys[(t)->ord[k]].sy : (t)->keys[(t)->ord[k]].ey)
+
+// Cost of the blank jump from the end of tour position a to the start of
+// position b. Position -1 is the start point, n is past the end (free).
+static inline int tour_link(OLContext *ctx, Tour *t, Point *start, int a, int b)
+{
+	if (b >= t->n)
+		return 0;
+	if (a < 0)
+		return blank_cost(ctx, start->x, start->y, TOUR_SX(t, b), TOUR_SY(t, b));
+	return blank_cost(ctx, TOUR_EX(t, a), TOUR_EY(t, a), TOUR_SX(t, b), TOUR_SY(t, b));
+}
+
+static int tour_cost(OLContext *ctx, Tour *t, Point *start)
+{
+	int cost = 0;
+	for (int k=0; k<t->n; k++)
+		cost += tour_link(ctx, t, start, k-1, k);
+	return cost;
+}
+
+static void tour_reverse(Tour *t, int i, int j)
+{
+	for (; i < j; i++, j--) {
+		int o = t->ord[i];
+		uint8_t v = t->inv[i];
+		t->ord[i] = t->ord[j];
+		t->inv[i] = !t->inv[j];
+		t->ord[j] = o;
+		t->inv[j] = !v;
+	}
+	if (i == j)
+		t->inv[i] = !t->inv[i];
+}
+
+// 2-opt: reversing positions i..j (and flipping every object in it) only
+// changes the two jumps at its ends, since the jump cost is symmetric.
+// i == j is a plain reversal of one object.
+static int tour_2opt(OLContext *ctx, Tour *t, Point *start, int i, int j)
+{
+	float px, py;
+	if (i == 0) {
+		px = start->x;
+		py = start->y;
+	} else {
+		px = TOUR_EX(t, i-1);
+		py = TOUR_EY(t, i-1);
+	}
+	int before = tour_link(ctx, t, start, i-1, i) + tour_link(ctx, t, start, j, j+1);
+	int after = blank_cost(ctx, px, py, TOUR_EX(t, j), TOUR_EY(t, j));
+	if (j+1 < t->n)
+		after += blank_cost(ctx, TOUR_SX(t, i), TOUR_SY(t, i), TOUR_SX(t, j+1), TOUR_SY(t, j+1));
+	if (after >= before)
+		return 0;
+	tour_reverse(t, i, j);
+	return before - after;
+}
+
+// Or-opt: move the len objects at position i to after position p,
+// optionally reversed.
+static int tour_oropt(OLContext *ctx, Tour *t, Point *start, int i, int len, int p, int rev)
+{
+	int last = i + len - 1;
+	float sx, sy, ex, ey;
+	if (rev) {
+		sx = TOUR_EX(t, last); sy = TOUR_EY(t, last);
+		ex = TOUR_SX(t, i); ey = TOUR_SY(t, i);
+	} else {
+		sx = TOUR_SX(t, i); sy = TOUR_SY(t, i);
+		ex = TOUR_EX(t, last); ey = TOUR_EY(t, last);
+	}
+
+	int removed = tour_link(ctx, t, start, i-1, i) + tour_link(ctx, t, start, last, last+1)
+	              + tour_link(ctx, t, start, p, p+1);
+	int added = (last+1 < t->n) ? tour_link(ctx, t, start, i-1, last+1) : 0;
+	if (p < 0)
+		added += blank_cost(ctx, start->x, start->y, sx, sy);
+	else
+		added += blank_cost(ctx, TOUR_EX(t, p), TOUR_EY(t, p), sx, sy);
+	if (p+1 < t->n)
+		added += blank_cost(ctx, ex, ey, TOUR_SX(t, p+1), TOUR_SY(t, p+1));
+	if (added >= removed)
+		return 0;
+
+	int ord[3];
+	uint8_t inv[3];
+	memcpy(ord, &t->ord[i], len * sizeof(int));
+	memcpy(inv, &t->inv[i], len);
+	int dst;
+	if (p < i) {
+		dst = p + 1;
+		memmove(&t->ord[dst+len], &t->ord[dst], (i - dst) * sizeof(int));
+		memmove(&t->inv[dst+len], &t->inv[dst], i - dst);
+	} else {
+		dst = p - len + 1;
+		memmove(&t->ord[i], &t->ord[last+1], (p - last) * sizeof(int));
+		memmove(&t->inv[i], &t->inv[last+1], p - last);
+	}
+	memcpy(&t->ord[dst], ord, len * sizeof(int));
+	memcpy(&t->inv[dst], inv, len);
+	if (rev)
+		tour_reverse(t, dst, dst + len - 1);
+	return removed - added;
+}
+
+// Refinement budget per output and frame when optimize_time is not set
+#define OPTIMIZE_DEFAULT_TIME 0.002
+
+// How many candidate moves to try between deadline checks
+#define OPTIMIZE_CHECK_MOVES 256
+
+// Refines the tour in place, picking up at the candidate move where the plan's
+// last refinement stopped. For each object the moves are numbered: 2-opt with
+// every later object first, then Or-opt of the 1, 2 and 3 object runs starting
+// there to every position. Returns 1 once every object has been looked at
+// since a move last helped, or 0 if the time budget runs out first.
+static int tour_optimize(OLContext *ctx, Tour *t, Point *start, TourPlan *plan)
+{
+	int reverse = !(ctx->params.render_flags & RENDER_NOREVERSE);
+	double deadline;
+	unsigned int moves = 0;
+	int i = plan->pos;
+	int m = plan->move;
+
+	if (i >= t->n) {
+		i = 0;
+		m = 0;
+	}
+
+	if (ctx->params.optimize_time > 0)
+		deadline = get_time() + ctx->params.optimize_time;
+	else
+		deadline = get_time() + OPTIMIZE_DEFAULT_TIME;
+
+	// the object a move helped on is only done once all of it has been
+	// looked at again, hence the extra sweep step
+	while (plan->quiet <= t->n) {
+		int twoopt = reverse ? t->n - i : 0;
+		for (; m < twoopt + 3 * (t->n + 1); m++) {
+			if (!(++moves % OPTIMIZE_CHECK_MOVES) && get_time() > deadline) {
+				plan->pos = i;
+				plan->move = m;
+				return 0;
+			}
+			if (m < twoopt) {
+				if (tour_2opt(ctx, t, start, i, i + m))
+					plan->quiet = 0;
+				continue;
+			}
+			int len = (m - twoopt) / (t->n + 1) + 1;
+			int p = (m - twoopt) % (t->n + 1) - 1;
+			if (i+len > t->n)
+				break;
+			if (p >= i-1 && p <= i+len-1)
+				continue;
+			if (tour_oropt(ctx, t, start, i, len, p, 0) ||
+			    (reverse && tour_oropt(ctx, t, start, i, len, p, 1))) {
+				plan->quiet = 0;
+				// on to the next run length
+				m = twoopt + len * (t->n + 1) - 1;
+			}
+		}
+		plan->quiet++;
+		m = 0;
+		if (++i == t->n)
+			i = 0;
+	}
+	plan->pos = i;
+	plan->move = 0;
+	return 1;
+}
+
+static void tour_alloc(Tour *t, int count)
+{
+	if (count <= t->max)
+		return;
+	t->max = count;
+	t->keys = realloc(t->keys, count * sizeof(*t->keys));
+	t->ord = realloc(t->ord, count * sizeof(*t->ord));
+	t->inv = realloc(t->inv, count * sizeof(*t->inv));
+	t->cache_keys = realloc(t->cache_keys, count * sizeof(*t->cache_keys));
+	for (int i=0; i<2; i++) {
+		t->plans[i].ord = realloc(t->plans[i].ord, count * sizeof(*t->plans[i].ord));
+		t->plans[i].inv = realloc(t->plans[i].inv, count * sizeof(*t->plans[i].inv));
+	}
+}
+
+// Plans the object order for RENDER_OPTIMIZE into the output's tour: a greedy
+// nearest neighbour tour over the object endpoints, refined with 2-opt and
+// Or-opt moves until no move helps or optimize_time runs out. A cached tour is
+// reused if nothing it was planned from has changed, and refinement picks up
+// where it left off if the last frame ran out of time.
+static void plan_tour(OLContext *ctx, int output)
+{
+	Frame *frame = &ctx->wframes[output];
+	Tour *t = &frame->tour;
+	int i;
+
+	tour_alloc(t, frame->objcnt);
+	memset(t->keys, 0, frame->objcnt * sizeof(*t->keys));
+	for (i=0; i<frame->objcnt; i++) {
+		Object *obj = &frame->objects[i];
+		if (!obj_eligible(ctx, obj))
+			continue;
+		t->keys[i].pointcnt = obj->pointcnt;
+		t->keys[i].sx = obj->points[0].x;
+		t->keys[i].sy = obj->points[0].y;
+		t->keys[i].ex = obj->points[obj->pointcnt-1].x;
+		t->keys[i].ey = obj->points[obj->pointcnt-1].y;
+	}
+
+	Point *start = &ctx->last_render_point[output];
+	if (t->cache_objcnt == frame->objcnt &&
+	    t->cache_flags == ctx->params.render_flags &&
+	    t->cache_off_speed == ctx->params.off_speed &&
+	    t->cache_start_wait == ctx->params.start_wait &&
+	    t->cache_end_wait == ctx->params.end_wait &&
+	    !memcmp(t->keys, t->cache_keys, frame->objcnt * sizeof(*t->keys))) {
+		for (i=0; i<2; i++) {
+			TourPlan *plan = &t->plans[i];
+			if (plan->valid && plan->start_x == start->x && plan->start_y == start->y) {
+				t->n = plan->n;
+				memcpy(t->ord, plan->ord, t->n * sizeof(*t->ord));
+				memcpy(t->inv, plan->inv, t->n);
+				if (!plan->converged) {
+					plan->converged = tour_optimize(ctx, t, start, plan);
+					plan->saved = plan->greedy_cost - tour_cost(ctx, t, start);
+					memcpy(plan->ord, t->ord, t->n * sizeof(*t->ord));
+					memcpy(plan->inv, t->inv, t->n);
+				}
+				ctx->out_info[output].blank_points_saved = plan->saved;
+				return;
+			}
+		}
+	} else {
+		t->plans[0].valid = 0;
+		t->plans[1].valid = 0;
+		t->cache_objcnt = frame->objcnt;
+		t->cache_flags = ctx->params.render_flags;
+		t->cache_off_speed = ctx->params.off_speed;
+		t->cache_start_wait = ctx->params.start_wait;
+		t->cache_end_wait = ctx->params.end_wait;
+		memcpy(t->cache_keys, t->keys, frame->objcnt * sizeof(*t->keys));
+	}
+
+	// the grid skips used objects by their point count, so clear them while
+	// building the tour and restore them afterwards
+	ObjGrid *grid = &frame->grid;
+	Point closest_to = {-1,-1,0};
+	int inv;
+	grid_build(ctx, grid, frame);
+	t->n = 0;
+	while (1) {
+		if (grid->built > 64 && grid->live < grid->built / 2)
+			grid_build(ctx, grid, frame);
+		int idx = grid_nearest(grid, frame, &closest_to, &inv);
+		if (idx < 0)
+			break;
+		Object *obj = &frame->objects[idx];
+		t->ord[t->n] = idx;
+		t->inv[t->n] = inv;
+		closest_to = *obj_endpoint(obj, !inv);
+		t->n++;
+		obj->pointcnt = 0;
+		grid->live--;
+	}
+	for (i=0; i<frame->objcnt; i++)
+		if (t->keys[i].pointcnt)
+			frame->objects[i].pointcnt = t->keys[i].pointcnt;
+
+	TourPlan *plan = &t->plans[t->next_plan];
+	t->next_plan = !t->next_plan;
+	plan->pos = 0;
+	plan->move = 0;
+	plan->quiet = 0;
+	int greedy_cost = tour_cost(ctx, t, start);
+	plan->converged = tour_optimize(ctx, t, start, plan);
+	int saved = greedy_cost - tour_cost(ctx, t, start);
+	ctx->out_info[output].blank_points_saved = saved;
+
+	plan->valid = 1;
+	plan->start_x = start->x;
+	plan->start_y = start->y;
+	plan->n = t->n;
+	plan->greedy_cost = greedy_cost;
+	plan->saved = saved;
+	memcpy(plan->ord, t->ord, t->n * sizeof(*t->ord));
+	memcpy(plan->inv, t->inv, t->n);
+}
+
+static void reverse_object(Object *obj)
+{
+	Point *pt = obj->points;
+	int cnt = obj->pointcnt;
+	for (int i=0; i<cnt/2; i++) {
+		Point tmp = pt[i];
+		pt[i] = pt[cnt-i-1];
+		pt[cnt-i-1] = tmp;
+	}
+}
+
+// Grows the sample planes of one output in a ring slot to hold count
+// samples, keeping the first keep. Only called on slots owned by the
+// renderer.
+static void rf_reserve(OLContext *ctx, RenderedFrame *rframe, int output, int count, int keep)
+{
+	int size;
+	float *x;
+
+	if (count <= rframe->pmax[output])
+		return;
+	size = grow_size(ctx, rframe->pmax[output], count, 0);
+	x = malloc(5 * size * sizeof(float));
+	if (keep) {
+		memcpy(x, rframe->x[output], keep * sizeof(float));
+		memcpy(x + size, rframe->y[output], keep * sizeof(float));
+		memcpy(x + 2 * size, rframe->r[output], keep * sizeof(float));
+		memcpy(x + 3 * size, rframe->g[output], keep * sizeof(float));
+		memcpy(x + 4 * size, rframe->b[output], keep * sizeof(float));
+	}
+	free(rframe->x[output]);
+	rframe->x[output] = x;
+	rframe->y[output] = x + size;
+	rframe->r[output] = x + 2 * size;
+	rframe->g[output] = x + 3 * size;
+	rframe->b[output] = x + 4 * size;
+	rframe->pmax[output] = size;
+}
+
+// Splits rendered points into the sample planes of a ring slot, so the
+// playback side only has to copy them
+static void unpack_points(OLContext *ctx, RenderedFrame *rframe, int output, const Point *points, int count)
+{
+	rf_reserve(ctx, rframe, output, count, 0);
+
+	float *x = rframe->x[output];
+	float *y = rframe->y[output];
+	float *r = rframe->r[output];
+	float *g = rframe->g[output];
+	float *b = rframe->b[output];
+
+	for (int i = 0; i < count; i++) {
+		uint32_t color = points[i].color;
+		x[i] = points[i].x;
+		y[i] = points[i].y;
+		r[i] = ((color >> 16) & 0xff) / 255.0f;
+		g[i] = ((color >> 8) & 0xff) / 255.0f;
+		b[i] = (color & 0xff) / 255.0f;
+	}
+}
+
+// Blanking and dwells (lit points that do not move) are kept by the resampler
+static inline int fixed_point(const Point *points, int i)
+{
+	return i == 0 || points[i].color == C_BLACK ||
+		(points[i].x == points[i-1].x && points[i].y == points[i-1].y);
+}
+
+static inline void put_sample(RenderedFrame *rframe, int output, int j, float x, float y, uint32_t color)
+{
+	rframe->x[output][j] = x;
+	rframe->y[output][j] = y;
+	rframe->r[output][j] = ((color >> 16) & 0xff) / 255.0f;
+	rframe->g[output][j] = ((color >> 8) & 0xff) / 255.0f;
+	rframe->b[output][j] = (color & 0xff) / 255.0f;
+}
+
+/*
+Resamples the rendered points of an output to exactly out_count samples,
+straight into a ring slot. Every blanking and dwell sample is kept as it is,
+so corners and the moves between objects look the same, and the samples left
+over are spread evenly by arc length along the lit paths. When the fixed
+samples alone do not fit, everything is decimated evenly instead.
+*/
+static void resample_points(OLContext *ctx, RenderedFrame *rframe, int output, const Point *points, int count, int out_count)
+{
+	int i, j = 0, k = 0, fixed = 0, lit, last_moving = 0;
+	double total = 0, arc = 0;
+
+	rf_reserve(ctx, rframe, output, out_count, 0);
+
+	for (i = 0; i < count; i++) {
+		if (fixed_point(points, i)) {
+			fixed++;
+		} else {
+			total += hypotf(points[i].x - points[i-1].x, points[i].y - points[i-1].y);
+			last_moving = i;
+		}
+	}
+	lit = out_count - fixed;
+
+	if (lit <= 0 || total <= 0) {
+		for (j = 0; j < out_count; j++) {
+			i = out_count > 1 ? (long)j * (count - 1) / (out_count - 1) : count - 1;
+			put_sample(rframe, output, j, points[i].x, points[i].y, points[i].color);
+			if (points[i].color == C_BLACK)
+				ctx->out_info[output].resampled_blacks++;
+		}
+		return;
+	}
+
+	for (i = 0; i < count; i++) {
+		const Point *p = &points[i];
+		if (fixed_point(points, i)) {
+			put_sample(rframe, output, j++, p->x, p->y, p->color);
+			if (p->color == C_BLACK)
+				ctx->out_info[output].resampled_blacks++;
+			continue;
+		}
+		// lit sample k (1-based) sits at arc length k * total / lit
+		const Point *q = &points[i-1];
+		float d = hypotf(p->x - q->x, p->y - q->y);
+		double end = arc + d;
+		int upto = i == last_moving ? lit : (int)(end * lit / total);
+		if (upto > lit)
+			upto = lit;
+		for (; k < upto; k++) {
+			float t = k + 1 == lit ? 1 : ((k + 1) * total / lit - arc) / d;
+			t = CLAMP(t, 0, 1);
+			put_sample(rframe, output, j++, q->x + (p->x - q->x) * t, q->y + (p->y - q->y) * t, p->color);
+		}
+		arc = end;
+	}
+}
+
+#define HASH_PRIME 0x100000001b3ULL
+
+// FNV style hash of size bytes (a multiple of 4), in four independent lanes
+// of 64 bit words so that it runs at memory speed on big point buffers
+static uint64_t hash_words(uint64_t h, const void *data, size_t size)
+{
+	const uint8_t *p = data;
+	uint64_t lane[4] = {h, h ^ 1, h ^ 2, h ^ 3};
+	uint64_t w[4];
+	uint32_t t;
+	size_t i;
+
+	for (i = 0; i + 32 <= size; i += 32) {
+		memcpy(w, p + i, 32);
+		lane[0] = (lane[0] ^ w[0]) * HASH_PRIME;
+		lane[1] = (lane[1] ^ w[1]) * HASH_PRIME;
+		lane[2] = (lane[2] ^ w[2]) * HASH_PRIME;
+		lane[3] = (lane[3] ^ w[3]) * HASH_PRIME;
+	}
+	for (; i < size; i += 4) {
+		memcpy(&t, p + i, 4);
+		lane[0] = (lane[0] ^ t) * HASH_PRIME;
+	}
+	h = lane[0];
+	for (i = 1; i < 4; i++)
+		h = (h ^ (lane[i] >> 29) ^ lane[i]) * HASH_PRIME;
+	return h;
+}
+
+// Hashes everything render_output() works from: the objects, the render
+// parameters, where the scanner was left and the minimum frame length
+static uint64_t frame_hash(OLContext *ctx, int output, int min_points)
+{
+	Frame *frame = &ctx->wframes[output];
+	uint64_t h = 0xcbf29ce484222325ULL;
+
+	h = hash_words(h, &ctx->params, sizeof(ctx->params));
+	h = hash_words(h, &ctx->last_render_point[output], sizeof(Point));
+	h = hash_words(h, &min_points, sizeof(min_points));
+	h = hash_words(h, &frame->dropped, sizeof(frame->dropped));
+	h = hash_words(h, &frame->culled, sizeof(frame->culled));
+	for (int i = 0; i < frame->objcnt; i++) {
+		Object *obj = &frame->objects[i];
+		h = hash_words(h, &obj->pointcnt, sizeof(obj->pointcnt));
+		h = hash_words(h, &obj->skipped, sizeof(obj->skipped));
+		h = hash_words(h, obj->bbox, sizeof(obj->bbox));
+	}
+	return hash_words(h, frame->points, frame->psnext * sizeof(Point));
+}
+
+// Copies the samples of the last frame rendered for an output into the ring
+// slot being written
+static int reuse_output(OLContext *ctx, int output)
+{
+	Frame *frame = &ctx->wframes[output];
+	RenderedFrame *from = &ctx->frames[frame->reuse_slot];
+	RenderedFrame *to = write_frame(ctx);
+	int count = frame->reuse_count;
+
+	// synchronous backends write every frame to the same slot
+	if (to != from) {
+		rf_reserve(ctx, to, output, count, 0);
+		memcpy(to->x[output], from->x[output], count * sizeof(float));
+		memcpy(to->y[output], from->y[output], count * sizeof(float));
+		memcpy(to->r[output], from->r[output], count * sizeof(float));
+		memcpy(to->g[output], from->g[output], count * sizeof(float));
+		memcpy(to->b[output], from->b[output], count * sizeof(float));
+		frame->reuse_slot = to - ctx->frames;
+	}
+
+	ctx->out_info[output] = frame->reuse_info;
+	ctx->out_info[output].reuse_hits = 1;
+	ctx->out_info[output].reuse_misses = 0;
+	ctx->out_info[output].reorder_time = 0;
+	ctx->out_info[output].render_time = 0;
+	ctx->out_info[output].resample_time = 0;
+	ctx->out_info[output].output_time = 0;
+	frame->psnext = 0;
+	frame->objcnt = 0;
+	frame->dropped = 0;
+	frame->culled = 0;
+	return count;
+}
+
+static int render_output(OLContext *ctx, int output, int max_fps)
+{
+	Frame *frame = &ctx->wframes[output];
+	int count = 0;
+	int min_points = ctx->params.rate / max_fps;
+	int reuse = !(ctx->params.render_flags & RENDER_NOREUSE);
+	uint64_t hash = 0;
+	OLFrameInfo *info = &ctx->out_info[output];
+	double tm = get_time();
+
+	if (reuse) {
+		hash = frame_hash(ctx, output, min_points);
+		if (frame->reuse_valid && frame->reuse_hash == hash) {
+			count = reuse_output(ctx, output);
+			lap(&tm, &info->output_time);
+			return count;
+		}
+		info->reuse_misses = 1;
+	}
+	lap(&tm, &info->output_time);
+
+	frame->rpnext=0;
+	int cnt = frame->objcnt;
+	int clinv = 0;
+
+	if ((ctx->params.render_flags & RENDER_OPTIMIZE) && !(ctx->params.render_flags & RENDER_NOREORDER)) {
+		Tour *t = &frame->tour;
+		plan_tour(ctx, output);
+		lap(&tm, &info->reorder_time);
+		for (int k=0; k<t->n; k++) {
+			Object *obj = &frame->objects[t->ord[k]];
+			if (t->inv[k])
+				reverse_object(obj);
+			render_object(ctx, output, obj);
+			obj->pointcnt = 0;
+			ctx->out_info[output].objects++;
+		}
+	} else if (!(ctx->params.render_flags & RENDER_NOREORDER)) {
+		Point closest_to = {-1,-1,0}; // first look for the object nearest the botleft
+		ObjGrid *grid = &frame->grid;
+		grid_build(ctx, grid, frame);
+		lap(&tm, &info->reorder_time);
+		while(cnt) {
+			Object *closest = NULL;
+			// keep the grid dense as objects get used up
+			if (grid->built > 64 && grid->live < grid->built / 2)
+				grid_build(ctx, grid, frame);
+			int idx = grid_nearest(grid, frame, &closest_to, &clinv);
+			if (idx >= 0)
+				closest = &frame->objects[idx];
+			if (!closest)
+				break;
+			if (clinv)
+				reverse_object(closest);
+			//olLog("%d (%d) (nearest to %f,%f)\n", closest - frame->objects, closest->pointcnt, closest_to.x, closest_to.y);
+			if (render_object(ctx, output, closest))
+				closest_to = ctx->last_render_point[output];
+			//olLog("[%d] ", frame->rpnext);
+			//olLog("[LRP:%f %f]\n", ctx->last_render_point[output].x, ctx->last_render_point[output].y);
+			closest->pointcnt = 0;
+			grid->live--;
+			cnt--;
+			ctx->out_info[output].objects++;
+		}
+		//olLog("\n");
+	} else {
+		for (int i=0; i<frame->objcnt; i++) {
+			if (frame->objects[i].pointcnt + frame->objects[i].skipped < ctx->params.min_length)
+				continue;
+			render_object(ctx, output, &frame->objects[i]);
+		}
+	}
+	frame->psnext = 0;
+	frame->objcnt = 0;
+	ctx->out_info[output].dropped_objects += frame->dropped;
+	frame->dropped = 0;
+	ctx->out_info[output].culled_objects += frame->culled;
+	frame->culled = 0;
+	count = frame->rpnext;
+	ctx->out_info[output].points = count;
+
+	lap(&tm, &info->render_time);
+
+	RenderedFrame *rframe = write_frame(ctx);
+	if (ctx->params.max_framelen && count > ctx->params.max_framelen) {
+		count = ctx->params.max_framelen;
+		resample_points(ctx, rframe, output, frame->rpoints, frame->rpnext, count);
+		ctx->out_info[output].resampled_points = count;
+		lap(&tm, &info->resample_time);
+	} else {
+		unpack_points(ctx, rframe, output, frame->rpoints, count);
+	}
+	if (count) {
+		ctx->last_render_point[output].x = rframe->x[output][count-1];
+		ctx->last_render_point[output].y = rframe->y[output][count-1];
+	}
+	if (ctx->config.max_points && min_points > ctx->config.max_points)
+		min_points = ctx->config.max_points;
+	rf_reserve(ctx, rframe, output, min_points, count);
+	while(count < min_points) {
+		rframe->x[output][count] = ctx->last_render_point[output].x;
+		rframe->y[output][count] = ctx->last_render_point[output].y;
+		rframe->r[output][count] = 0;
+		rframe->g[output][count] = 0;
+		rframe->b[output][count] = 0;
+		count++;
+		ctx->out_info[output].padding_points++;
+	}
+	frame->rpnext = count;
+
+	lap(&tm, &info->output_time);
+
+	frame->reuse_valid = reuse;
+	frame->reuse_hash = hash;
+	frame->reuse_slot = rframe - ctx->frames;
+	frame->reuse_count = count;
+	frame->reuse_info = ctx->out_info[output];
+
+	return count;
+}
+
+void olCtxSetOutput(OLContext *ctx, int output)
+{
+	ctx->wframe = &ctx->wframes[output];
+}
+
+/*
+With several outputs, outputs 1..n-1 are rendered by one worker thread each
+while the calling thread renders output 0. Everything render_output() touches
+is per output (temp frame, point counter, info, last point), so the workers
+only need to sync up at the start and end of each frame.
+*/
+
+
+static void *render_thread(void *arg)
+{
+	RenderWorker *worker = arg;
+	OLContext *ctx = worker->ctx;
+	int output = worker->output;
+	unsigned int gen = 0;
+
+	pthread_mutex_lock(&ctx->render_lock);
+	while (1) {
+		while (gen == ctx->render_gen && !ctx->render_quit)
+			pthread_cond_wait(&ctx->render_start, &ctx->render_lock);
+		if (ctx->render_quit)
+			break;
+		gen = ctx->render_gen;
+		pthread_mutex_unlock(&ctx->render_lock);
+
+		ctx->render_counts[output] = render_output(ctx, output, ctx->render_fps);
+
+		pthread_mutex_lock(&ctx->render_lock);
+		if (--ctx->render_busy == 0)
+			pthread_cond_signal(&ctx->render_done);
+	}
+	pthread_mutex_unlock(&ctx->render_lock);
+	return NULL;
+}
+
+static void start_render_threads(OLContext *ctx)
+{
+	ctx->render_gen = 0;
+	ctx->render_busy = 0;
+	ctx->render_quit = 0;
+	for (int i = 1; i < ctx->config.num_outputs; i++) {
+		ctx->workers[i].ctx = ctx;
+		ctx->workers[i].output = i;
+		pthread_create(&ctx->workers[i].thread, NULL, render_thread, &ctx->workers[i]);
+	}
+}
+
+static void stop_render_threads(OLContext *ctx)
+{
+	pthread_mutex_lock(&ctx->render_lock);
+	ctx->render_quit = 1;
+	pthread_cond_broadcast(&ctx->render_start);
+	pthread_mutex_unlock(&ctx->render_lock);
+	for (int i = 1; i < ctx->config.num_outputs; i++)
+		pthread_join(ctx->workers[i].thread, NULL);
+}
+
+// Logs repeated frames at most once a second, and with min_buffer_count
+// queues one more frame ahead after a repeat, one less once playback has
+// kept up for LEAD_SETTLE seconds
+static void adjust_lead(OLContext *ctx, double now)
+{
+	int repeats = ctx->last_info.repeated_frames;
+
+	ctx->log_repeats += repeats;
+	if (ctx->log_repeats && now - ctx->log_time >= 1.0) {
+		olLog("%u frame(s) repeated in %.1f s, %d queued ahead\n",
+		      ctx->log_repeats, now - ctx->log_time, ctx->buflag);
+		ctx->log_repeats = 0;
+		ctx->log_time = now;
+	}
+
+	if (!ctx->config.min_buffer_count)
+		return;
+	if (repeats) {
+		if (ctx->buflag < ctx->config.buffer_count)
+			ctx->buflag++;
+		ctx->lead_time = now;
+	} else if (ctx->buflag > ctx->config.min_buffer_count &&
+	           now - ctx->lead_time >= LEAD_SETTLE) {
+		ctx->buflag--;
+		ctx->lead_time = now;
+	}
+}
+
+float olCtxRenderFrame(OLContext *ctx, int max_fps)
+{
+	int *counts = ctx->render_counts;
+	int count = 0;
+	int needed = 0;
+	int wr = atomic_load_explicit(&ctx->cwbuf, memory_order_relaxed);
+	double wait_start = 0;
+	double tm = get_time();
+	unsigned int repeats;
+
+	memset(&ctx->last_info, 0, sizeof(ctx->last_info));
+	memset(ctx->out_info, 0, sizeof(ctx->out_info));
+	ctx->last_info.draw_time = tm - ctx->draw_start;
+	ctx->last_info.shader_time = ctx->shader_time;
+	ctx->shader_time = 0;
+	repeats = atomic_load_explicit(&ctx->rt_repeats, memory_order_relaxed);
+	ctx->last_info.repeated_frames = repeats - ctx->seen_repeats;
+	ctx->seen_repeats = repeats;
+	ctx->last_info.callback_time = atomic_exchange_explicit(&ctx->rt_max_ns, 0, memory_order_relaxed) / 1e9;
+	adjust_lead(ctx, tm);
+
+	// frames queued, counting the one playing
+	while (!ctx->backend->write &&
+	       (wr - atomic_load_explicit(&ctx->crbuf, memory_order_acquire) + ctx->fbufs) % ctx->fbufs >= ctx->buflag) {
+		//olLog("Waiting %d\n", wr);
+		if (!wait_start)
+			wait_start = get_time();
+		atomic_store_explicit(&ctx->first_time_full, 1, memory_order_release);
+		while (sem_wait(&ctx->frame_free) < 0 && errno == EINTR);
+	}
+	if (wait_start)
+		ctx->last_info.queue_wait = get_time() - wait_start;
+
+	if (ctx->config.num_outputs > 1) {
+		pthread_mutex_lock(&ctx->render_lock);
+		ctx->render_fps = max_fps;
+		ctx->render_busy = ctx->config.num_outputs - 1;
+		ctx->render_gen++;
+		pthread_cond_broadcast(&ctx->render_start);
+		pthread_mutex_unlock(&ctx->render_lock);
+	}
+
+	counts[0] = render_output(ctx, 0, max_fps);
+
+	if (ctx->config.num_outputs > 1) {
+		pthread_mutex_lock(&ctx->render_lock);
+		while (ctx->render_busy)
+			pthread_cond_wait(&ctx->render_done, &ctx->render_lock);
+		pthread_mutex_unlock(&ctx->render_lock);
+	}
+	ctx->wframe = &ctx->wframes[0];
+
+	for (int i = 0; i < ctx->config.num_outputs; i++) {
+		if (counts[i] > count)
+			count = counts[i];
+		ctx->last_info.objects += ctx->out_info[i].objects;
+		ctx->last_info.points += ctx->out_info[i].points;
+		ctx->last_info.resampled_points += ctx->out_info[i].resampled_points;
+		ctx->last_info.resampled_blacks += ctx->out_info[i].resampled_blacks;
+		ctx->last_info.padding_points += ctx->out_info[i].padding_points;
+		ctx->last_info.blank_points += ctx->out_info[i].blank_points;
+		ctx->last_info.blank_points_saved += ctx->out_info[i].blank_points_saved;
+		ctx->last_info.dropped_objects += ctx->out_info[i].dropped_objects;
+		ctx->last_info.dropped_points += ctx->out_info[i].dropped_points;
+		ctx->last_info.culled_objects += ctx->out_info[i].culled_objects;
+		ctx->last_info.reuse_hits += ctx->out_info[i].reuse_hits;
+		ctx->last_info.reuse_misses += ctx->out_info[i].reuse_misses;
+		ctx->last_info.reorder_time += ctx->out_info[i].reorder_time;
+		ctx->last_info.render_time += ctx->out_info[i].render_time;
+		ctx->last_info.resample_time += ctx->out_info[i].resample_time;
+		ctx->last_info.output_time += ctx->out_info[i].output_time;
+		if (ctx->out_info[i].points > needed)
+			needed = ctx->out_info[i].points;
+	}
+	update_detail(ctx, needed);
+	ctx->last_info.detail_level = ctx->detail_level;
+	ctx->last_info.detail_scale = detail_scale(ctx->detail_level);
+	tm = get_time();
+
+	for (int i = 0; i < ctx->config.num_outputs; i++) {
+		RenderedFrame *rframe = &ctx->frames[wr];
+		float x = 0, y = 0, r = 0, g = 0, b = 0;
+		rf_reserve(ctx, rframe, i, count, counts[i]);
+		if (counts[i] > 0) {
+			int last = counts[i] - 1;
+			x = rframe->x[i][last];
+			y = rframe->y[i][last];
+			r = rframe->r[i][last];
+			g = rframe->g[i][last];
+			b = rframe->b[i][last];
+		}
+		for (int j = counts[i]; j < count; j++) {
+			rframe->x[i][j] = x;
+			rframe->y[i][j] = y;
+			rframe->r[i][j] = r;
+			rframe->g[i][j] = g;
+			rframe->b[i][j] = b;
+		}
+	}
+	ctx->frames[wr].pnext = count;
+
+	if (count > ctx->frames[wr].amax) {
+		RenderedFrame *rframe = &ctx->frames[wr];
+		rframe->amax = grow_size(ctx, rframe->amax, count, 0);
+		rframe->audio_l = realloc(rframe->audio_l, rframe->amax * sizeof(float));
+		rframe->audio_r = realloc(rframe->audio_r, rframe->amax * sizeof(float));
+	}
+
+	lap(&tm, &ctx->last_info.output_time);
+
+	if (ctx->audiocb) {
+		ctx->audiocb(ctx->frames[wr].audio_l, ctx->frames[wr].audio_r, count);
+	} else {
+		memset(ctx->frames[wr].audio_l, 0, sizeof(float)*count);
+		memset(ctx->frames[wr].audio_r, 0, sizeof(float)*count);
+	}
+	lap(&tm, &ctx->last_info.audio_time);
+
+	//olLog("Rendered frame! %d\n", wr);
+	if (ctx->backend->write) {
+		ctx->backend->write(ctx, &ctx->frames[wr]);
+	} else {
+		int rd;
+		wr = (wr + 1) % ctx->fbufs;
+		atomic_store_explicit(&ctx->cwbuf, wr, memory_order_release);
+		rd = atomic_load_explicit(&ctx->crbuf, memory_order_acquire);
+		ctx->last_info.queue_depth = (wr - rd + ctx->fbufs) % ctx->fbufs;
+		ctx->last_info.queue_lead = ctx->buflag;
+	}
+	lap(&tm, &ctx->last_info.output_time);
+	ctx->draw_start = tm;
+
+	return count / (float)ctx->params.rate;
+}
+
+void olCtxLoadIdentity(OLContext *ctx)
+{
+	static const float identity[3][3] = {
+		{1,0,0},
+		{0,1,0},
+		{0,0,1}
+	};
+	memcpy(&ctx->mtx2d[0][0], &identity[0][0], sizeof(ctx->mtx2d));
+}
+
+void olCtxRotate(OLContext *ctx, float theta)
+{
+	float rot[9] = {
+		cosf(theta),-sinf(theta),0,
+		sinf(theta),cosf(theta),0,
+		0,0,1,
+	};
+	olCtxMultMatrix(ctx, rot);
+}
+
+void olCtxTranslate(OLContext *ctx, float x, float y)
+{
+	float trans[9] = {
+		1,0,0,
+		0,1,0,
+		x,y,1,
+	};
+	olCtxMultMatrix(ctx, trans);
+}
+
+
+void olCtxScale(OLContext *ctx, float sx, float sy)
+{
+	float scale[9] = {
+		sx,0,0,
+		0,sy,0,
+		0,0,1,
+	};
+	olCtxMultMatrix(ctx, scale);
+}
+
+void olCtxMultMatrix(OLContext *ctx, float m[9])
+{
+	float new[3][3];
+
+	new[0][0] = ctx->mtx2d[0][0]*m[0] + ctx->mtx2d[0][1]*m[1] + ctx->mtx2d[0][2]*m[2];
+	new[0][1] = ctx->mtx2d[0][0]*m[3] + ctx->mtx2d[0][1]*m[4] + ctx->mtx2d[0][2]*m[5];
+	new[0][2] = ctx->mtx2d[0][0]*m[6] + ctx->mtx2d[0][1]*m[7] + ctx->mtx2d[0][2]*m[8];
+	new[1][0] = ctx->mtx2d[1][0]*m[0] + ctx->mtx2d[1][1]*m[1] + ctx->mtx2d[1][2]*m[2];
+	new[1][1] = ctx->mtx2d[1][0]*m[3] + ctx->mtx2d[1][1]*m[4] + ctx->mtx2d[1][2]*m[5];
+	new[1][2] = ctx->mtx2d[1][0]*m[6] + ctx->mtx2d[1][1]*m[7] + ctx->mtx2d[1][2]*m[8];
+	new[2][0] = ctx->mtx2d[2][0]*m[0] + ctx->mtx2d[2][1]*m[1] + ctx->mtx2d[2][2]*m[2];
+	new[2][1] = ctx->mtx2d[2][0]*m[3] + ctx->mtx2d[2][1]*m[4] + ctx->mtx2d[2][2]*m[5];
+	new[2][2] = ctx->mtx2d[2][0]*m[6] + ctx->mtx2d[2][1]*m[7] + ctx->mtx2d[2][2]*m[8];
+
+	memcpy(&ctx->mtx2d[0][0], &new[0][0], sizeof(ctx->mtx2d));
+}
+
+void olCtxPushMatrix(OLContext *ctx)
+{
+	memcpy(&ctx->mtx2ds[ctx->mtx2dp][0][0], &ctx->mtx2d[0][0], sizeof(ctx->mtx2d));
+	ctx->mtx2dp++;
+}
+
+void olCtxPopMatrix(OLContext *ctx)
+{
+	ctx->mtx2dp--;
+	memcpy(&ctx->mtx2d[0][0], &ctx->mtx2ds[ctx->mtx2dp][0][0], sizeof(ctx->mtx2d));
+}
+
+void olCtxLoadIdentity3(OLContext *ctx)
+{
+	static const float identity[4][4] = {
+		{1,0,0,0},
+		{0,1,0,0},
+		{0,0,1,0},
+		{0,0,0,1},
+	};
+	memcpy(&ctx->mtx3d[0][0], &identity[0][0], sizeof(ctx->mtx3d));
+}
+
+void olCtxRotate3X(OLContext *ctx, float theta)
+{
+	float rot[16] = {
+		1,0,0,0,
+		0,cosf(theta),sinf(theta),0,
+		0,-sinf(theta),cosf(theta),0,
+		0,0,0,1
+	};
+	olCtxMultMatrix3(ctx, rot);
+}
 
-	Point *ip = obj->points;
-	for (i=0; i<obj->pointcnt; i++, ip++) {
-		if (ip->x < obj->bbox[0][0] || ip->x > obj->bbox[1][0] ||
-			ip->y < obj->bbox[0][1] || ip->y > obj->bbox[1][1])
-			continue;
-		if (ip->color != C_BLACK)
-			break;
-	}
-	if (i == obj->pointcnt) // null object
-		return 0;
+void olCtxRotate3Y(OLContext *ctx, float theta)
+{
+	float rot[16] = {
+		cosf(theta),0,-sinf(theta),0,
+		0,1,0,0,
+		sinf(theta),0,cosf(theta),0,
+		0,0,0,1
+	};
+	olCtxMultMatrix3(ctx, rot);
+}
 
-	ip = obj->points;
-	int prev_inside = 0;
-	for (i=0; i<obj->pointcnt; i++, ip++) {
-		int inside = 1;
-		if (ip->x < obj->bbox[0][0] || ip->x > obj->bbox[1][0] ||
-			ip->y < obj->bbox[0][1] || ip->y > obj->bbox[1][1])
-			inside = 0;
-		if (ip->color == 0 && (params.render_flags & RENDER_CULLDARK))
-			inside = 0;
-		if (inside && !prev_inside) {
-			float dx = ip->x - last_render_point[output].x;
-			float dy = ip->y - last_render_point[output].y;
-			float distance = fmaxf(fabsf(dx),fabsf(dy));
-			int points = ceilf(distance/params.off_speed);
-			if (distance > params.snap) {
-				for (j=0; j<params.end_wait; j++) {
-					addrndpoint(output, last_render_point[output].x, last_render_point[output].y, C_BLACK);
-				}
-				for (j=0; j<points; j++) {
-					addrndpoint(output, last_render_point[output].x + (dx/(float)points) * j,
-								last_render_point[output].y + (dy/(float)points) * j,
-								C_BLACK);
-				}
-				for (j=0; j<params.start_wait; j++) {
-					addrndpoint(output, ip->x, ip->y, C_BLACK);
-				}
+void olCtxRotate3Z(OLContext *ctx, float theta)
+{
+	float rot[16] = {
+		cosf(theta), sinf(theta), 0, 0,
+		-sinf(theta), cosf(theta), 0, 0,
+		0, 0, 1, 0,
+		0, 0, 0, 1
+	};
+	olCtxMultMatrix3(ctx, rot);
+}
+
+void olCtxTranslate3(OLContext *ctx, float x, float y, float z)
+{
+	float trans[16] = {
+		1,0,0,0,
+		0,1,0,0,
+		0,0,1,0,
+		x,y,z,1,
+	};
+	olCtxMultMatrix3(ctx, trans);
+}
+
+
+void olCtxScale3(OLContext *ctx, float sx, float sy, float sz)
+{
+	float trans[16] = {
+		sx,0,0,0,
+		0,sy,0,0,
+		0,0,sz,0,
+		0,0,0,1,
+	};
+	olCtxMultMatrix3(ctx, trans);
+}
+
+void olCtxMultMatrix3(OLContext *ctx, float m[16])
+{
+	float new[4][4];
+
+	new[0][0] = ctx->mtx3d[0][0]*m[ 0] + ctx->mtx3d[0][1]*m[ 1] + ctx->mtx3d[0][2]*m[ 2] + ctx->mtx3d[0][3]*m[ 3];
+	new[0][1] = ctx->mtx3d[0][0]*m[ 4] + ctx->mtx3d[0][1]*m[ 5] + ctx->mtx3d[0][2]*m[ 6] + ctx->mtx3d[0][3]*m[ 7];
+	new[0][2] = ctx->mtx3d[0][0]*m[ 8] + ctx->mtx3d[0][1]*m[ 9] + ctx->mtx3d[0][2]*m[10] + ctx->mtx3d[0][3]*m[11];
+	new[0][3] = ctx->mtx3d[0][0]*m[12] + ctx->mtx3d[0][1]*m[13] + ctx->mtx3d[0][2]*m[14] + ctx->mtx3d[0][3]*m[15];
+	new[1][0] = ctx->mtx3d[1][0]*m[ 0] + ctx->mtx3d[1][1]*m[ 1] + ctx->mtx3d[1][2]*m[ 2] + ctx->mtx3d[1][3]*m[ 3];
+	new[1][1] = ctx->mtx3d[1][0]*m[ 4] + ctx->mtx3d[1][1]*m[ 5] + ctx->mtx3d[1][2]*m[ 6] + ctx->mtx3d[1][3]*m[ 7];
+	new[1][2] = ctx->mtx3d[1][0]*m[ 8] + ctx->mtx3d[1][1]*m[ 9] + ctx->mtx3d[1][2]*m[10] + ctx->mtx3d[1][3]*m[11];
+	new[1][3] = ctx->mtx3d[1][0]*m[12] + ctx->mtx3d[1][1]*m[13] + ctx->mtx3d[1][2]*m[14] + ctx->mtx3d[1][3]*m[15];
+	new[2][0] = ctx->mtx3d[2][0]*m[ 0] + ctx->mtx3d[2][1]*m[ 1] + ctx->mtx3d[2][2]*m[ 2] + ctx->mtx3d[2][3]*m[ 3];
+	new[2][1] = ctx->mtx3d[2][0]*m[ 4] + ctx->mtx3d[2][1]*m[ 5] + ctx->mtx3d[2][2]*m[ 6] + ctx->mtx3d[2][3]*m[ 7];
+	new[2][2] = ctx->mtx3d[2][0]*m[ 8] + ctx->mtx3d[2][1]*m[ 9] + ctx->mtx3d[2][2]*m[10] + ctx->mtx3d[2][3]*m[11];
+	new[2][3] = ctx->mtx3d[2][0]*m[12] + ctx->mtx3d[2][1]*m[13] + ctx->mtx3d[2][2]*m[14] + ctx->mtx3d[2][3]*m[15];
+	new[3][0] = ctx->mtx3d[3][0]*m[ 0] + ctx->mtx3d[3][1]*m[ 1] + ctx->mtx3d[3][2]*m[ 2] + ctx->mtx3d[3][3]*m[ 3];
+	new[3][1] = ctx->mtx3d[3][0]*m[ 4] + ctx->mtx3d[3][1]*m[ 5] + ctx->mtx3d[3][2]*m[ 6] + ctx->mtx3d[3][3]*m[ 7];
+	new[3][2] = ctx->mtx3d[3][0]*m[ 8] + ctx->mtx3d[3][1]*m[ 9] + ctx->mtx3d[3][2]*m[10] + ctx->mtx3d[3][3]*m[11];
+	new[3][3] = ctx->mtx3d[3][0]*m[12] + ctx->mtx3d[3][1]*m[13] + ctx->mtx3d[3][2]*m[14] + ctx->mtx3d[3][3]*m[15];
+
+	memcpy(&ctx->mtx3d[0][0], &new[0][0], sizeof(ctx->mtx3d));
+}
+
+void olCtxPushMatrix3(OLContext *ctx)
+{
+	memcpy(&ctx->mtx3ds[ctx->mtx3dp][0][0], &ctx->mtx3d[0][0], sizeof(ctx->mtx3d));
+	ctx->mtx3dp++;
+}
+
+void olCtxPopMatrix3(OLContext *ctx)
+{
+	ctx->mtx3dp--;
+	memcpy(&ctx->mtx3d[0][0], &ctx->mtx3ds[ctx->mtx3dp][0][0], sizeof(ctx->mtx3d));
+}
+
+void olCtxTransformVertex4(OLContext *ctx, float *x, float *y, float *z, float *w)
+{
+	float px;
+	float py;
+	float pz;
+	float pw;
+
+	px = ctx->mtx3d[0][0]**x + ctx->mtx3d[0][1]**y + ctx->mtx3d[0][2]**z + ctx->mtx3d[0][3]**w;
+	py = ctx->mtx3d[1][0]**x + ctx->mtx3d[1][1]**y + ctx->mtx3d[1][2]**z + ctx->mtx3d[1][3]**w;
+	pz = ctx->mtx3d[2][0]**x + ctx->mtx3d[2][1]**y + ctx->mtx3d[2][2]**z + ctx->mtx3d[2][3]**w;
+	pw = ctx->mtx3d[3][0]**x + ctx->mtx3d[3][1]**y + ctx->mtx3d[3][2]**z + ctx->mtx3d[3][3]**w;
+
+	*x = px;
+	*y = py;
+	*z = pz;
+	*w = pw;
+}
+
+void olCtxTransformVertex3(OLContext *ctx, float *x, float *y, float *z)
+{
+	float w = 1.0;
+
+	olCtxTransformVertex4(ctx, x, y, z, &w);
+
+	*x /= w;
+	*y /= w;
+	*z /= w;
+}
+
+void olCtxTransformVertices(OLContext *ctx, float *x, float *y, int count)
+{
+	ol_xf.transform2(ctx->mtx2d, x, y, count);
+}
+
+void olCtxTransformVertices3(OLContext *ctx, float *x, float *y, float *z, int count)
+{
+	ol_xf.transform3(ctx->mtx3d, x, y, z, count);
+}
+
+// Clip space w below which 3D vertices are behind the near plane
+static float near_w(OLContext *ctx)
+{
+	return ctx->params.z_near > SMALL_Z ? ctx->params.z_near : SMALL_Z;
+}
+
+// Projects a clip space vertex in front of the near plane
+static void project_vertex(OLContext *ctx, const float c[4], uint32_t color)
+{
+	float z = c[2] / c[3];
+	if (z == 0)
+		z = SMALL_Z; // Hack for code not clipping z
+	vertex2z(ctx, c[0] / c[3], c[1] / c[3], 1.0 / z, color);
+}
+
+// Line strips are clipped against the near plane, ending the object where
+// they go behind it and starting a new one where they come back. Points
+// behind it are dropped; bezier control points are projected as they are.
+static void clip_vertex(OLContext *ctx, const float c[4], uint32_t color)
+{
+	DrawState *ds = &ctx->dstate;
+	float near = near_w(ctx);
+	int in = c[3] >= near;
+	float e[4];
+	int i;
+
+	if (ds->prim == OL_BEZIERSTRIP) {
+		project_vertex(ctx, c, color);
+	} else if (ds->prim == OL_POINTS || !ds->clip_valid) {
+		if (in)
+			project_vertex(ctx, c, color);
+	} else {
+		if (in != (ds->clip[3] >= near)) {
+			float t = (ds->clip[3] - near) / (ds->clip[3] - c[3]);
+			for (i = 0; i < 3; i++)
+				e[i] = ds->clip[i] + t * (c[i] - ds->clip[i]);
+			e[3] = near;
+			project_vertex(ctx, e, color);
+			if (!in) {
+				int prim = ds->prim;
+				olCtxEnd(ctx);
+				olCtxBegin(ctx, prim);
 			}
 		}
-		if (inside) {
-			last_render_point[output] = *ip;
-			addrndpoint(output, ip->x, ip->y, ip->color);
-		}
-		prev_inside = inside;
+		if (in)
+			project_vertex(ctx, c, color);
 	}
-	return 1;
+	memcpy(ds->clip, c, sizeof(ds->clip));
+	ds->clip_valid = 1;
 }
 
-static int render_output(int output, int max_fps)
+void olCtxVertex3(OLContext *ctx, float x, float y, float z, uint32_t color)
 {
-	int count = 0;
-	int min_points = params.rate / max_fps;
+	float c[4];
 
-	frames[cwbuf].pnext=0;
-	int cnt = wframe->objcnt;
-	float dclosest = 0;
-	int clinv = 0;
+	if (ctx->recording) {
+		list_vertex(ctx->recording, x, y, z, color, 1);
+		return;
+	}
+	if(ctx->v3shader)
+		ctx->v3shader(&x, &y, &z, &color);
+	if (!ctx->dstate.curobj)
+		return;
+	c[0] = x;
+	c[1] = y;
+	c[2] = z;
+	c[3] = 1.0;
+	olCtxTransformVertex4(ctx, &c[0], &c[1], &c[2], &c[3]);
+	clip_vertex(ctx, c, color);
+}
 
-	if (!(params.render_flags & RENDER_NOREORDER)) {
-		Point closest_to = {-1,-1,0}; // first look for the object nearest the botleft
-		while(cnt) {
-			Object *closest = NULL;
-			for (int i=0; i<wframe->objcnt; i++) {
-				if (!wframe->objects[i].pointcnt)
-					continue;
-				if (wframe->objects[i].pointcnt < params.min_length)
-					continue;
-				float dx = wframe->objects[i].points[0].x - closest_to.x;
-				float dy = wframe->objects[i].points[0].y - closest_to.y;
-				float distance = fmaxf(fabsf(dx),fabsf(dy)) + 0.01*(fabsf(dx)+fabsf(dy));
-				if (!closest || distance < dclosest) {
-					closest = &wframe->objects[i];
-					clinv = 0;
-					dclosest = distance;
-				}
-				if (!(params.render_flags & RENDER_NOREVERSE)) {
-					dx = wframe->objects[i].points[wframe->objects[i].pointcnt-1].x - closest_to.x;
-					dy = wframe->objects[i].points[wframe->objects[i].pointcnt-1].y - closest_to.y;
-					distance = fmaxf(fabsf(dx),fabsf(dy)) + 0.01*(fabsf(dx)+fabsf(dy));
-					if(!closest || distance < dclosest) {
-						closest = &wframe->objects[i];
-						clinv = 1;
-						dclosest = distance;
-					}
-				}
-			}
-			if (!closest)
+void olCtxVertexArray(OLContext *ctx, int size, int stride, const float *pointer)
+{
+	if (size != 2 && size != 3) {
+		olLog("olVertexArray: bad size %d\n", size);
+		return;
+	}
+	ctx->va_size = size;
+	ctx->va_stride = stride ? stride : size * sizeof(float);
+	ctx->va_pointer = pointer;
+}
+
+void olCtxColorArray(OLContext *ctx, int stride, const uint32_t *pointer)
+{
+	ctx->ca_stride = stride ? stride : sizeof(uint32_t);
+	ctx->ca_pointer = pointer;
+}
+
+void olCtxGetVertexArray(OLContext *ctx, int *size, int *stride, const float **pointer)
+{
+	*size = ctx->va_size;
+	*stride = ctx->va_stride;
+	*pointer = ctx->va_pointer;
+}
+
+void olCtxGetColorArray(OLContext *ctx, int *stride, const uint32_t **pointer)
+{
+	*stride = ctx->ca_stride;
+	*pointer = ctx->ca_pointer;
+}
+
+#define ARRAY_BATCH 256
+
+// Whether a batch of 3D vertices can skip near plane clipping: nothing in it,
+// or in the line segment leading up to it, is behind the plane
+static int batch_in_front(OLContext *ctx, const float *x, const float *y, const float *z, int count)
+{
+	float (*m)[4] = ctx->mtx3d;
+	float near = near_w(ctx);
+	int i, in = 1;
+
+	if (ctx->dstate.prim == OL_BEZIERSTRIP)
+		return 1;
+	if (ctx->dstate.prim == OL_LINESTRIP && ctx->dstate.clip_valid)
+		in = ctx->dstate.clip[3] >= near;
+	for (i = 0; i < count; i++)
+		in &= m[3][0]*x[i] + m[3][1]*y[i] + m[3][2]*z[i] + m[3][3] >= near;
+	return in;
+}
+
+// Gathers and colours up to ARRAY_BATCH vertices at a time into planar scratch
+// arrays for the batch transform kernels, then feeds them to the
+// primitive with the switch hoisted out of the loop. Only valid when no vertex
+// shader could see the individual vertices.
+static void draw_arrays_batched(OLContext *ctx, int first, int count)
+{
+	float bx[ARRAY_BATCH], by[ARRAY_BATCH], bz[ARRAY_BATCH];
+	uint32_t bc[ARRAY_BATCH];
+	float last[4];
+	const char *vp = (const char *)ctx->va_pointer + (size_t)first * ctx->va_stride;
+	const char *cp = NULL;
+	int i, n;
+
+	if (ctx->ca_pointer)
+		cp = (const char *)ctx->ca_pointer + (size_t)first * ctx->ca_stride;
+
+	while (count > 0 && ctx->dstate.curobj) {
+		n = count < ARRAY_BATCH ? count : ARRAY_BATCH;
+
+		for (i = 0; i < n; i++) {
+			const float *v = (const float *)(vp + (size_t)i * ctx->va_stride);
+			bx[i] = v[0];
+			by[i] = v[1];
+			bz[i] = ctx->va_size == 3 ? v[2] : 0;
+		}
+		if (cp) {
+			for (i = 0; i < n; i++)
+				bc[i] = *(const uint32_t *)(cp + (size_t)i * ctx->ca_stride);
+			cp += (size_t)n * ctx->ca_stride;
+		} else {
+			for (i = 0; i < n; i++)
+				bc[i] = C_WHITE;
+		}
+		vp += (size_t)n * ctx->va_stride;
+		count -= n;
+
+		if (ctx->va_size == 3 && !batch_in_front(ctx, bx, by, bz, n)) {
+			for (i = 0; i < n; i++)
+				olCtxVertex3(ctx, bx[i], by[i], bz[i], bc[i]);
+			continue;
+		}
+		for (i = 0; i < n; i++)
+			bc[i] = colmul(bc[i], ctx->curcol);
+
+		if (ctx->va_size == 3) {
+			last[0] = bx[n-1];
+			last[1] = by[n-1];
+			last[2] = bz[n-1];
+			last[3] = 1.0;
+			olCtxTransformVertex4(ctx, &last[0], &last[1], &last[2], &last[3]);
+			memcpy(ctx->dstate.clip, last, sizeof(last));
+			ctx->dstate.clip_valid = 1;
+			// same as olVertex3(): project, then z becomes 1/depth
+			ol_xf.transform3(ctx->mtx3d, bx, by, bz, n);
+			for (i = 0; i < n; i++)
+				bz[i] = 1.0 / (bz[i] == 0 ? SMALL_Z : bz[i]);
+		}
+		ol_xf.transform2(ctx->mtx2d, bx, by, n);
+
+		switch (ctx->dstate.prim) {
+			case OL_LINESTRIP:
+				for (i = 0; i < n; i++)
+					line_to(ctx, bx[i], by[i], bz[i], bc[i]);
+				break;
+			case OL_BEZIERSTRIP:
+				for (i = 0; i < n; i++)
+					bezier_to(ctx, bx[i], by[i], bc[i]);
+				break;
+			case OL_POINTS:
+				for (i = 0; i < n; i++)
+					point_to(ctx, bx[i], by[i], bz[i], bc[i]);
 				break;
-			if (clinv) {
-				Point *pt = closest->points;
-				int cnt = closest->pointcnt;
-				for (int i=0; i<cnt/2; i++) {
-					Point tmp = pt[i];
-					pt[i] = pt[cnt-i-1];
-					pt[cnt-i-1] = tmp;
-				}
-			}
-			//olLog("%d (%d) (nearest to %f,%f)\n", closest - wframe->objects, closest->pointcnt, closest_to.x, closest_to.y);
-			if (render_object(output, closest))
-				closest_to = last_render_point[output];
-			//olLog("[%d] ", frames[cwbuf].pnext);
-			//olLog("[LRP:%f %f]\n", last_render_point.x, last_render_point.y);
-			closest->pointcnt = 0;
-			cnt--;
-			last_info.objects++;
 		}
-		//olLog("\n");
+	}
+}
+
+void olCtxDrawArrays(OLContext *ctx, int prim, int first, int count)
+{
+	int i;
+
+	if (!ctx->va_pointer || count <= 0)
+		return;
+
+	olCtxBegin(ctx, prim);
+	if (ctx->recording || ctx->vpreshader || ctx->vshader ||
+		(ctx->va_size == 3 && ctx->v3shader)) {
+		for (i = first; i < first + count; i++) {
+			const float *v = (const float *)((const char *)ctx->va_pointer + (size_t)i * ctx->va_stride);
+			uint32_t color = C_WHITE;
+			if (ctx->ca_pointer)
+				color = *(const uint32_t *)((const char *)ctx->ca_pointer + (size_t)i * ctx->ca_stride);
+			if (ctx->va_size == 3)
+				olCtxVertex3(ctx, v[0], v[1], v[2], color);
+			else
+				olCtxVertex(ctx, v[0], v[1], color);
+		}
 	} else {
-		for (int i=0; i<wframe->objcnt; i++) {
-			if (wframe->objects[i].pointcnt < params.min_length)
-				continue;
-			render_object(output, &wframe->objects[i]);
+		draw_arrays_batched(ctx, first, count);
+	}
+	olCtxEnd(ctx);
+}
+
+void olCtxRect(OLContext *ctx, float x1, float y1, float x2, float y2, uint32_t color)
+{
+	olCtxBegin(ctx, OL_LINESTRIP);
+	olCtxVertex(ctx, x1,y1,color);
+	olCtxVertex(ctx, x1,y2,color);
+	olCtxVertex(ctx, x2,y2,color);
+	olCtxVertex(ctx, x2,y1,color);
+	olCtxVertex(ctx, x1,y1,color);
+	olCtxEnd(ctx);
+}
+
+void olCtxLine(OLContext *ctx, float x1, float y1, float x2, float y2, uint32_t color)
+{
+	olCtxBegin(ctx, OL_LINESTRIP);
+	olCtxVertex(ctx, x1,y1,color);
+	olCtxVertex(ctx, x2,y2,color);
+	olCtxEnd(ctx);
+}
+
+
+void olCtxDot(OLContext *ctx, float x, float y, int samples, uint32_t color)
+{
+	int i;
+	olCtxBegin(ctx, OL_POINTS);
+	for (i = 0; i < samples; i++)
+		olCtxVertex(ctx, x,y,color);
+	olCtxEnd(ctx);
+}
+
+/*
+Display lists record olBegin()/olVertex()/olEnd() calls for replay with
+olCallList(), under whatever matrices, color and shaders are current then.
+When the 2D matrix is affine, no vertex shaders are set and the 3D matrix is
+the identity (or the list has no 3D vertices), the tessellated objects are
+kept in list coordinates and replays only transform them. They
+are tessellated again when the render parameters change or the matrix scale
+moves by more than LIST_SCALE_TOLERANCE, since point density depends on it.
+Rotations and translations reuse the cached points.
+*/
+
+#define LIST_SCALE_TOLERANCE 0.02f
+
+OLDisplayList *olNewList(void)
+{
+	return calloc(1, sizeof(OLDisplayList));
+}
+
+void olDeleteList(OLDisplayList *list)
+{
+	if (!list)
+		return;
+	free(list->objects);
+	free(list->vertices);
+	free(list->points);
+	free(list);
+}
+
+void olCtxBeginList(OLContext *ctx, OLDisplayList *list)
+{
+	if (ctx->dstate.curobj)
+		return;
+	list->objcnt = 0;
+	list->vcnt = 0;
+	list->pcnt = 0;
+	list->has3d = 0;
+	list->open = 0;
+	list->cached = 0;
+	ctx->recording = list;
+}
+
+void olCtxEndList(OLContext *ctx)
+{
+	if (ctx->recording)
+		ctx->recording->open = 0;
+	ctx->recording = NULL;
+}
+
+static void list_draw(OLContext *ctx, OLDisplayList *list, ListObject *lo)
+{
+	olCtxBegin(ctx, lo->prim);
+	for (int i = 0; i < lo->vcount; i++) {
+		ListVertex *v = &list->vertices[lo->vfirst + i];
+		if (v->is3d)
+			olCtxVertex3(ctx, v->x, v->y, v->z, v->color);
+		else
+			olCtxVertex2Z(ctx, v->x, v->y, v->z, v->color);
+	}
+}
+
+// Draws a 2D object the usual way, with the color multiplier deferred, and
+// stores its tessellation in list coordinates using inverse matrix inv
+static int list_tessellate(OLContext *ctx, OLDisplayList *list, ListObject *lo, float inv[2][3], uint32_t curcol)
+{
+	Object *obj;
+
+	lo->pfirst = list->pcnt;
+	lo->pcount = 0;
+
+	// the cache is replayed under other transforms, so it must be complete
+	ctx->curcol = C_WHITE;
+	ctx->nocull = 1;
+	list_draw(ctx, list, lo);
+	ctx->nocull = 0;
+	ctx->curcol = curcol;
+	if (!close_object(ctx))
+		return !ctx->dstate.overflow;
+
+	obj = ctx->dstate.curobj;
+	if (list->pcnt + obj->pointcnt > list->pmax) {
+		while (list->pcnt + obj->pointcnt > list->pmax)
+			list->pmax = list->pmax ? list->pmax * 2 : 1024;
+		list->points = realloc(list->points, list->pmax * sizeof(Point));
+	}
+	ol_xf.affine4(inv, &obj->points[0].x, &list->points[list->pcnt].x, obj->pointcnt);
+	if (curcol != C_WHITE)
+		for (int i = 0; i < obj->pointcnt; i++)
+			obj->points[i].color = colmul(obj->points[i].color, curcol);
+	lo->pcount = obj->pointcnt;
+	list->pcnt += obj->pointcnt;
+	finish_object(ctx);
+	return 1;
+}
+
+// Emits a cached object through the current (affine) matrix and color
+static void list_replay(OLContext *ctx, OLDisplayList *list, ListObject *lo)
+{
+	float (*m)[3] = ctx->mtx2d;
+	float affine[2][3] = {
+		{m[0][0] / m[2][2], m[0][1] / m[2][2], m[0][2] / m[2][2]},
+		{m[1][0] / m[2][2], m[1][1] / m[2][2], m[1][2] / m[2][2]},
+	};
+	uint32_t curcol = ctx->curcol;
+	Point *pts;
+
+	if (!lo->pcount)
+		return;
+	olCtxBegin(ctx, lo->prim);
+	if (!(pts = ps_alloc(ctx, lo->pcount))) {
+		ctx->wframe->dropped++;
+		drop_object(ctx);
+		return;
+	}
+	ol_xf.affine4(affine, &list->points[lo->pfirst].x, &pts[0].x, lo->pcount);
+	if (curcol != C_WHITE)
+		for (int i = 0; i < lo->pcount; i++)
+			pts[i].color = colmul(pts[i].color, curcol);
+	ctx->dstate.curobj->pointcnt = lo->pcount;
+	finish_object(ctx);
+}
+
+void olCtxCallList(OLContext *ctx, OLDisplayList *list)
+{
+	static const float identity3[4][4] = {
+		{1,0,0,0},
+		{0,1,0,0},
+		{0,0,1,0},
+		{0,0,0,1},
+	};
+	float (*m)[3] = ctx->mtx2d;
+	float inv[2][3] = {{0}};
+	float scale[2] = {0, 0};
+	int cacheable, ok = 1;
+
+	if (ctx->recording || ctx->dstate.curobj)
+		return;
+
+	// points can only be cached through an invertible affine transform
+	float det = m[0][0] * m[1][1] - m[0][1] * m[1][0];
+	cacheable = m[2][0] == 0 && m[2][1] == 0 && m[2][2] != 0 && det != 0 &&
+		!ctx->vpreshader && !ctx->vshader;
+	// 3D vertices through an identity transform are plain 2D ones, as long
+	// as w = 1 is in front of the near plane
+	if (list->has3d && (ctx->v3shader || ctx->params.z_near > 1 ||
+		memcmp(ctx->mtx3d, identity3, sizeof(identity3))))
+		cacheable = 0;
+
+	if (cacheable) {
+		scale[0] = hypotf(m[0][0], m[1][0]) / fabsf(m[2][2]);
+		scale[1] = hypotf(m[0][1], m[1][1]) / fabsf(m[2][2]);
+		if (list->cached &&
+			fabsf(scale[0] - list->scale[0]) <= LIST_SCALE_TOLERANCE * list->scale[0] &&
+			fabsf(scale[1] - list->scale[1]) <= LIST_SCALE_TOLERANCE * list->scale[1] &&
+			!memcmp(&list->params, &ctx->params, sizeof(OLRenderParams))) {
+			for (int i = 0; i < list->objcnt; i++)
+				list_replay(ctx, list, &list->objects[i]);
+			return;
 		}
+		inv[0][0] = m[1][1] / det;
+		inv[0][1] = -m[0][1] / det;
+		inv[1][0] = -m[1][0] / det;
+		inv[1][1] = m[0][0] / det;
+		inv[0][2] = -(inv[0][0] * m[0][2] + inv[0][1] * m[1][2]);
+		inv[1][2] = -(inv[1][0] * m[0][2] + inv[1][1] * m[1][2]);
+		for (int i = 0; i < 2; i++)
+			for (int j = 0; j < 2; j++)
+				inv[i][j] *= m[2][2];
+		list->pcnt = 0;
 	}
-	wframe->psnext = 0;
-	wframe->objcnt = 0;
-	count = frames[cwbuf].pnext;
-	last_info.points = count;
 
-	if (params.max_framelen && count > params.max_framelen)
-	{
-		int in_count = count;
-		int out_count = params.max_framelen;
-		chkpts(count);
+	for (int i = 0; i < list->objcnt; i++) {
+		ListObject *lo = &list->objects[i];
+		if (!cacheable) {
+			list_draw(ctx, list, lo);
+			olCtxEnd(ctx);
+		} else {
+			ok &= list_tessellate(ctx, list, lo, inv, ctx->curcol);
+		}
+	}
 
-		Point *pin = frames[cwbuf].points[output];
-		Point *pout = &pin[in_count];
+	list->cached = cacheable && ok;
+	if (list->cached) {
+		list->scale[0] = scale[0];
+		list->scale[1] = scale[1];
+		list->params = ctx->params;
+	}
+}
 
-		float pos = 0;
-		float delta = count / (float)out_count;
+void olCtxResetColor(OLContext *ctx)
+{
+	ctx->curcol = C_WHITE;
+}
 
-		count = 0;
-		while (pos < (in_count - 1)) {
-			int ipos = pos;
-			float rest = pos - ipos;
+void olCtxMultColor(OLContext *ctx, uint32_t color)
+{
+	ctx->curcol = colmul(ctx->curcol, color);
+}
 
-			pout->x = pin[ipos].x * (1-rest) + pin[ipos+1].x * rest;
-			pout->y = pin[ipos].y * (1-rest) + pin[ipos+1].y * rest;
+void olCtxPushColor(OLContext *ctx)
+{
+	ctx->cols[ctx->coldp] = ctx->curcol;
+	ctx->coldp++;
+}
 
-			if (pin[ipos].color == C_BLACK || pin[ipos+1].color == C_BLACK) {
-				pout->color = C_BLACK;
-				pos += 1;
-				last_info.resampled_blacks++;
-			} else {
-				pout->color = pin[ipos].color;
-				pos += delta;
-			}
+void olCtxPopColor(OLContext *ctx)
+{
+	ctx->coldp--;
+	ctx->curcol = ctx->cols[ctx->coldp];
+}
 
-			pout++;
-			count++;
-		}
 
-		memcpy(pin, &pin[in_count], count * sizeof(*pin));
-		frames[cwbuf].pnext = count;
-		chkpts(0);
-		last_info.resampled_points = count;
-	}
-	if (count) {
-		last_render_point[output].x = frames[cwbuf].points[output][count-1].x;
-		last_render_point[output].y = frames[cwbuf].points[output][count-1].y;
-	}
-	while(count < min_points) {
-		frames[cwbuf].points[output][count].x = last_render_point[output].x;
-		frames[cwbuf].points[output][count].y = last_render_point[output].y;
-		frames[cwbuf].points[output][count].color = C_BLACK;
-		count++;
-		last_info.padding_points++;
-	}
-	frames[cwbuf].pnext = count;
+void olCtxSetVertexPreShader(OLContext *ctx, ShaderFunc f)
+{
+	ctx->vpreshader = f;
+}
+void olCtxSetVertexShader(OLContext *ctx, ShaderFunc f)
+{
+	ctx->vshader = f;
+}
+void olCtxSetVertex3Shader(OLContext *ctx, Shader3Func f)
+{
+	ctx->v3shader = f;
+}
 
-	return count;
+void olCtxSetPixelShader(OLContext *ctx, ShaderFunc f)
+{
+	ctx->pshader = f;
+}
+void olCtxSetPixel3Shader(OLContext *ctx, Shader3Func f)
+{
+	ctx->p3shader = f;
 }
 
-void olSetOutput(int output)
+void olCtxSetAudioCallback(OLContext *ctx, AudioCallbackFunc f)
 {
-	wframe = &wframes[output];
+	ctx->audiocb = f;
 }
 
-float olRenderFrame(int max_fps)
+void olCtxSetFrameCallback(OLContext *ctx, FrameCallbackFunc f)
 {
-	int counts[OL_MAX_OUTPUTS];
-	int count = 0;
+	ctx->framecb = f;
+}
 
-	memset(&last_info, 0, sizeof(last_info));
+void olCtxFrustum(OLContext *ctx, float l, float r, float b, float t, float n, float f)
+{
+	float m[16] = {
+		(2*n)/(r-l),  0,            0,               0,
+		0,            (2*n)/(t-b),  0,               0,
+		(r+l)/(r-l),  (t+b)/(t-b),  -(f+n)/(f-n),   -1,
+		0,            0,            (-2*f*n)/(f-n),  0,
+	};
 
-	while (((cwbuf+1)%fbufs) == crbuf) {
-		//olLog("Waiting %d %d\n", cwbuf, crbuf);
-		usleep(1000);
-		first_time_full = 1;
-	}
+	olCtxMultMatrix3(ctx, m);
+}
 
-	for (int i = 0; i < g_config.num_outputs; i++) {
-		wframe = &wframes[i];
-		counts[i] = render_output(i, max_fps);
-		if (counts[i] > count)
-			count = counts[i];
-	}
-	wframe = &wframes[0];
+void olCtxPerspective(OLContext *ctx, float fovy, float aspect, float zNear, float zFar)
+{
+	float xmin, xmax, ymin, ymax;
 
-	for (int i = 0; i < g_config.num_outputs; i++) {
-		Point p = {0, 0, 0, 0};
-		if (counts[i] > 0)
-			p = frames[cwbuf].points[i][counts[i] - 1];
-		for (int j = counts[i]; j < count; j++) {
-			frames[cwbuf].points[i][j] = p;
-		}
-	}
+	ymax = zNear * tanf(fovy * M_PI / 360.0);
+	ymin = -ymax;
 
-	if (audiocb) {
-		audiocb(frames[cwbuf].audio_l, frames[cwbuf].audio_r, count);
-	} else {
-		memset(frames[cwbuf].audio_l, 0, sizeof(float)*count);
-		memset(frames[cwbuf].audio_r, 0, sizeof(float)*count);
-	}
+	xmin = ymin * aspect;
+	xmax = ymax * aspect;
 
-	//olLog("Rendered frame! %d\n", cwbuf);
-	cwbuf = (cwbuf + 1) % fbufs;
+	olCtxFrustum(ctx,  xmin, xmax, ymin, ymax, zNear, zFar );
+}
 
-	return count / (float)params.rate;
+void olCtxSetScissor(OLContext *ctx, float x0, float y0, float x1, float y1)
+{
+	ctx->bbox[0][0] = x0;
+	ctx->bbox[0][1] = y0;
+	ctx->bbox[1][0] = x1;
+	ctx->bbox[1][1] = y1;
 }
 
-void olLoadIdentity(void)
+void olCtxGetFrameInfo(OLContext *ctx, OLFrameInfo *info)
 {
-	static const float identity[3][3] = {
-		{1,0,0},
-		{0,1,0},
-		{0,0,1}
-	};
-	memcpy(&mtx2d[0][0], &identity[0][0], sizeof(mtx2d));
+	*info = ctx->last_info;
 }
 
-void olRotate(float theta)
+void olCtxGetOutputStats(OLContext *ctx, OLOutputStats *stats)
 {
-	float rot[9] = {
-		cosf(theta),-sinf(theta),0,
-		sinf(theta),cosf(theta),0,
-		0,0,1,
-	};
-	olMultMatrix(rot);
+	stats->callbacks = atomic_load_explicit(&ctx->rt_callbacks, memory_order_relaxed);
+	stats->dummy_callbacks = atomic_load_explicit(&ctx->rt_dummies, memory_order_relaxed);
+	stats->repeated_frames = atomic_load_explicit(&ctx->rt_repeats, memory_order_relaxed);
+	stats->samples = atomic_load_explicit(&ctx->rt_samples, memory_order_relaxed);
+	stats->callback_time = atomic_load_explicit(&ctx->rt_total_ns, memory_order_relaxed) / 1e9;
+	stats->max_callback_time = atomic_load_explicit(&ctx->rt_peak_ns, memory_order_relaxed) / 1e9;
 }
 
-void olTranslate(float x, float y)
+/*
+Default context API, kept for single rig, single thread applications.
+*/
+
+void olSetRenderParams(OLRenderParams *params)
 {
-	float trans[9] = {
-		1,0,0,
-		0,1,0,
-		x,y,1,
-	};
-	olMultMatrix(trans);
+	olCtxSetRenderParams(default_ctx, params);
 }
 
+void olGetRenderParams(OLRenderParams *params)
+{
+	olCtxGetRenderParams(default_ctx, params);
+}
 
-void olScale(float sx, float sy)
+void olSetOutput(int output)
 {
-	float scale[9] = {
-		sx,0,0,
-		0,sy,0,
-		0,0,1,
-	};
-	olMultMatrix(scale);
+	olCtxSetOutput(default_ctx, output);
 }
 
-void olMultMatrix(float m[9])
+void olSetAudioCallback(AudioCallbackFunc f)
 {
-	float new[3][3];
+	olCtxSetAudioCallback(default_ctx, f);
+}
 
-	new[0][0] = mtx2d[0][0]*m[0] + mtx2d[0][1]*m[1] + mtx2d[0][2]*m[2];
-	new[0][1] = mtx2d[0][0]*m[3] + mtx2d[0][1]*m[4] + mtx2d[0][2]*m[5];
-	new[0][2] = mtx2d[0][0]*m[6] + mtx2d[0][1]*m[7] + mtx2d[0][2]*m[8];
-	new[1][0] = mtx2d[1][0]*m[0] + mtx2d[1][1]*m[1] + mtx2d[1][2]*m[2];
-	new[1][1] = mtx2d[1][0]*m[3] + mtx2d[1][1]*m[4] + mtx2d[1][2]*m[5];
-	new[1][2] = mtx2d[1][0]*m[6] + mtx2d[1][1]*m[7] + mtx2d[1][2]*m[8];
-	new[2][0] = mtx2d[2][0]*m[0] + mtx2d[2][1]*m[1] + mtx2d[2][2]*m[2];
-	new[2][1] = mtx2d[2][0]*m[3] + mtx2d[2][1]*m[4] + mtx2d[2][2]*m[5];
-	new[2][2] = mtx2d[2][0]*m[6] + mtx2d[2][1]*m[7] + mtx2d[2][2]*m[8];
+void olSetFrameCallback(FrameCallbackFunc f)
+{
+	olCtxSetFrameCallback(default_ctx, f);
+}
 
-	memcpy(&mtx2d[0][0], &new[0][0], sizeof(mtx2d));
+void olLoadIdentity(void)
+{
+	olCtxLoadIdentity(default_ctx);
 }
 
 void olPushMatrix(void)
 {
-	memcpy(&mtx2ds[mtx2dp][0][0], &mtx2d[0][0], sizeof(mtx2d));
-	mtx2dp++;
+	olCtxPushMatrix(default_ctx);
 }
 
 void olPopMatrix(void)
 {
-	mtx2dp--;
-	memcpy(&mtx2d[0][0], &mtx2ds[mtx2dp][0][0], sizeof(mtx2d));
+	olCtxPopMatrix(default_ctx);
 }
 
-void olLoadIdentity3(void)
+void olMultMatrix(float m[9])
 {
-	static const float identity[4][4] = {
-		{1,0,0,0},
-		{0,1,0,0},
-		{0,0,1,0},
-		{0,0,0,1},
-	};
-	memcpy(&mtx3d[0][0], &identity[0][0], sizeof(mtx3d));
+	olCtxMultMatrix(default_ctx, m);
 }
 
-void olRotate3X(float theta)
+void olRotate(float theta)
 {
-	float rot[16] = {
-		1,0,0,0,
-		0,cosf(theta),sinf(theta),0,
-		0,-sinf(theta),cosf(theta),0,
-		0,0,0,1
-	};
-	olMultMatrix3(rot);
+	olCtxRotate(default_ctx, theta);
 }
 
-void olRotate3Y(float theta)
+void olTranslate(float x, float y)
 {
-	float rot[16] = {
-		cosf(theta),0,-sinf(theta),0,
-		0,1,0,0,
-		sinf(theta),0,cosf(theta),0,
-		0,0,0,1
-	};
-	olMultMatrix3(rot);
+	olCtxTranslate(default_ctx, x, y);
 }
 
-void olRotate3Z(float theta)
+void olScale(float sx, float sy)
 {
-	float rot[16] = {
-		cosf(theta), sinf(theta), 0, 0,
-		-sinf(theta), cosf(theta), 0, 0,
-		0, 0, 1, 0,
-		0, 0, 0, 1
-	};
-	olMultMatrix3(rot);
+	olCtxScale(default_ctx, sx, sy);
 }
 
-void olTranslate3(float x, float y, float z)
+void olLoadIdentity3(void)
 {
-	float trans[16] = {
-		1,0,0,0,
-		0,1,0,0,
-		0,0,1,0,
-		x,y,z,1,
-	};
-	olMultMatrix3(trans);
+	olCtxLoadIdentity3(default_ctx);
 }
 
+void olPushMatrix3(void)
+{
+	olCtxPushMatrix3(default_ctx);
+}
 
-void olScale3(float sx, float sy, float sz)
+void olPopMatrix3(void)
 {
-	float trans[16] = {
-		sx,0,0,0,
-		0,sy,0,0,
-		0,0,sz,0,
-		0,0,0,1,
-	};
-	olMultMatrix3(trans);
+	olCtxPopMatrix3(default_ctx);
 }
 
 void olMultMatrix3(float m[16])
 {
-	float new[4][4];
+	olCtxMultMatrix3(default_ctx, m);
+}
 
-	new[0][0] = mtx3d[0][0]*m[ 0] + mtx3d[0][1]*m[ 1] + mtx3d[0][2]*m[ 2] + mtx3d[0][3]*m[ 3];
-	new[0][1] = mtx3d[0][0]*m[ 4] + mtx3d[0][1]*m[ 5] + mtx3d[0][2]*m[ 6] + mtx3d[0][3]*m[ 7];
-	new[0][2] = mtx3d[0][0]*m[ 8] + mtx3d[0][1]*m[ 9] + mtx3d[0][2]*m[10] + mtx3d[0][3]*m[11];
-	new[0][3] = mtx3d[0][0]*m[12] + mtx3d[0][1]*m[13] + mtx3d[0][2]*m[14] + mtx3d[0][3]*m[15];
-	new[1][0] = mtx3d[1][0]*m[ 0] + mtx3d[1][1]*m[ 1] + mtx3d[1][2]*m[ 2] + mtx3d[1][3]*m[ 3];
-	new[1][1] = mtx3d[1][0]*m[ 4] + mtx3d[1][1]*m[ 5] + mtx3d[1][2]*m[ 6] + mtx3d[1][3]*m[ 7];
-	new[1][2] = mtx3d[1][0]*m[ 8] + mtx3d[1][1]*m[ 9] + mtx3d[1][2]*m[10] + mtx3d[1][3]*m[11];
-	new[1][3] = mtx3d[1][0]*m[12] + mtx3d[1][1]*m[13] + mtx3d[1][2]*m[14] + mtx3d[1][3]*m[15];
-	new[2][0] = mtx3d[2][0]*m[ 0] + mtx3d[2][1]*m[ 1] + mtx3d[2][2]*m[ 2] + mtx3d[2][3]*m[ 3];
-	new[2][1] = mtx3d[2][0]*m[ 4] + mtx3d[2][1]*m[ 5] + mtx3d[2][2]*m[ 6] + mtx3d[2][3]*m[ 7];
-	new[2][2] = mtx3d[2][0]*m[ 8] + mtx3d[2][1]*m[ 9] + mtx3d[2][2]*m[10] + mtx3d[2][3]*m[11];
-	new[2][3] = mtx3d[2][0]*m[12] + mtx3d[2][1]*m[13] + mtx3d[2][2]*m[14] + mtx3d[2][3]*m[15];
-	new[3][0] = mtx3d[3][0]*m[ 0] + mtx3d[3][1]*m[ 1] + mtx3d[3][2]*m[ 2] + mtx3d[3][3]*m[ 3];
-	new[3][1] = mtx3d[3][0]*m[ 4] + mtx3d[3][1]*m[ 5] + mtx3d[3][2]*m[ 6] + mtx3d[3][3]*m[ 7];
-	new[3][2] = mtx3d[3][0]*m[ 8] + mtx3d[3][1]*m[ 9] + mtx3d[3][2]*m[10] + mtx3d[3][3]*m[11];
-	new[3][3] = mtx3d[3][0]*m[12] + mtx3d[3][1]*m[13] + mtx3d[3][2]*m[14] + mtx3d[3][3]*m[15];
-
-	memcpy(&mtx3d[0][0], &new[0][0], sizeof(mtx3d));
+void olRotate3X(float theta)
+{
+	olCtxRotate3X(default_ctx, theta);
 }
 
-void olPushMatrix3(void)
+void olRotate3Y(float theta)
 {
-	memcpy(&mtx3ds[mtx3dp][0][0], &mtx3d[0][0], sizeof(mtx3d));
-	mtx3dp++;
+	olCtxRotate3Y(default_ctx, theta);
 }
 
-void olPopMatrix3(void)
+void olRotate3Z(float theta)
 {
-	mtx3dp--;
-	memcpy(&mtx3d[0][0], &mtx3ds[mtx3dp][0][0], sizeof(mtx3d));
+	olCtxRotate3Z(default_ctx, theta);
 }
 
-void olTransformVertex4(float *x, float *y, float *z, float *w)
+void olTranslate3(float x, float y, float z)
 {
-	float px;
-	float py;
-	float pz;
-	float pw;
+	olCtxTranslate3(default_ctx, x, y, z);
+}
 
-	px = mtx3d[0][0]**x + mtx3d[0][1]**y + mtx3d[0][2]**z + mtx3d[0][3]**w;
-	py = mtx3d[1][0]**x + mtx3d[1][1]**y + mtx3d[1][2]**z + mtx3d[1][3]**w;
-	pz = mtx3d[2][0]**x + mtx3d[2][1]**y + mtx3d[2][2]**z + mtx3d[2][3]**w;
-	pw = mtx3d[3][0]**x + mtx3d[3][1]**y + mtx3d[3][2]**z + mtx3d[3][3]**w;
+void olScale3(float sx, float sy, float sz)
+{
+	olCtxScale3(default_ctx, sx, sy, sz);
+}
 
-	*x = px;
-	*y = py;
-	*z = pz;
-	*w = pw;
+void olFrustum(float left, float right, float bot, float ttop, float near, float far)
+{
+	olCtxFrustum(default_ctx, left, right, bot, ttop, near, far);
 }
 
-void olTransformVertex3(float *x, float *y, float *z)
+void olPerspective(float fovy, float aspect, float zNear, float zFar)
 {
-	float w = 1.0;
+	olCtxPerspective(default_ctx, fovy, aspect, zNear, zFar);
+}
 
-	olTransformVertex4(x, y, z, &w);
+void olResetColor(void)
+{
+	olCtxResetColor(default_ctx);
+}
 
-	*x /= w;
-	*y /= w;
-	*z /= w;
+void olMultColor(uint32_t color)
+{
+	olCtxMultColor(default_ctx, color);
 }
 
-void olVertex3(float x, float y, float z, uint32_t color)
+void olPushColor(void)
 {
-	if(v3shader)
-		v3shader(&x, &y, &z, &color);
-	olTransformVertex3(&x, &y, &z);
-	if (z == 0)
-		z = SMALL_Z; // Hack for code not clipping z
-	olVertex2Z(x, y, 1.0 / z, color);
+	olCtxPushColor(default_ctx);
 }
 
-void olRect(float x1, float y1, float x2, float y2, uint32_t color)
+void olPopColor(void)
 {
-	olBegin(OL_LINESTRIP);
-	olVertex(x1,y1,color);
-	olVertex(x1,y2,color);
-	olVertex(x2,y2,color);
-	olVertex(x2,y1,color);
-	olVertex(x1,y1,color);
-	olEnd();
+	olCtxPopColor(default_ctx);
 }
 
-void olLine(float x1, float y1, float x2, float y2, uint32_t color)
+void olBegin(int prim)
 {
-	olBegin(OL_LINESTRIP);
-	olVertex(x1,y1,color);
-	olVertex(x2,y2,color);
-	olEnd();
+	olCtxBegin(default_ctx, prim);
 }
 
+void olVertex(float x, float y, uint32_t color)
+{
+	olCtxVertex(default_ctx, x, y, color);
+}
 
-void olDot(float x, float y, int samples, uint32_t color)
+void olVertex3(float x, float y, float z, uint32_t color)
 {
-	int i;
-	olBegin(OL_POINTS);
-	for (i = 0; i < samples; i++)
-		olVertex(x,y,color);
-	olEnd();
+	olCtxVertex3(default_ctx, x, y, z, color);
 }
 
-void olResetColor(void)
+void olVertex2Z(float x, float y, float z, uint32_t color)
 {
-	curcol = C_WHITE;
+	olCtxVertex2Z(default_ctx, x, y, z, color);
 }
 
-void olMultColor(uint32_t color)
+void olEnd(void)
 {
-	curcol = colmul(curcol, color);
+	olCtxEnd(default_ctx);
 }
 
-void olPushColor(void)
+void olTransformVertex(float *x, float *y)
 {
-	cols[coldp] = curcol;
-	coldp++;
+	olCtxTransformVertex(default_ctx, x, y);
 }
 
-void olPopColor(void)
+void olTransformVertex3(float *x, float *y, float *z)
 {
-	coldp--;
-	curcol = cols[coldp];
+	olCtxTransformVertex3(default_ctx, x, y, z);
 }
 
+void olTransformVertex4(float *x, float *y, float *z, float *w)
+{
+	olCtxTransformVertex4(default_ctx, x, y, z, w);
+}
 
 void olSetVertexPreShader(ShaderFunc f)
 {
-	vpreshader = f;
+	olCtxSetVertexPreShader(default_ctx, f);
 }
+
 void olSetVertexShader(ShaderFunc f)
 {
-	vshader = f;
+	olCtxSetVertexShader(default_ctx, f);
 }
+
 void olSetVertex3Shader(Shader3Func f)
 {
-	v3shader = f;
+	olCtxSetVertex3Shader(default_ctx, f);
 }
 
 void olSetPixelShader(ShaderFunc f)
 {
-	pshader = f;
+	olCtxSetPixelShader(default_ctx, f);
 }
+
 void olSetPixel3Shader(Shader3Func f)
 {
-	p3shader = f;
+	olCtxSetPixel3Shader(default_ctx, f);
 }
 
-void olSetAudioCallback(AudioCallbackFunc f)
+void olTransformVertices(float *x, float *y, int count)
 {
-	audiocb = f;
+	olCtxTransformVertices(default_ctx, x, y, count);
 }
 
-void olFrustum (float l, float r, float b, float t, float n, float f)
+void olTransformVertices3(float *x, float *y, float *z, int count)
 {
-	float m[16] = {
-		(2*n)/(r-l),  0,            0,               0,
-		0,            (2*n)/(t-b),  0,               0,
-		(r+l)/(r-l),  (t+b)/(t-b),  -(f+n)/(f-n),   -1,
-		0,            0,            (-2*f*n)/(f-n),  0,
-	};
+	olCtxTransformVertices3(default_ctx, x, y, z, count);
+}
 
-	olMultMatrix3(m);
+void olVertexArray(int size, int stride, const float *pointer)
+{
+	olCtxVertexArray(default_ctx, size, stride, pointer);
 }
 
-void olPerspective (float fovy, float aspect, float zNear, float zFar)
+void olColorArray(int stride, const uint32_t *pointer)
 {
-	float xmin, xmax, ymin, ymax;
+	olCtxColorArray(default_ctx, stride, pointer);
+}
 
-	ymax = zNear * tanf(fovy * M_PI / 360.0);
-	ymin = -ymax;
+void olGetVertexArray(int *size, int *stride, const float **pointer)
+{
+	olCtxGetVertexArray(default_ctx, size, stride, pointer);
+}
 
-	xmin = ymin * aspect;
-	xmax = ymax * aspect;
+void olGetColorArray(int *stride, const uint32_t **pointer)
+{
+	olCtxGetColorArray(default_ctx, stride, pointer);
+}
 
-	olFrustum( xmin, xmax, ymin, ymax, zNear, zFar );
+void olDrawArrays(int prim, int first, int count)
+{
+	olCtxDrawArrays(default_ctx, prim, first, count);
+}
+
+void olRect(float x1, float y1, float x2, float y2, uint32_t color)
+{
+	olCtxRect(default_ctx, x1, y1, x2, y2, color);
+}
+
+void olLine(float x1, float y1, float x2, float y2, uint32_t color)
+{
+	olCtxLine(default_ctx, x1, y1, x2, y2, color);
+}
+
+void olDot(float x, float y, int points, uint32_t color)
+{
+	olCtxDot(default_ctx, x, y, points, color);
 }
 
-void olSetScissor (float x0, float y0, float x1, float y1)
+float olRenderFrame(int max_fps)
 {
-	bbox[0][0] = x0;
-	bbox[0][1] = y0;
-	bbox[1][0] = x1;
-	bbox[1][1] = y1;
+	return olCtxRenderFrame(default_ctx, max_fps);
 }
 
 void olGetFrameInfo(OLFrameInfo *info)
 {
-	*info = last_info;
+	olCtxGetFrameInfo(default_ctx, info);
+}
+
+void olGetOutputStats(OLOutputStats *stats)
+{
+	olCtxGetOutputStats(default_ctx, stats);
+}
+
+void olShutdown(void)
+{
+	olCtxShutdown(default_ctx);
+	default_ctx = NULL;
+}
+
+void olSetScissor(float x0, float y0, float x1, float y1)
+{
+	olCtxSetScissor(default_ctx, x0, y0, x1, y1);
+}
+
+void olBeginList(OLDisplayList *list)
+{
+	olCtxBeginList(default_ctx, list);
+}
+
+void olEndList(void)
+{
+	olCtxEndList(default_ctx);
+}
+
+void olCallList(OLDisplayList *list)
+{
+	olCtxCallList(default_ctx, list);
 }
 
 void olLog(const char *fmt, ...)
@@ -43,7 +43,7 @@ float olGetCharOverlap(Font *font, float height)
 	return font->overlap * ratio;
 }
 
-float olDrawChar(Font *font, float x, float y, float height, uint32_t color, int c)
+float olCtxDrawChar(OLContext *ctx, Font *font, float x, float y, float height, uint32_t color, int c)
 {
 	if (!font)
 		return 0;
@@ -55,17 +55,17 @@ float olDrawChar(Font *font, float x, float y, float height, uint32_t color, int
 
 	if (p) {
 
-		olBegin(OL_BEZIERSTRIP);
+		olCtxBegin(ctx, OL_BEZIERSTRIP);
 
 		do {
-			olVertex3(x + p->x * ratio, y - p->y * ratio, 0, color);
+			olCtxVertex3(ctx, x + p->x * ratio, y - p->y * ratio, 0, color);
 			if (p->flag == 1) {
-				olEnd();
-				olBegin(OL_BEZIERSTRIP);
+				olCtxEnd(ctx);
+				olCtxBegin(ctx, OL_BEZIERSTRIP);
 			}
 		} while ((p++)->flag != 2);
 
-		olEnd();
+		olCtxEnd(ctx);
 	}
 
 	if (chr->width) {
@@ -75,13 +75,13 @@ float olDrawChar(Font *font, float x, float y, float height, uint32_t color, int
 	}
 }
 
-float olDrawString(Font *font, float x, float y, float height, uint32_t color, const char *s)
+float olCtxDrawString(OLContext *ctx, Font *font, float x, float y, float height, uint32_t color, const char *s)
 {
 	float w = 0;
 	float ratio = height / font->height;
 
 	while(*s) {
-		w += olDrawChar(font, x+w, y, height, color, (uint8_t)*s) - font->overlap * ratio;
+		w += olCtxDrawChar(ctx, font, x+w, y, height, color, (uint8_t)*s) - font->overlap * ratio;
 		s++;
 	}
 
@@ -89,6 +89,16 @@ float olDrawString(Font *font, float x, float y, float height, uint32_t color, c
 }
 
 
+float olDrawChar(Font *font, float x, float y, float height, uint32_t color, int c)
+{
+	return olCtxDrawChar(olGetDefaultContext(), font, x, y, height, color, c);
+}
+
+float olDrawString(Font *font, float x, float y, float height, uint32_t color, const char *s)
+{
+	return olCtxDrawString(olGetDefaultContext(), font, x, y, height, color, s);
+}
+
 float olGetStringWidth(Font *font, float height, const char *s)
 {
 	float w = 0;
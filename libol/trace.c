@@ -22,25 +22,80 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <pthread.h>
 
 #include "trace.h"
 #include "align.h"
+#include "imgproc.h"
+
+// Edge detection runs on horizontal bands of the image, one per thread. Band
+// boundaries are multiples of 16 rows so that each band covers whole blocks
+// of the kernels' transposed layouts; rows needed from neighbouring bands
+// (the blur halo, and the rows around the band's edges that Canny looks at)
+// are only read after a barrier.
+//
+// In incremental mode the image is also split into 16x16 tiles, matching the
+// kernels' blocks. Each tile records what has to be redone for the frame.
+#define TILE_SIZE 16
+#define TILE_CHANGED	1 // input differs from the previous frame
+#define TILE_BLUR	2 // blurred image
+#define TILE_EDGES	4 // edge map
+#define TILE_TRACE	8 // contours
+
+typedef struct {
+	struct OLTraceCtx *ctx;
+	pthread_t thread;
+	icoord y0, y1;
+
+	OLTracePoint *sb;
+	OLTracePoint *sbp;
+	OLTracePoint *sb_end;
+	unsigned int sb_size;
+
+	// Canny works down the band in a window of three rows of gradients and
+	// magnitudes
+	void *rows;
+	int16_t *gx[3], *gy[3];
+	uint16_t *mag[3];
+} TraceBand;
 
 struct OLTraceCtx {
 	OLTraceParams p;
+	const ImgprocKernels *kern;
 	icoord aw, ah;
 	uint16_t *k;
 	unsigned int ksize, kpad;
 	uint8_t *bibuf, *btbuf, *sibuf;
-	int16_t *stbuf, *sxbuf, *sybuf;
-	uint32_t *smbuf;
 
 	uint16_t *tracebuf;
-
-	OLTracePoint *sb;
-	OLTracePoint *sbp;
-	OLTracePoint *sb_end;
-	unsigned int sb_size;
+	// 1 for an edge pixel, 2 for one that can start a contour
+	uint8_t *edges;
+
+	// incremental mode: the previous input, the tile flags, and the contours
+	// last returned, which are kept unless they cross a tile being retraced
+	uint8_t *prev;
+	int have_prev;
+	uint8_t *tiles;
+	icoord tw, th;
+	OLTracePoint *kept;
+	unsigned int kept_size;
+	unsigned int *kept_counts;
+	uint8_t *dropped;
+	unsigned int kept_objects, kept_objects_size;
+
+	unsigned int nbands;
+	TraceBand *bands;
+
+	// the frame being traced, and the worker threads running bands 1 and up
+	uint8_t *src;
+	icoord stride;
+	pthread_mutex_t lock;
+	pthread_cond_t start;
+	pthread_cond_t done;
+	pthread_barrier_t barrier;
+	unsigned int gen;
+	unsigned int busy;
+	int quit;
 
 	OLTracePoint *pb;
 	OLTracePoint *pbp;
@@ -56,19 +111,10 @@ static int pc = 0;
 static int tframe = 0;
 #endif
 
-void ol_conv_sse2(uint8_t *src, uint8_t *dst, size_t w, size_t h, uint16_t *kern, size_t ksize);
-void ol_sobel_sse2_gx_v(uint8_t *src, int16_t *dst, size_t w, size_t h);
-void ol_sobel_sse2_gx_h(int16_t *src, int16_t *dst, size_t w, size_t h);
-void ol_sobel_sse2_gy_v(uint8_t *src, int16_t *dst, size_t w, size_t h);
-void ol_sobel_sse2_gy_h(int16_t *src, int16_t *dst, size_t w, size_t h);
-void ol_transpose_2x8x8(uint8_t *p, size_t stride);
-void ol_transpose_8x8w(int16_t *p, size_t stride);
-
-typedef void (*sobel_v_fn)(uint8_t *src, int16_t *dst, size_t w, size_t h);
-typedef void (*sobel_h_fn)(int16_t *src, int16_t *dst, size_t w, size_t h);
-
 static void alloc_bufs(OLTraceCtx *ctx)
 {
+	unsigned int i, j, rows;
+
 	ctx->aw = (ctx->p.width+15) & ~15;
 	ctx->ah = (ctx->p.height+15) & ~15;
 
@@ -90,27 +136,58 @@ static void alloc_bufs(OLTraceCtx *ctx)
 		ctx->sibuf = malloc_align(ctx->aw * (ctx->ah + 2), 64);
 	}
 
-	if (ctx->p.mode == OL_TRACE_CANNY) {
-		if (!ctx->sibuf)
-			ctx->sibuf = malloc_align(ctx->aw * (ctx->ah + 2), 64);
-		ctx->stbuf = malloc_align(sizeof(*ctx->stbuf) * ctx->ah * (ctx->aw + 2), 64);
-		ctx->sxbuf = malloc_align(sizeof(*ctx->sxbuf) * ctx->aw * ctx->ah, 64);
-		ctx->sybuf = malloc_align(sizeof(*ctx->sybuf) * ctx->aw * ctx->ah, 64);
-		ctx->smbuf = malloc_align(sizeof(*ctx->smbuf) * ctx->aw * ctx->ah, 64);
-	} else {
-		ctx->stbuf = NULL;
-		ctx->sxbuf = NULL;
-		ctx->sybuf = NULL;
-		ctx->smbuf = NULL;
-	}
+	if (ctx->p.mode == OL_TRACE_CANNY && !ctx->sibuf)
+		ctx->sibuf = malloc_align(ctx->aw * (ctx->ah + 2), 64);
 
 	ctx->tracebuf = malloc(ctx->p.width * ctx->p.height * sizeof(*ctx->tracebuf));
 	memset(ctx->tracebuf, 0, ctx->p.width * ctx->p.height * sizeof(*ctx->tracebuf));	
+	ctx->edges = calloc(ctx->p.width * ctx->p.height, 1);
 
-	ctx->sb_size = ctx->p.width * 16;
-	ctx->sb = malloc(ctx->sb_size * sizeof(*ctx->sb));
-	ctx->sbp = ctx->sb;
-	ctx->sb_end = ctx->sb + ctx->sb_size;
+	if (ctx->p.incremental) {
+		ctx->tw = ctx->aw / TILE_SIZE;
+		ctx->th = ctx->ah / TILE_SIZE;
+		ctx->tiles = malloc(ctx->tw * ctx->th);
+		ctx->prev = malloc(ctx->p.width * ctx->p.height);
+	} else {
+		ctx->tiles = NULL;
+		ctx->prev = NULL;
+	}
+	ctx->have_prev = 0;
+	ctx->kept = NULL;
+	ctx->kept_size = 0;
+	ctx->kept_counts = NULL;
+	ctx->dropped = NULL;
+	ctx->kept_objects = 0;
+	ctx->kept_objects_size = 0;
+
+	ctx->nbands = ctx->p.threads ? ctx->p.threads : 1;
+	if (ctx->nbands > ctx->ah / 16)
+		ctx->nbands = ctx->ah / 16;
+	rows = (ctx->ah / 16 + ctx->nbands - 1) / ctx->nbands * 16;
+	// rounding up the band height can leave the last ones empty
+	ctx->nbands = (ctx->ah + rows - 1) / rows;
+	ctx->bands = calloc(ctx->nbands, sizeof(*ctx->bands));
+	for (i = 0; i < ctx->nbands; i++) {
+		TraceBand *b = &ctx->bands[i];
+		b->ctx = ctx;
+		b->y0 = i * rows;
+		b->y1 = b->y0 + rows;
+		if (b->y1 > ctx->ah)
+			b->y1 = ctx->ah;
+		b->sb_size = ctx->p.width * 16 / ctx->nbands;
+		b->sb = malloc(b->sb_size * sizeof(*b->sb));
+		b->sbp = b->sb;
+		b->sb_end = b->sb + b->sb_size;
+		if (ctx->p.mode == OL_TRACE_CANNY) {
+			int16_t *r = b->rows = malloc_align(ctx->aw * 18, 64);
+			for (j = 0; j < 3; j++) {
+				b->gx[j] = r;
+				b->gy[j] = r + ctx->aw;
+				b->mag[j] = (uint16_t *)(r + 2 * ctx->aw);
+				r += 3 * ctx->aw;
+			}
+		}
+	}
 
 	ctx->pb_size = ctx->p.width * 16;
 	ctx->pb = malloc(ctx->pb_size * sizeof(*ctx->pb));
@@ -120,10 +197,28 @@ static void alloc_bufs(OLTraceCtx *ctx)
 
 static void free_bufs(OLTraceCtx *ctx)
 {
+	unsigned int i;
+
 	if (ctx->tracebuf)
 		free(ctx->tracebuf);
-	if (ctx->sb)
-		free(ctx->sb);
+	if (ctx->edges)
+		free(ctx->edges);
+	if (ctx->tiles)
+		free(ctx->tiles);
+	if (ctx->prev)
+		free(ctx->prev);
+	if (ctx->kept)
+		free(ctx->kept);
+	if (ctx->kept_counts)
+		free(ctx->kept_counts);
+	if (ctx->dropped)
+		free(ctx->dropped);
+	for (i = 0; i < ctx->nbands; i++) {
+		free(ctx->bands[i].sb);
+		if (ctx->bands[i].rows)
+			free_align(ctx->bands[i].rows);
+	}
+	free(ctx->bands);
 	if (ctx->pb)
 		free(ctx->pb);
 	if (ctx->k)
@@ -134,14 +229,6 @@ static void free_bufs(OLTraceCtx *ctx)
 		free_align(ctx->btbuf);
 	if (ctx->sibuf)
 		free_align(ctx->sibuf);
-	if (ctx->stbuf)
-		free_align(ctx->stbuf);
-	if (ctx->sxbuf)
-		free_align(ctx->sxbuf);
-	if (ctx->sybuf)
-		free_align(ctx->sybuf);
-	if (ctx->smbuf)
-		free_align(ctx->smbuf);
 }
 
 static void init_blur(OLTraceCtx *ctx)
@@ -174,126 +261,105 @@ static void init_blur(OLTraceCtx *ctx)
 	}
 }
 
-static void perform_blur(OLTraceCtx *ctx, uint8_t *src, icoord stride)
+// Copies the band's rows of the source into bibuf, replicating the first and
+// last rows into the padding above and below the image
+static void fill_blur(OLTraceCtx *ctx, TraceBand *b, uint8_t *src, icoord stride)
 {
-	unsigned int x, y, z;
-	uint8_t *p, *q;
+	unsigned int y;
+	icoord y1 = b->y1 < ctx->p.height ? b->y1 : ctx->p.height;
+	uint8_t *p;
 
-	p = ctx->bibuf;
-	for (y = 0; y < ctx->kpad; y++) {
-		memcpy(p, src, ctx->p.width);
-		p += ctx->aw;
+	if (b->y0 == 0) {
+		p = ctx->bibuf;
+		for (y = 0; y < ctx->kpad; y++) {
+			memcpy(p, src, ctx->p.width);
+			p += ctx->aw;
+		}
 	}
-	for (y = 0; y < ctx->p.height; y++) {
+	p = ctx->bibuf + (ctx->kpad + b->y0) * ctx->aw;
+	src += b->y0 * stride;
+	for (y = b->y0; y < y1; y++) {
 		memcpy(p, src, ctx->p.width);
 		src += stride;
 		p += ctx->aw;
 	}
-	src -= stride;
-	for (y = 0; y < ctx->kpad; y++) {
-		memcpy(p, src, ctx->p.width);
-		p += ctx->aw;
+	if (y1 == ctx->p.height) {
+		src -= stride;
+		for (y = 0; y < ctx->kpad; y++) {
+			memcpy(p, src, ctx->p.width);
+			p += ctx->aw;
+		}
 	}
+}
 
-	p = ctx->bibuf;
-	q = ctx->btbuf + ctx->ah * ctx->kpad;
+// Whether the tile holding pixel (x, y) has flag set; always true outside
+// incremental mode
+static inline int tile_has(OLTraceCtx *ctx, icoord x, icoord y, uint8_t flag)
+{
+	return !ctx->tiles || (ctx->tiles[(y / TILE_SIZE) * ctx->tw + x / TILE_SIZE] & flag);
+}
+
+static void perform_blur(OLTraceCtx *ctx, TraceBand *b)
+{
+	unsigned int x, y, z;
+	icoord y1 = b->y1 < ctx->p.height ? b->y1 : ctx->p.height;
+	uint8_t *p, *q;
+
+	p = ctx->bibuf + b->y0 * ctx->aw;
+	q = ctx->btbuf + ctx->ah * ctx->kpad + b->y0;
 	for (x = 0; x < ctx->aw; x += 16) {
 		uint8_t *r = p;
 		uint8_t *s = q;
-		for (y = 0; y < ctx->p.height; y += 8) {
+		for (y = b->y0; y < y1; y += 8, r += 8*ctx->aw, s += 8) {
+			uint8_t *u = r;
 			uint8_t *t = s;
+			if (!tile_has(ctx, x, y, TILE_BLUR))
+				continue;
 			for (z = 0; z < 4; z++) {
-				ol_conv_sse2(r, t, ctx->aw, ctx->ah, ctx->k, ctx->ksize);
-				r += 2*ctx->aw;
+				ctx->kern->conv(u, t, ctx->aw, ctx->ah, ctx->k, ctx->ksize);
+				u += 2*ctx->aw;
 				t += 2*ctx->ah;
 			}
 			if (y&8) {
-				ol_transpose_2x8x8(s-8, ctx->ah);
-				ol_transpose_2x8x8(t-8, ctx->ah);
+				ctx->kern->transpose_2x8x8(s-8, ctx->ah);
+				ctx->kern->transpose_2x8x8(t-8, ctx->ah);
 			}
-			s += 8;
 		}
 		p += 16;
 		q += 16 * ctx->ah;
 	}
-	p = ctx->btbuf;
-	q = ctx->btbuf + ctx->ah * ctx->kpad;
+	p = ctx->btbuf + b->y0;
+	q = ctx->btbuf + ctx->ah * ctx->kpad + b->y0;
 	for (y = 0; y < ctx->kpad; y++) {
-		memcpy(p, q, ctx->ah);
+		memcpy(p, q, b->y1 - b->y0);
 		p += ctx->ah;
 	}
-	p = ctx->btbuf + ctx->ah * (ctx->kpad + ctx->p.width);
+	p = ctx->btbuf + ctx->ah * (ctx->kpad + ctx->p.width) + b->y0;
 	q = p - ctx->ah;
 	for (y = 0; y < ctx->kpad; y++) {
-		memcpy(p, q, ctx->ah);
+		memcpy(p, q, b->y1 - b->y0);
 		p += ctx->ah;
 	}
 
-	p = ctx->btbuf;
-	q = ctx->sibuf + ctx->aw;
-	for (x = 0; x < ctx->ah; x += 16) {
+	p = ctx->btbuf + b->y0;
+	q = ctx->sibuf + ctx->aw + b->y0 * ctx->aw;
+	for (x = b->y0; x < b->y1; x += 16) {
 		uint8_t *r = p;
 		uint8_t *s = q;
-		for (y = 0; y < ctx->p.width; y += 8) {
+		for (y = 0; y < ctx->p.width; y += 8, r += 8*ctx->ah, s += 8) {
+			uint8_t *u = r;
 			uint8_t *t = s;
+			if (!tile_has(ctx, y, x, TILE_BLUR))
+				continue;
 			for (z = 0; z < 4; z++) {
-				ol_conv_sse2(r, t, ctx->ah, ctx->aw, ctx->k, ctx->ksize);
-				r += 2*ctx->ah;
+				ctx->kern->conv(u, t, ctx->ah, ctx->aw, ctx->k, ctx->ksize);
+				u += 2*ctx->ah;
 				t += 2*ctx->aw;
 			}
 			if (y&8) {
-				ol_transpose_2x8x8(s-8, ctx->aw);
-				ol_transpose_2x8x8(t-8, ctx->aw);
+				ctx->kern->transpose_2x8x8(s-8, ctx->aw);
+				ctx->kern->transpose_2x8x8(t-8, ctx->aw);
 			}
-			s += 8;
-		}
-		p += 16;
-		q += 16 * ctx->aw;
-	}
-}
-
-static void perform_sobel(OLTraceCtx *ctx, sobel_v_fn vfn, sobel_h_fn hfn, int16_t *obuf)
-{
-	icoord x, y;
-	uint8_t *bp;
-	int16_t *p, *q;
-
-	bp = ctx->sibuf + ctx->aw;
-	memcpy(ctx->sibuf, bp, ctx->aw);
-	bp += ctx->aw * ctx->p.height;
-	memcpy(bp, bp - ctx->aw, ctx->aw);
-
-	bp = ctx->sibuf;
-	q = ctx->stbuf + ctx->ah;
-	for (x = 0; x < ctx->aw; x += 16) {
-		uint8_t *r = bp;
-		int16_t *s = q;
-		for (y = 0; y < ctx->p.height; y += 8) {
-			vfn(r, s, ctx->aw, ctx->ah);
-			ol_transpose_8x8w(s, 2*ctx->ah);
-			ol_transpose_8x8w(s + 8*ctx->ah, 2*ctx->ah);
-			r += 8*ctx->aw;
-			s += 8;
-		}
-		bp += 16;
-		q += 16 * ctx->ah;
-	}
-	p = ctx->stbuf + ctx->ah;
-	memcpy(ctx->stbuf, p, 2 * ctx->ah);
-	p += ctx->ah * ctx->p.width;
-	memcpy(p, p - ctx->ah, 2 * ctx->ah);
-
-	p = ctx->stbuf;
-	q = obuf;
-	for (x = 0; x < ctx->ah; x += 16) {
-		int16_t *r = p;
-		int16_t *s = q;
-		for (y = 0; y < ctx->p.width; y += 8) {
-			hfn(r, s, ctx->ah, ctx->aw);
-			ol_transpose_8x8w(s, 2*ctx->aw);
-			ol_transpose_8x8w(s + 8*ctx->aw, 2*ctx->aw);
-			r += 8*ctx->ah;
-			s += 8;
 		}
 		p += 16;
 		q += 16 * ctx->aw;
@@ -320,17 +386,17 @@ static inline void add_bufpoint(OLTraceCtx *ctx, icoord x, icoord y)
 	}
 }
 
-static inline void add_startpoint(OLTraceCtx *ctx, icoord x, icoord y)
+static inline void add_startpoint(TraceBand *b, icoord x, icoord y)
 {
-	ctx->sbp->x = x;
-	ctx->sbp->y = y;
-	ctx->sbp++;
-	if (ctx->sbp == ctx->sb_end) {
-		unsigned int cur = ctx->sbp - ctx->sb;
-		ctx->sb_size *= 2;
-		ctx->sb = realloc(ctx->sb, ctx->sb_size * sizeof(*ctx->sb));
-		ctx->sbp = ctx->sb + cur;
-		ctx->sb_end = ctx->sb + ctx->sb_size;
+	b->sbp->x = x;
+	b->sbp->y = y;
+	b->sbp++;
+	if (b->sbp == b->sb_end) {
+		unsigned int cur = b->sbp - b->sb;
+		b->sb_size *= 2;
+		b->sb = realloc(b->sb, b->sb_size * sizeof(*b->sb));
+		b->sbp = b->sb + cur;
+		b->sb_end = b->sb + b->sb_size;
 	}
 }
 
@@ -445,21 +511,24 @@ static int trace_pixels(OLTraceCtx *ctx, uint16_t *buf, int output, icoord *cx,
 	return iters;
 }
 
-static void find_edges_thresh(OLTraceCtx *ctx, uint8_t *src, unsigned int stride)
+typedef void (*rect_fn)(OLTraceCtx *ctx, TraceBand *b, icoord xa, icoord xb, icoord ya, icoord yb);
+
+static void find_edges_thresh(OLTraceCtx *ctx, TraceBand *b, icoord xa, icoord xb, icoord ya, icoord yb)
 {
 	unsigned int thresh = ctx->p.threshold;
-	icoord x, y, w, h;
+	uint8_t *src = ctx->ksize ? ctx->sibuf : ctx->src;
+	icoord stride = ctx->ksize ? ctx->aw : ctx->stride;
+	icoord x, y, w;
 	w = ctx->p.width;
-	h = ctx->p.height;
 
-	for (y=2; y<h-2; y++) {
-		for (x=2; x<w-2;x++) {
+	for (y = ya; y < yb; y++) {
+		for (x = xa; x < xb; x++) {
 			int idx = y*stride+x;
 			int oidx = y*w+x;
+			ctx->edges[oidx] = 0;
 			if (src[idx] > thresh && (!(src[idx-stride] > thresh)
 			                         || !(src[idx-1] > thresh))) {
-				ctx->tracebuf[oidx] = 0xFFFF;
-				add_startpoint(ctx, x, y);
+				ctx->edges[oidx] = 2;
 #ifdef DEBUG
 				dbg[oidx][0] = 64;
 				dbg[oidx][1] = 64;
@@ -468,8 +537,7 @@ static void find_edges_thresh(OLTraceCtx *ctx, uint8_t *src, unsigned int stride
 			}
 			if (src[idx] <= thresh && (!(src[idx-stride] <= thresh)
 			                         || !(src[idx-1] <= thresh))) {
-				ctx->tracebuf[oidx] = 0xFFFF;
-				add_startpoint(ctx, x, y);
+				ctx->edges[oidx] = 2;
 #ifdef DEBUG
 				dbg[oidx][0] = 64;
 				dbg[oidx][1] = 64;
@@ -480,11 +548,16 @@ static void find_edges_thresh(OLTraceCtx *ctx, uint8_t *src, unsigned int stride
 	}
 }
 
-#define ABS(x) (((x)<0)?-(x):(x))
-
-static void find_edges_canny(OLTraceCtx *ctx, uint8_t *src, unsigned int stride)
+// Non-maximum suppression over the rectangle. Gradients are computed one row
+// ahead from the blurred image, so the rows just outside it are covered too
+// and no full-frame gradient buffers are needed.
+static void find_edges_canny(OLTraceCtx *ctx, TraceBand *b, icoord xa, icoord xb, icoord ya, icoord yb)
 {
-	icoord x, y;
+	icoord y;
+	// the row kernels work on [1,n-1) and [2,n-2) of the pixels they get
+	icoord o = xa - 2;
+	icoord n = xb - xa + 4;
+	uint16_t *mag[3];
 	
 	unsigned int high_t = ctx->p.threshold;
 	unsigned int low_t = ctx->p.threshold2;
@@ -495,150 +568,379 @@ static void find_edges_canny(OLTraceCtx *ctx, uint8_t *src, unsigned int stride)
 		low_t = high_t;
 		high_t = tmp;
 	}
-	
-	if (src != ctx->sibuf) {
-		uint8_t *p = ctx->sibuf + ctx->aw;
-		for (y = 0; y < ctx->p.height; y++) {
-			memcpy(p, src, ctx->p.width);
-			src += stride;
+
+	// image row y is row y+1 of sibuf, so row y's window starts at row y
+	for (y = ya - 1; y <= ya; y++)
+		ctx->kern->sobel_row(ctx->sibuf + y*ctx->aw + o, ctx->aw,
+		                     b->gx[y%3] + o, b->gy[y%3] + o, b->mag[y%3] + o, n);
+
+	for (y = ya; y < yb; y++) {
+		unsigned int k = (y+1) % 3;
+
+		ctx->kern->sobel_row(ctx->sibuf + (y+1)*ctx->aw + o, ctx->aw,
+		                     b->gx[k] + o, b->gy[k] + o, b->mag[k] + o, n);
+		mag[0] = b->mag[(y-1)%3] + o;
+		mag[1] = b->mag[y%3] + o;
+		mag[2] = b->mag[k] + o;
+		ctx->kern->nms_row(b->gx[y%3] + o, b->gy[y%3] + o, mag,
+		                   ctx->edges + y*ctx->p.width + o, n, low_t, high_t);
+	}
+}
+
+// Marks the rectangle's edges for tracing and queues its start points
+static void collect_edges(OLTraceCtx *ctx, TraceBand *b, icoord xa, icoord xb, icoord ya, icoord yb)
+{
+	icoord x, y;
+
+	for (y = ya; y < yb; y++) {
+		uint8_t *e = ctx->edges + y*ctx->p.width;
+		uint16_t *pt = ctx->tracebuf + y*ctx->p.width;
+		for (x = xa; x < xb; x++) {
+			if (e[x]) {
+				pt[x] = 0xffff;
+				if (e[x] > 1)
+					add_startpoint(b, x, y);
+			}
+		}
+	}
+}
+
+// Calls fn on the band's pixels that edge detection looks at, at once, or in
+// incremental mode on each horizontal run of tiles with flag set
+static void for_each_rect(OLTraceCtx *ctx, TraceBand *b, uint8_t flag, rect_fn fn)
+{
+	icoord x0 = 2, x1 = ctx->p.width - 2;
+	icoord y0 = b->y0 > 2 ? b->y0 : 2;
+	icoord y1 = b->y1 < (ctx->p.height-2) ? b->y1 : (ctx->p.height-2);
+	icoord tx, ty;
+
+	if (y0 >= y1 || x0 >= x1)
+		return;
+	if (!ctx->tiles) {
+		fn(ctx, b, x0, x1, y0, y1);
+		return;
+	}
+
+	for (ty = y0 / TILE_SIZE; ty * TILE_SIZE < y1; ty++) {
+		uint8_t *t = ctx->tiles + ty * ctx->tw;
+		icoord ya = ty * TILE_SIZE > y0 ? ty * TILE_SIZE : y0;
+		icoord yb = (ty + 1) * TILE_SIZE < y1 ? (ty + 1) * TILE_SIZE : y1;
+		for (tx = 0; tx < ctx->tw; tx++) {
+			icoord xa, xb;
+			if (!(t[tx] & flag))
+				continue;
+			xa = tx * TILE_SIZE;
+			while (tx < ctx->tw && (t[tx] & flag))
+				tx++;
+			xb = tx * TILE_SIZE;
+			if (xa < x0)
+				xa = x0;
+			if (xb > x1)
+				xb = x1;
+			if (xa < xb)
+				fn(ctx, b, xa, xb, ya, yb);
+		}
+	}
+}
+
+static void band_sync(OLTraceCtx *ctx)
+{
+	if (ctx->nbands > 1)
+		pthread_barrier_wait(&ctx->barrier);
+}
+
+// Runs edge detection on one band. Every band goes through the same
+// barriers, which only depend on the parameters.
+static void trace_band(OLTraceCtx *ctx, TraceBand *b)
+{
+	uint8_t *pbuf = ctx->src;
+	icoord stride = ctx->stride;
+	icoord y1 = b->y1 < ctx->p.height ? b->y1 : ctx->p.height;
+	icoord y;
+
+	memset(ctx->tracebuf + b->y0 * ctx->p.width, 0, (y1 - b->y0) * ctx->p.width * 2);
+	b->sbp = b->sb;
+
+	if (ctx->ksize) {
+		fill_blur(ctx, b, pbuf, stride);
+		band_sync(ctx);
+		perform_blur(ctx, b);
+	} else if (ctx->p.mode == OL_TRACE_CANNY) {
+		uint8_t *p = ctx->sibuf + ctx->aw * (1 + b->y0);
+		pbuf += b->y0 * stride;
+		for (y = b->y0; y < y1; y++) {
+			memcpy(p, pbuf, ctx->p.width);
+			pbuf += stride;
 			p += ctx->aw;
 		}
 	}
+	if (ctx->ksize || ctx->p.mode == OL_TRACE_CANNY)
+		band_sync(ctx);
 
-	perform_sobel(ctx, ol_sobel_sse2_gx_v, ol_sobel_sse2_gx_h, ctx->sxbuf);
-	perform_sobel(ctx, ol_sobel_sse2_gy_v, ol_sobel_sse2_gy_h, ctx->sybuf);
-
-	uint32_t *pm = ctx->smbuf;
-	int16_t *px = ctx->sxbuf;
-	int16_t *py = ctx->sybuf;
-	unsigned int count = ctx->aw * ctx->p.height;
-
-	while (count--) {
-		*pm++ = ABS(*px) + ABS(*py);
-		px++;
-		py++;
-	}
-
-#define TAN45 0.41421356
-#define ITAN45 ((int32_t)(TAN45*0x10000))
-
-	int s = ctx->aw;
-
-	for (y = 2; y < (ctx->p.height-2); y++) {
-		uint16_t *pt = ctx->tracebuf + y*ctx->p.width + 2;
-		px = ctx->sxbuf + y*ctx->aw + 2;
-		py = ctx->sybuf + y*ctx->aw + 2;
-		pm = ctx->smbuf + y*ctx->aw + 2;
-		for (x = 2; x < (ctx->p.width-2); x++) {
-			uint32_t gm = *pm;
-			if (gm > low_t)  {
-				int16_t gx = *px;
-				int16_t gy = *py;
-				int16_t sign = gx ^ gy;
-				gx = ABS(gx);
-				gy = ABS(gy);
-				int32_t kgy = ITAN45*gy;
-				if ((gx<<16) < kgy) {
-					// horizontal edge [-]
-					if (gm > pm[-s] && gm > pm[s]) {
-						*pt = 0xffff;
-						if (gm > high_t)
-							add_startpoint(ctx, x, y);
-					}
-				} else if ((gx<<16) > (kgy+(gy<<17))) {
-					// vertical edge [|]
-					if (gm > pm[-1] && gm > pm[1]) {
-						*pt = 0xffff;
-						if (gm > high_t)
-							add_startpoint(ctx, x, y);
-					}
-				} else if (sign < 0) {
-					// diagonal edge [\]
-					if (gm > pm[1-s] && gm > pm[s-1]) {
-						*pt = 0xffff;
-						if (gm > high_t)
-							add_startpoint(ctx, x, y);
-					}
-				} else {
-					// diagonal edge [/]
-					if (gm > pm[-1-s] && gm > pm[s+1]) {
-						*pt = 0xffff;
-						if (gm > high_t)
-							add_startpoint(ctx, x, y);
-					}
+	switch (ctx->p.mode) {
+		case OL_TRACE_THRESHOLD:
+			for_each_rect(ctx, b, TILE_EDGES, find_edges_thresh);
+			break;
+		case OL_TRACE_CANNY:
+			for_each_rect(ctx, b, TILE_EDGES, find_edges_canny);
+			break;
+	}
+	for_each_rect(ctx, b, TILE_TRACE, collect_edges);
+}
+
+static void *band_thread(void *arg)
+{
+	TraceBand *b = arg;
+	OLTraceCtx *ctx = b->ctx;
+	unsigned int gen = 0;
+
+	while (1) {
+		pthread_mutex_lock(&ctx->lock);
+		while (!ctx->quit && ctx->gen == gen)
+			pthread_cond_wait(&ctx->start, &ctx->lock);
+		if (ctx->quit) {
+			pthread_mutex_unlock(&ctx->lock);
+			break;
+		}
+		gen = ctx->gen;
+		pthread_mutex_unlock(&ctx->lock);
+
+		trace_band(ctx, b);
+
+		pthread_mutex_lock(&ctx->lock);
+		if (--ctx->busy == 0)
+			pthread_cond_signal(&ctx->done);
+		pthread_mutex_unlock(&ctx->lock);
+	}
+	return NULL;
+}
+
+static void start_threads(OLTraceCtx *ctx)
+{
+	unsigned int i;
+
+	ctx->gen = 0;
+	ctx->busy = 0;
+	ctx->quit = 0;
+	if (ctx->nbands < 2)
+		return;
+	pthread_barrier_init(&ctx->barrier, NULL, ctx->nbands);
+	for (i = 1; i < ctx->nbands; i++)
+		pthread_create(&ctx->bands[i].thread, NULL, band_thread, &ctx->bands[i]);
+}
+
+static void stop_threads(OLTraceCtx *ctx)
+{
+	unsigned int i;
+
+	if (ctx->nbands < 2)
+		return;
+	pthread_mutex_lock(&ctx->lock);
+	ctx->quit = 1;
+	pthread_cond_broadcast(&ctx->start);
+	pthread_mutex_unlock(&ctx->lock);
+	for (i = 1; i < ctx->nbands; i++)
+		pthread_join(ctx->bands[i].thread, NULL);
+	pthread_barrier_destroy(&ctx->barrier);
+}
+
+// Sets to on every tile within r tiles of one with from set
+static void dilate_tiles(OLTraceCtx *ctx, uint8_t from, uint8_t to, int r)
+{
+	int tx, ty, x, y;
+
+	for (ty = 0; ty < ctx->th; ty++) {
+		for (tx = 0; tx < ctx->tw; tx++) {
+			if (!(ctx->tiles[ty * ctx->tw + tx] & from))
+				continue;
+			for (y = ty - r; y <= ty + r; y++) {
+				if (y < 0 || y >= ctx->th)
+					continue;
+				for (x = tx - r; x <= tx + r; x++) {
+					if (x >= 0 && x < ctx->tw)
+						ctx->tiles[y * ctx->tw + x] |= to;
+				}
+			}
+		}
+	}
+}
+
+// Compares the frame against the previous one and works out which tiles need
+// to be blurred, edge detected and traced again, and which of the contours
+// returned last time are still good
+static void incremental_begin(OLTraceCtx *ctx, uint8_t *src, unsigned int stride)
+{
+	icoord w = ctx->p.width;
+	icoord x, y;
+	unsigned int i, j;
+	OLTracePoint *p;
+	int changed;
+
+	if (!ctx->have_prev) {
+		memset(ctx->tiles, TILE_CHANGED, ctx->tw * ctx->th);
+		ctx->kept_objects = 0;
+	} else {
+		memset(ctx->tiles, 0, ctx->tw * ctx->th);
+		for (y = 0; y < ctx->p.height; y++) {
+			uint8_t *t = ctx->tiles + (y / TILE_SIZE) * ctx->tw;
+			for (x = 0; x < w; x += TILE_SIZE) {
+				icoord n = w - x < TILE_SIZE ? w - x : TILE_SIZE;
+				if (!(t[x / TILE_SIZE] & TILE_CHANGED) &&
+					memcmp(src + y * stride + x, ctx->prev + y * w + x, n))
+					t[x / TILE_SIZE] |= TILE_CHANGED;
+			}
+		}
+	}
+	for (y = 0; y < ctx->p.height; y++)
+		memcpy(ctx->prev + y * w, src + y * stride, w);
+	ctx->have_prev = 1;
+
+	// blurred pixels see kpad pixels around them, and edges two more
+	dilate_tiles(ctx, TILE_CHANGED, TILE_BLUR, (ctx->kpad + TILE_SIZE - 1) / TILE_SIZE);
+	dilate_tiles(ctx, TILE_CHANGED, TILE_EDGES | TILE_TRACE,
+	             (ctx->kpad + 2 + TILE_SIZE - 1) / TILE_SIZE);
+
+	// a contour that crosses a tile being retraced is traced again as a
+	// whole, which can pull in more contours through the tiles it covers
+	if (ctx->kept_objects)
+		memset(ctx->dropped, 0, ctx->kept_objects);
+	do {
+		changed = 0;
+		p = ctx->kept;
+		for (i = 0; i < ctx->kept_objects; i++) {
+			unsigned int count = ctx->kept_counts[i];
+			if (!ctx->dropped[i]) {
+				for (j = 0; j < count; j++) {
+					if (tile_has(ctx, p[j].x, p[j].y, TILE_TRACE))
+						break;
+				}
+				if (j < count) {
+					ctx->dropped[i] = 1;
+					changed = 1;
+					for (j = 0; j < count; j++)
+						ctx->tiles[(p[j].y / TILE_SIZE) * ctx->tw + p[j].x / TILE_SIZE] |= TILE_TRACE;
 				}
 			}
-			px++;
-			py++;
-			pm++;
-			pt++;
+			p += count;
+		}
+	} while (changed);
+}
+
+// Returns the contours that were not retraced, as they were
+static unsigned int incremental_reuse(OLTraceCtx *ctx)
+{
+	OLTracePoint *p = ctx->kept;
+	unsigned int i, j, objects = 0;
+
+	for (i = 0; i < ctx->kept_objects; i++) {
+		unsigned int count = ctx->kept_counts[i];
+		if (!ctx->dropped[i]) {
+			for (j = 0; j < count; j++)
+				add_bufpoint(ctx, p[j].x, p[j].y);
+			ctx->pbp[-1].x |= 1<<31;
+			objects++;
 		}
+		p += count;
 	}
+	return objects;
+}
+
+// Keeps a copy of the contours returned, for the next frame
+static void incremental_end(OLTraceCtx *ctx, OLTraceResult *result)
+{
+	unsigned int points = ctx->pbp - ctx->pb;
+	unsigned int i;
+
+	if (points > ctx->kept_size) {
+		ctx->kept_size = points;
+		ctx->kept = realloc(ctx->kept, ctx->kept_size * sizeof(*ctx->kept));
+	}
+	if (result->count > ctx->kept_objects_size) {
+		ctx->kept_objects_size = result->count;
+		ctx->dropped = realloc(ctx->dropped, ctx->kept_objects_size);
+	}
+	ctx->kept_counts = realloc(ctx->kept_counts, ctx->kept_objects_size * sizeof(*ctx->kept_counts));
+	if (points)
+		memcpy(ctx->kept, result->objects[0].points, points * sizeof(*ctx->kept));
+	for (i = 0; i < result->count; i++)
+		ctx->kept_counts[i] = result->objects[i].count;
+	ctx->kept_objects = result->count;
 }
 
 int olTrace(OLTraceCtx *ctx, uint8_t *src, unsigned int stride, OLTraceResult *result)
 {
 	icoord x, y;
 	unsigned int objects = 0;
+	unsigned int i;
 	icoord w = ctx->p.width;
-	icoord h = ctx->p.height;
 
-	memset(ctx->tracebuf, 0, w*h*2);
 #ifdef DEBUG
+	icoord h = ctx->p.height;
 	memset(dbg, 0, 3*w*h);
 #endif
 
-	ctx->sbp = ctx->sb;
 	ctx->pbp = ctx->pb;
+	ctx->src = src;
+	ctx->stride = stride;
+	if (ctx->tiles) {
+		incremental_begin(ctx, src, stride);
+		objects = incremental_reuse(ctx);
+	}
 
-	uint8_t *pbuf = src;
-	if (ctx->ksize) {
-		perform_blur(ctx, pbuf, stride);
-		pbuf = ctx->sibuf;
-		stride = ctx->aw;
+	if (ctx->nbands > 1) {
+		pthread_mutex_lock(&ctx->lock);
+		ctx->busy = ctx->nbands - 1;
+		ctx->gen++;
+		pthread_cond_broadcast(&ctx->start);
+		pthread_mutex_unlock(&ctx->lock);
 	}
-	switch (ctx->p.mode) {
-		case OL_TRACE_THRESHOLD:
-			find_edges_thresh(ctx, pbuf, stride);
-			break;
-		case OL_TRACE_CANNY:
-			find_edges_canny(ctx, pbuf, stride);
-			break;
+
+	trace_band(ctx, &ctx->bands[0]);
+
+	if (ctx->nbands > 1) {
+		pthread_mutex_lock(&ctx->lock);
+		while (ctx->busy)
+			pthread_cond_wait(&ctx->done, &ctx->lock);
+		pthread_mutex_unlock(&ctx->lock);
 	}
 
-	OLTracePoint *ps = ctx->sb;
-	while (ps != ctx->sbp) {
-		x = ps->x;
-		y = ps->y;
-		ps++;
-		uint16_t flg = 1;
-		while (ctx->tracebuf[y*w+x] & 0x8000) {
-			icoord tx = x, ty = y;
-			if (flg != 64)
-				flg <<= 1;
-			trace_pixels(ctx, ctx->tracebuf, 0, &tx, &ty, flg);
+	// contours are followed serially, from the start points of each band in
+	// turn, which gives the same order as a single band
+	for (i = 0; i < ctx->nbands; i++) {
+		OLTracePoint *ps = ctx->bands[i].sb;
+		while (ps != ctx->bands[i].sbp) {
+			x = ps->x;
+			y = ps->y;
+			ps++;
+			uint16_t flg = 1;
+			while (ctx->tracebuf[y*w+x] & 0x8000) {
+				icoord tx = x, ty = y;
+				if (flg != 64)
+					flg <<= 1;
+				trace_pixels(ctx, ctx->tracebuf, 0, &tx, &ty, flg);
 #ifdef DEBUG
-			icoord sx = tx, sy = ty;
+				icoord sx = tx, sy = ty;
 #endif
-			if (trace_pixels(ctx, ctx->tracebuf, 1, &tx, &ty, 0xFFFF)) {
-				ctx->pbp[-1].x |= 1<<31;
-				objects++;
-			}
+				if (trace_pixels(ctx, ctx->tracebuf, 1, &tx, &ty, 0xFFFF)) {
+					ctx->pbp[-1].x |= 1<<31;
+					objects++;
+				}
 
 #ifdef DEBUG
-			dbg[y*w+x][0] = 255;
-			dbg[y*w+x][1] = 255;
-			dbg[y*w+x][2] = 0;
-
-			dbg[sy*w+sx][0] = 0;
-			dbg[sy*w+sx][1] = 255;
-			dbg[sy*w+sx][2] = 255;
-
-			dbg[ty*w+tx][0] = 255;
-			dbg[ty*w+tx][1] = 0;
-			dbg[ty*w+tx][2] = 0;
-			printf("%d: %d,%d %d,%d %d,%d\n", tframe, x, y, sx, sy, tx, ty);
+				dbg[y*w+x][0] = 255;
+				dbg[y*w+x][1] = 255;
+				dbg[y*w+x][2] = 0;
+
+				dbg[sy*w+sx][0] = 0;
+				dbg[sy*w+sx][1] = 255;
+				dbg[sy*w+sx][2] = 255;
+
+				dbg[ty*w+tx][0] = 255;
+				dbg[ty*w+tx][1] = 0;
+				dbg[ty*w+tx][2] = 0;
+				printf("%d: %d,%d %d,%d %d,%d\n", tframe, x, y, sx, sy, tx, ty);
 #endif
+			}
 		}
 	}
 #ifdef DEBUG
@@ -674,6 +976,9 @@ int olTrace(OLTraceCtx *ctx, uint8_t *src, unsigned int stride, OLTraceResult *r
 		}
 	}
 
+	if (ctx->tiles)
+		incremental_end(ctx, result);
+
 	return objects;
 }
 
@@ -683,9 +988,14 @@ int olTraceInit(OLTraceCtx **pctx, OLTraceParams *params)
 	OLTraceCtx *ctx = malloc(sizeof(OLTraceCtx));
 
 	ctx->p = *params;
+	ctx->kern = ol_imgproc_kernels();
+	pthread_mutex_init(&ctx->lock, NULL);
+	pthread_cond_init(&ctx->start, NULL);
+	pthread_cond_init(&ctx->done, NULL);
 
 	alloc_bufs(ctx);
 	init_blur(ctx);
+	start_threads(ctx);
 
 	*pctx = ctx;
 	return 0;
@@ -695,15 +1005,29 @@ int olTraceReInit(OLTraceCtx *ctx, OLTraceParams *params)
 {
 	unsigned int new_ksize = ((unsigned int)round(params->sigma * 6 + 1)) | 1;
 
+	// alloc_bufs() turns a 1-tap kernel into no blur at all
+	if (new_ksize <= 1)
+		new_ksize = 0;
+
 	if (ctx->p.mode != params->mode ||
 		ctx->p.width != params->width ||
 		ctx->p.height != params->height ||
+		ctx->p.threads != params->threads ||
+		ctx->p.incremental != params->incremental ||
 		ctx->ksize != new_ksize)
 	{
+		stop_threads(ctx);
 		free_bufs(ctx);
 		ctx->p = *params;
 		alloc_bufs(ctx);
+		start_threads(ctx);
 	} else {
+		// the edges kept from the last frame are only good for the same
+		// thresholds and blur
+		if (ctx->p.threshold != params->threshold ||
+			ctx->p.threshold2 != params->threshold2 ||
+			ctx->p.sigma != params->sigma)
+			ctx->have_prev = 0;
 		ctx->p = *params;
 	}
 	init_blur(ctx);
@@ -721,11 +1045,20 @@ void olTraceFree(OLTraceResult *result)
 	}
 }
 
+const char *olTraceKernels(OLTraceCtx *ctx)
+{
+	return ctx->kern->name;
+}
+
 void olTraceDeinit(OLTraceCtx *ctx)
 {
 	if (!ctx)
 		return;
 
+	stop_threads(ctx);
 	free_bufs(ctx);
+	pthread_mutex_destroy(&ctx->lock);
+	pthread_cond_destroy(&ctx->start);
+	pthread_cond_destroy(&ctx->done);
 	free(ctx);
 }
@@ -0,0 +1,317 @@
+/*
+        OpenLase - a realtime laser graphics toolkit
+
+Copyright (C) 2009-2011 Hector Martin "marcan" <hector@marcansoft.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 2.1 or version 3.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include "transform.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+# define HAVE_X86_KERNELS
+# include <immintrin.h>
+#endif
+
+#if defined(__aarch64__)
+// armv7 NEON has no divide, so only AArch64 gets vector kernels
+# define HAVE_NEON_KERNELS
+# include <arm_neon.h>
+#endif
+
+/* Portable versions, also used for the tails of the vector ones */
+
+static void transform2_c(const float m[3][3], float *x, float *y, int count)
+{
+	int i;
+	for (i = 0; i < count; i++) {
+		float nx = m[0][0] * x[i] + m[0][1] * y[i] + m[0][2];
+		float ny = m[1][0] * x[i] + m[1][1] * y[i] + m[1][2];
+		float nw = m[2][0] * x[i] + m[2][1] * y[i] + m[2][2];
+		x[i] = nx / nw;
+		y[i] = ny / nw;
+	}
+}
+
+static void transform3_c(const float m[4][4], float *x, float *y, float *z, int count)
+{
+	int i;
+	for (i = 0; i < count; i++) {
+		float px = m[0][0] * x[i] + m[0][1] * y[i] + m[0][2] * z[i] + m[0][3];
+		float py = m[1][0] * x[i] + m[1][1] * y[i] + m[1][2] * z[i] + m[1][3];
+		float pz = m[2][0] * x[i] + m[2][1] * y[i] + m[2][2] * z[i] + m[2][3];
+		float pw = m[3][0] * x[i] + m[3][1] * y[i] + m[3][2] * z[i] + m[3][3];
+		x[i] = px / pw;
+		y[i] = py / pw;
+		z[i] = pz / pw;
+	}
+}
+
+static void affine4_c(const float m[2][3], const float *in, float *out, int count)
+{
+	int i;
+	for (i = 0; i < count; i++, in += 4, out += 4) {
+		float x = in[0], y = in[1];
+		out[0] = m[0][0] * x + m[0][1] * y + m[0][2];
+		out[1] = m[1][0] * x + m[1][1] * y + m[1][2];
+		memcpy(out + 2, in + 2, 2 * sizeof(float));
+	}
+}
+
+#ifdef HAVE_X86_KERNELS
+
+/* SSE2. Always there on x86_64. */
+
+__attribute__((target("sse2")))
+static void transform2_sse2(const float m[3][3], float *x, float *y, int count)
+{
+	__m128 m00 = _mm_set1_ps(m[0][0]), m01 = _mm_set1_ps(m[0][1]), m02 = _mm_set1_ps(m[0][2]);
+	__m128 m10 = _mm_set1_ps(m[1][0]), m11 = _mm_set1_ps(m[1][1]), m12 = _mm_set1_ps(m[1][2]);
+	__m128 m20 = _mm_set1_ps(m[2][0]), m21 = _mm_set1_ps(m[2][1]), m22 = _mm_set1_ps(m[2][2]);
+	int i;
+
+	for (i = 0; i + 4 <= count; i += 4) {
+		__m128 vx = _mm_loadu_ps(x + i);
+		__m128 vy = _mm_loadu_ps(y + i);
+		__m128 nx = _mm_add_ps(_mm_add_ps(_mm_mul_ps(m00, vx), _mm_mul_ps(m01, vy)), m02);
+		__m128 ny = _mm_add_ps(_mm_add_ps(_mm_mul_ps(m10, vx), _mm_mul_ps(m11, vy)), m12);
+		__m128 nw = _mm_add_ps(_mm_add_ps(_mm_mul_ps(m20, vx), _mm_mul_ps(m21, vy)), m22);
+		_mm_storeu_ps(x + i, _mm_div_ps(nx, nw));
+		_mm_storeu_ps(y + i, _mm_div_ps(ny, nw));
+	}
+	transform2_c(m, x + i, y + i, count - i);
+}
+
+#define ROW4_SSE(r, vx, vy, vz) \
+	_mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(m[r][0]), vx), \
+		_mm_mul_ps(_mm_set1_ps(m[r][1]), vy)), _mm_mul_ps(_mm_set1_ps(m[r][2]), vz)), \
+		_mm_set1_ps(m[r][3]))
+
+__attribute__((target("sse2")))
+static void transform3_sse2(const float m[4][4], float *x, float *y, float *z, int count)
+{
+	int i;
+
+	for (i = 0; i + 4 <= count; i += 4) {
+		__m128 vx = _mm_loadu_ps(x + i);
+		__m128 vy = _mm_loadu_ps(y + i);
+		__m128 vz = _mm_loadu_ps(z + i);
+		__m128 pw = ROW4_SSE(3, vx, vy, vz);
+		_mm_storeu_ps(x + i, _mm_div_ps(ROW4_SSE(0, vx, vy, vz), pw));
+		_mm_storeu_ps(y + i, _mm_div_ps(ROW4_SSE(1, vx, vy, vz), pw));
+		_mm_storeu_ps(z + i, _mm_div_ps(ROW4_SSE(2, vx, vy, vz), pw));
+	}
+	transform3_c(m, x + i, y + i, z + i, count - i);
+}
+
+__attribute__((target("sse2")))
+static void affine4_sse2(const float m[2][3], const float *in, float *out, int count)
+{
+	__m128 m00 = _mm_set1_ps(m[0][0]), m01 = _mm_set1_ps(m[0][1]), m02 = _mm_set1_ps(m[0][2]);
+	__m128 m10 = _mm_set1_ps(m[1][0]), m11 = _mm_set1_ps(m[1][1]), m12 = _mm_set1_ps(m[1][2]);
+	int i;
+
+	for (i = 0; i + 4 <= count; i += 4, in += 16, out += 16) {
+		__m128 r0 = _mm_loadu_ps(in), r1 = _mm_loadu_ps(in + 4);
+		__m128 r2 = _mm_loadu_ps(in + 8), r3 = _mm_loadu_ps(in + 12);
+		_MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+		__m128 nx = _mm_add_ps(_mm_add_ps(_mm_mul_ps(m00, r0), _mm_mul_ps(m01, r1)), m02);
+		__m128 ny = _mm_add_ps(_mm_add_ps(_mm_mul_ps(m10, r0), _mm_mul_ps(m11, r1)), m12);
+		r0 = nx;
+		r1 = ny;
+		_MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+		_mm_storeu_ps(out, r0);
+		_mm_storeu_ps(out + 4, r1);
+		_mm_storeu_ps(out + 8, r2);
+		_mm_storeu_ps(out + 12, r3);
+	}
+	affine4_c(m, in, out, count - i);
+}
+
+/* AVX2. FMA is deliberately not enabled so results match the others. */
+
+__attribute__((target("avx2")))
+static void transform2_avx2(const float m[3][3], float *x, float *y, int count)
+{
+	__m256 m00 = _mm256_set1_ps(m[0][0]), m01 = _mm256_set1_ps(m[0][1]), m02 = _mm256_set1_ps(m[0][2]);
+	__m256 m10 = _mm256_set1_ps(m[1][0]), m11 = _mm256_set1_ps(m[1][1]), m12 = _mm256_set1_ps(m[1][2]);
+	__m256 m20 = _mm256_set1_ps(m[2][0]), m21 = _mm256_set1_ps(m[2][1]), m22 = _mm256_set1_ps(m[2][2]);
+	int i;
+
+	for (i = 0; i + 8 <= count; i += 8) {
+		__m256 vx = _mm256_loadu_ps(x + i);
+		__m256 vy = _mm256_loadu_ps(y + i);
+		__m256 nx = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(m00, vx), _mm256_mul_ps(m01, vy)), m02);
+		__m256 ny = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(m10, vx), _mm256_mul_ps(m11, vy)), m12);
+		__m256 nw = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(m20, vx), _mm256_mul_ps(m21, vy)), m22);
+		_mm256_storeu_ps(x + i, _mm256_div_ps(nx, nw));
+		_mm256_storeu_ps(y + i, _mm256_div_ps(ny, nw));
+	}
+	transform2_c(m, x + i, y + i, count - i);
+}
+
+#define ROW4_AVX(r, vx, vy, vz) \
+	_mm256_add_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(m[r][0]), vx), \
+		_mm256_mul_ps(_mm256_set1_ps(m[r][1]), vy)), _mm256_mul_ps(_mm256_set1_ps(m[r][2]), vz)), \
+		_mm256_set1_ps(m[r][3]))
+
+__attribute__((target("avx2")))
+static void transform3_avx2(const float m[4][4], float *x, float *y, float *z, int count)
+{
+	int i;
+
+	for (i = 0; i + 8 <= count; i += 8) {
+		__m256 vx = _mm256_loadu_ps(x + i);
+		__m256 vy = _mm256_loadu_ps(y + i);
+		__m256 vz = _mm256_loadu_ps(z + i);
+		__m256 pw = ROW4_AVX(3, vx, vy, vz);
+		_mm256_storeu_ps(x + i, _mm256_div_ps(ROW4_AVX(0, vx, vy, vz), pw));
+		_mm256_storeu_ps(y + i, _mm256_div_ps(ROW4_AVX(1, vx, vy, vz), pw));
+		_mm256_storeu_ps(z + i, _mm256_div_ps(ROW4_AVX(2, vx, vy, vz), pw));
+	}
+	transform3_c(m, x + i, y + i, z + i, count - i);
+}
+
+// One record per 128-bit lane, two per register. The results are blended back
+// over the x,y slots.
+__attribute__((target("avx2")))
+static void affine4_avx2(const float m[2][3], const float *in, float *out, int count)
+{
+	__m256 a = _mm256_setr_ps(m[0][0], m[1][0], 0, 0, m[0][0], m[1][0], 0, 0);
+	__m256 b = _mm256_setr_ps(m[0][1], m[1][1], 0, 0, m[0][1], m[1][1], 0, 0);
+	__m256 t = _mm256_setr_ps(m[0][2], m[1][2], 0, 0, m[0][2], m[1][2], 0, 0);
+	int i;
+
+	for (i = 0; i + 2 <= count; i += 2, in += 8, out += 8) {
+		__m256 r = _mm256_loadu_ps(in);
+		__m256 vx = _mm256_permute_ps(r, _MM_SHUFFLE(0, 0, 0, 0));
+		__m256 vy = _mm256_permute_ps(r, _MM_SHUFFLE(1, 1, 1, 1));
+		__m256 n = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(a, vx), _mm256_mul_ps(b, vy)), t);
+		_mm256_storeu_ps(out, _mm256_blend_ps(r, n, 0x33));
+	}
+	affine4_c(m, in, out, count - i);
+}
+
+#endif
+
+#ifdef HAVE_NEON_KERNELS
+
+static void transform2_neon(const float m[3][3], float *x, float *y, int count)
+{
+	float32x4_t m00 = vdupq_n_f32(m[0][0]), m01 = vdupq_n_f32(m[0][1]), m02 = vdupq_n_f32(m[0][2]);
+	float32x4_t m10 = vdupq_n_f32(m[1][0]), m11 = vdupq_n_f32(m[1][1]), m12 = vdupq_n_f32(m[1][2]);
+	float32x4_t m20 = vdupq_n_f32(m[2][0]), m21 = vdupq_n_f32(m[2][1]), m22 = vdupq_n_f32(m[2][2]);
+	int i;
+
+	for (i = 0; i + 4 <= count; i += 4) {
+		float32x4_t vx = vld1q_f32(x + i);
+		float32x4_t vy = vld1q_f32(y + i);
+		float32x4_t nx = vaddq_f32(vaddq_f32(vmulq_f32(m00, vx), vmulq_f32(m01, vy)), m02);
+		float32x4_t ny = vaddq_f32(vaddq_f32(vmulq_f32(m10, vx), vmulq_f32(m11, vy)), m12);
+		float32x4_t nw = vaddq_f32(vaddq_f32(vmulq_f32(m20, vx), vmulq_f32(m21, vy)), m22);
+		vst1q_f32(x + i, vdivq_f32(nx, nw));
+		vst1q_f32(y + i, vdivq_f32(ny, nw));
+	}
+	transform2_c(m, x + i, y + i, count - i);
+}
+
+#define ROW4_NEON(r, vx, vy, vz) \
+	vaddq_f32(vaddq_f32(vaddq_f32(vmulq_f32(vdupq_n_f32(m[r][0]), vx), \
+		vmulq_f32(vdupq_n_f32(m[r][1]), vy)), vmulq_f32(vdupq_n_f32(m[r][2]), vz)), \
+		vdupq_n_f32(m[r][3]))
+
+static void transform3_neon(const float m[4][4], float *x, float *y, float *z, int count)
+{
+	int i;
+
+	for (i = 0; i + 4 <= count; i += 4) {
+		float32x4_t vx = vld1q_f32(x + i);
+		float32x4_t vy = vld1q_f32(y + i);
+		float32x4_t vz = vld1q_f32(z + i);
+		float32x4_t pw = ROW4_NEON(3, vx, vy, vz);
+		vst1q_f32(x + i, vdivq_f32(ROW4_NEON(0, vx, vy, vz), pw));
+		vst1q_f32(y + i, vdivq_f32(ROW4_NEON(1, vx, vy, vz), pw));
+		vst1q_f32(z + i, vdivq_f32(ROW4_NEON(2, vx, vy, vz), pw));
+	}
+	transform3_c(m, x + i, y + i, z + i, count - i);
+}
+
+static void affine4_neon(const float m[2][3], const float *in, float *out, int count)
+{
+	float32x4_t m00 = vdupq_n_f32(m[0][0]), m01 = vdupq_n_f32(m[0][1]), m02 = vdupq_n_f32(m[0][2]);
+	float32x4_t m10 = vdupq_n_f32(m[1][0]), m11 = vdupq_n_f32(m[1][1]), m12 = vdupq_n_f32(m[1][2]);
+	int i;
+
+	for (i = 0; i + 4 <= count; i += 4, in += 16, out += 16) {
+		float32x4x4_t r = vld4q_f32(in);
+		float32x4_t nx = vaddq_f32(vaddq_f32(vmulq_f32(m00, r.val[0]), vmulq_f32(m01, r.val[1])), m02);
+		float32x4_t ny = vaddq_f32(vaddq_f32(vmulq_f32(m10, r.val[0]), vmulq_f32(m11, r.val[1])), m12);
+		r.val[0] = nx;
+		r.val[1] = ny;
+		vst4q_f32(out, r);
+	}
+	affine4_c(m, in, out, count - i);
+}
+
+#endif
+
+static const TransformKernels kernels[] = {
+	{"c", transform2_c, transform3_c, affine4_c},
+#ifdef HAVE_X86_KERNELS
+	{"sse2", transform2_sse2, transform3_sse2, affine4_sse2},
+	{"avx2", transform2_avx2, transform3_avx2, affine4_avx2},
+#endif
+#ifdef HAVE_NEON_KERNELS
+	{"neon", transform2_neon, transform3_neon, affine4_neon},
+#endif
+};
+
+TransformKernels ol_xf = {"c", transform2_c, transform3_c, affine4_c};
+
+static int supported(const TransformKernels *k)
+{
+#ifdef HAVE_X86_KERNELS
+	__builtin_cpu_init();
+	if (!strcmp(k->name, "sse2"))
+		return __builtin_cpu_supports("sse2");
+	if (!strcmp(k->name, "avx2"))
+		return __builtin_cpu_supports("avx2");
+#endif
+	return 1;
+}
+
+static void pick_kernels(void)
+{
+	const char *cap = getenv("OL_SIMD");
+	int i;
+
+	// the table is in order of preference; take the last usable one
+	for (i = 0; i < sizeof(kernels) / sizeof(kernels[0]); i++) {
+		if (!supported(&kernels[i]))
+			break;
+		ol_xf = kernels[i];
+		if (cap && !strcmp(cap, kernels[i].name))
+			break;
+	}
+}
+
+void ol_transform_init(void)
+{
+	static pthread_once_t once = PTHREAD_ONCE_INIT;
+	pthread_once(&once, pick_kernels);
+}
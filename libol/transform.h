@@ -0,0 +1,47 @@
+/*
+        OpenLase - a realtime laser graphics toolkit
+
+Copyright (C) 2009-2011 Hector Martin "marcan" <hector@marcansoft.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 2.1 or version 3.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#ifndef TRANSFORM_H
+#define TRANSFORM_H
+
+/*
+Batch vertex transforms, picked at runtime for the CPU. Every variant does the
+same multiplies, adds and divides in the same order as the scalar code, so
+results do not depend on which one runs. That only holds with FMA contraction
+off, which libol/CMakeLists.txt sets for this file and libol.c.
+*/
+
+typedef struct {
+	const char *name;
+	// x,y through a 3x3 matrix with perspective divide, in place
+	void (*transform2)(const float m[3][3], float *x, float *y, int count);
+	// x,y,z (w = 1) through a 4x4 matrix with perspective divide, in place
+	void (*transform3)(const float m[4][4], float *x, float *y, float *z, int count);
+	// records of 4 floats: x,y through a 2x3 affine matrix, the other two
+	// copied as they are
+	void (*affine4)(const float m[2][3], const float *in, float *out, int count);
+} TransformKernels;
+
+extern TransformKernels ol_xf;
+
+// Fills in ol_xf. Safe to call more than once, from any thread. The OL_SIMD
+// environment variable (c, sse2, avx2, neon) caps the choice.
+void ol_transform_init(void);
+
+#endif
@@ -32,11 +32,29 @@ cdef extern from "libol.h":
 		_RENDER_GRAYSCALE "RENDER_GRAYSCALE"
 		_RENDER_NOREORDER "RENDER_NOREORDER"
 		_RENDER_NOREVERSE "RENDER_NOREVERSE"
+		_RENDER_OPTIMIZE "RENDER_OPTIMIZE"
+		_RENDER_NOREUSE "RENDER_NOREUSE"
+
+	enum:
+		_BACKEND_JACK "OL_BACKEND_JACK"
+		_BACKEND_NULL "OL_BACKEND_NULL"
+		_BACKEND_FILE "OL_BACKEND_FILE"
+	enum:
+		_FILE_RAW "OL_FILE_RAW"
+		_FILE_WAV "OL_FILE_WAV"
+		_FILE_ILDA "OL_FILE_ILDA"
+	enum:
+		_OVERFLOW_DROP "OL_OVERFLOW_DROP"
+		_OVERFLOW_DECIMATE "OL_OVERFLOW_DECIMATE"
 
 	ctypedef struct OLConfig:
 		int buffer_count
 		int max_points
 		int num_outputs
+		int backend
+		const char *filename
+		int file_format
+		int min_buffer_count
 
 	ctypedef struct OLRenderParams:
 		int rate
@@ -54,6 +72,11 @@ cdef extern from "libol.h":
 		int render_flags
 		int min_length
 		int max_framelen
+		float z_near
+		float optimize_time
+		int overflow
+		float target_fps
+		float max_accel
 
 	ctypedef struct OLFrameInfo "OLFrameInfo":
 		int objects
@@ -61,6 +84,35 @@ cdef extern from "libol.h":
 		int resampled_points
 		int resampled_blacks
 		int padding_points
+		int blank_points
+		int blank_points_saved
+		int dropped_objects
+		int dropped_points
+		int culled_objects
+		int detail_level
+		float detail_scale
+		int reuse_hits
+		int reuse_misses
+		float draw_time
+		float shader_time
+		float reorder_time
+		float render_time
+		float resample_time
+		float output_time
+		float audio_time
+		int queue_depth
+		int queue_lead
+		float queue_wait
+		int repeated_frames
+		float callback_time
+
+	ctypedef struct OLOutputStats "OLOutputStats":
+		unsigned int callbacks
+		unsigned int dummy_callbacks
+		unsigned int repeated_frames
+		unsigned long long samples
+		double callback_time
+		float max_callback_time
 
 	int olInit(int buffer_count, int max_points)
 	int olInit2(OLConfig *config)
@@ -108,6 +160,10 @@ cdef extern from "libol.h":
 	void olVertex3(float x, float y, float z, uint32_t color) except *
 	void olEnd() except *
 
+	void olVertexArray(int size, int stride, float *pointer)
+	void olColorArray(int stride, uint32_t *pointer)
+	void olDrawArrays(int prim, int first, int count) except *
+
 	void olTransformVertex(float *x, float *y)
 	void olTransformVertex3(float *x, float *y, float *z)
 	void olTransformVertex4(float *x, float *y, float *z, float *w)
@@ -129,11 +185,19 @@ cdef extern from "libol.h":
 	float olRenderFrame(int max_fps) nogil except *
 
 	void olGetFrameInfo(OLFrameInfo *info)
+	void olGetOutputStats(OLOutputStats *stats)
 
 	void olShutdown()
 
 	void olSetScissor (float x0, float y0, float x1, float y1)
 
+	ctypedef struct OLDisplayList
+	OLDisplayList *olNewList()
+	void olDeleteList(OLDisplayList *list)
+	void olBeginList(OLDisplayList *list)
+	void olEndList()
+	void olCallList(OLDisplayList *list)
+
 	void olLog(char *fmt, ...)
 
 	ctypedef char* const_char_ptr "const char*"
@@ -148,6 +212,19 @@ POINTS = OL_POINTS
 RENDER_GRAYSCALE = _RENDER_GRAYSCALE
 RENDER_NOREORDER = _RENDER_NOREORDER
 RENDER_NOREVERSE = _RENDER_NOREVERSE
+RENDER_OPTIMIZE = _RENDER_OPTIMIZE
+RENDER_NOREUSE = _RENDER_NOREUSE
+
+BACKEND_JACK = _BACKEND_JACK
+BACKEND_NULL = _BACKEND_NULL
+BACKEND_FILE = _BACKEND_FILE
+
+FILE_RAW = _FILE_RAW
+FILE_WAV = _FILE_WAV
+FILE_ILDA = _FILE_ILDA
+
+OVERFLOW_DROP = _OVERFLOW_DROP
+OVERFLOW_DECIMATE = _OVERFLOW_DECIMATE
 
 C_RED	= 0xff0000
 C_GREEN = 0x00ff00
@@ -173,6 +250,11 @@ cdef class RenderParams:
 	cdef public int render_flags
 	cdef public int min_length
 	cdef public int max_framelen
+	cdef public float z_near
+	cdef public float optimize_time
+	cdef public int overflow
+	cdef public float target_fps
+	cdef public float max_accel
 	def __init__(self):
 		self.rate = 48000
 		self.on_speed = 2/100.0
@@ -189,6 +271,11 @@ cdef class RenderParams:
 		self.render_flags = RENDER_GRAYSCALE
 		self.min_length = 0
 		self.max_framelen = 0
+		self.z_near = 0
+		self.optimize_time = 0
+		self.overflow = OVERFLOW_DROP
+		self.target_fps = 0
+		self.max_accel = 0
 	def copy(self):
 		new = RenderParams()
 		new.rate = self.rate
@@ -206,6 +293,11 @@ cdef class RenderParams:
 		new.render_flags = self.render_flags
 		new.min_length = self.min_length
 		new.max_framelen = self.max_framelen
+		new.z_near = self.z_near
+		new.optimize_time = self.optimize_time
+		new.overflow = self.overflow
+		new.target_fps = self.target_fps
+		new.max_accel = self.max_accel
 		return new
 
 cpdef setOutput(output):
@@ -228,6 +320,11 @@ cpdef setRenderParams(params):
 	cparams.render_flags = params.render_flags
 	cparams.min_length = params.min_length
 	cparams.max_framelen = params.max_framelen
+	cparams.z_near = params.z_near
+	cparams.optimize_time = params.optimize_time
+	cparams.overflow = params.overflow
+	cparams.target_fps = params.target_fps
+	cparams.max_accel = params.max_accel
 	olSetRenderParams(&cparams)
 
 cpdef getRenderParams():
@@ -249,14 +346,29 @@ cpdef getRenderParams():
 	pyparams.render_flags = params.render_flags
 	pyparams.min_length = params.min_length
 	pyparams.max_framelen = params.max_framelen
+	pyparams.z_near = params.z_near
+	pyparams.optimize_time = params.optimize_time
+	pyparams.overflow = params.overflow
+	pyparams.target_fps = params.target_fps
+	pyparams.max_accel = params.max_accel
 	return pyparams
 
-cpdef int init(int buffer_count=4, int max_points=30000, int num_outputs=1):
+cpdef int init(int buffer_count=4, int max_points=30000, int num_outputs=1,
+               int backend=BACKEND_JACK, object filename=None, int file_format=FILE_RAW,
+               int min_buffer_count=0):
 	cdef OLConfig config
-	
+	cdef bytes fname = None
+
 	config.buffer_count = buffer_count
 	config.max_points = max_points
 	config.num_outputs = num_outputs
+	config.backend = backend
+	config.filename = NULL
+	config.file_format = file_format
+	config.min_buffer_count = min_buffer_count
+	if filename is not None:
+		fname = _cstr(filename)
+		config.filename = fname
 
 	cdef int ret = olInit2(&config)
 	if ret < 0:
@@ -347,6 +459,36 @@ def vertex3(coord, color):
 	olVertex3(x, y, z, color)
 def end(): olEnd()
 
+def drawArrays(int prim, coords, colors=None):
+	cdef int count = len(coords)
+	cdef int size, i, j
+	cdef float *vbuf
+	cdef uint32_t *cbuf = NULL
+	if count == 0:
+		return
+	size = len(coords[0])
+	if size != 2 and size != 3:
+		raise ValueError("coords must be 2D or 3D")
+	if colors is not None and len(colors) != count:
+		raise ValueError("coords and colors differ in length")
+	vbuf = <float *>malloc(count * size * sizeof(float))
+	if colors is not None:
+		cbuf = <uint32_t *>malloc(count * sizeof(uint32_t))
+	try:
+		for i in range(count):
+			for j in range(size):
+				vbuf[i * size + j] = coords[i][j]
+			if cbuf != NULL:
+				cbuf[i] = colors[i]
+		olVertexArray(size, 0, vbuf)
+		olColorArray(0, cbuf)
+		olDrawArrays(prim, 0, count)
+	finally:
+		olVertexArray(size, 0, NULL)
+		olColorArray(0, NULL)
+		free(vbuf)
+		free(cbuf)
+
 cpdef tuple transformVertex(float x, float y):
 	olTransformVertex(&x, &y)
 	return x, y
@@ -455,6 +597,27 @@ cdef class FrameInfo:
 	cdef readonly int resampled_points
 	cdef readonly int resampled_blacks
 	cdef readonly int padding_points
+	cdef readonly int blank_points
+	cdef readonly int blank_points_saved
+	cdef readonly int dropped_objects
+	cdef readonly int dropped_points
+	cdef readonly int culled_objects
+	cdef readonly int detail_level
+	cdef readonly float detail_scale
+	cdef readonly int reuse_hits
+	cdef readonly int reuse_misses
+	cdef readonly float draw_time
+	cdef readonly float shader_time
+	cdef readonly float reorder_time
+	cdef readonly float render_time
+	cdef readonly float resample_time
+	cdef readonly float output_time
+	cdef readonly float audio_time
+	cdef readonly int queue_depth
+	cdef readonly int queue_lead
+	cdef readonly float queue_wait
+	cdef readonly int repeated_frames
+	cdef readonly float callback_time
 
 cpdef getFrameInfo():
 	cdef OLFrameInfo info
@@ -465,8 +628,49 @@ cpdef getFrameInfo():
 	pyinfo.resampled_points = info.resampled_points
 	pyinfo.resampled_blacks = info.resampled_blacks
 	pyinfo.padding_points = info.padding_points
+	pyinfo.blank_points = info.blank_points
+	pyinfo.blank_points_saved = info.blank_points_saved
+	pyinfo.dropped_objects = info.dropped_objects
+	pyinfo.dropped_points = info.dropped_points
+	pyinfo.culled_objects = info.culled_objects
+	pyinfo.detail_level = info.detail_level
+	pyinfo.detail_scale = info.detail_scale
+	pyinfo.reuse_hits = info.reuse_hits
+	pyinfo.reuse_misses = info.reuse_misses
+	pyinfo.draw_time = info.draw_time
+	pyinfo.shader_time = info.shader_time
+	pyinfo.reorder_time = info.reorder_time
+	pyinfo.render_time = info.render_time
+	pyinfo.resample_time = info.resample_time
+	pyinfo.output_time = info.output_time
+	pyinfo.audio_time = info.audio_time
+	pyinfo.queue_depth = info.queue_depth
+	pyinfo.queue_lead = info.queue_lead
+	pyinfo.queue_wait = info.queue_wait
+	pyinfo.repeated_frames = info.repeated_frames
+	pyinfo.callback_time = info.callback_time
 	return pyinfo
 
+cdef class OutputStats:
+	cdef readonly unsigned int callbacks
+	cdef readonly unsigned int dummy_callbacks
+	cdef readonly unsigned int repeated_frames
+	cdef readonly unsigned long long samples
+	cdef readonly double callback_time
+	cdef readonly float max_callback_time
+
+cpdef getOutputStats():
+	cdef OLOutputStats stats
+	olGetOutputStats(&stats)
+	pystats = OutputStats()
+	pystats.callbacks = stats.callbacks
+	pystats.dummy_callbacks = stats.dummy_callbacks
+	pystats.repeated_frames = stats.repeated_frames
+	pystats.samples = stats.samples
+	pystats.callback_time = stats.callback_time
+	pystats.max_callback_time = stats.max_callback_time
+	return pystats
+
 cpdef shutdown(): olShutdown()
 
 cpdef setScissor(tuple start, tuple end):
@@ -474,6 +678,21 @@ cpdef setScissor(tuple start, tuple end):
 	x2, y2 = end
 	olSetScissor(x1, y1, x2, y2)
 
+cdef class DisplayList:
+	cdef OLDisplayList *list
+	def __cinit__(self):
+		self.list = olNewList()
+	def __dealloc__(self):
+		olDeleteList(self.list)
+
+cpdef beginList(DisplayList dlist):
+	olBeginList(dlist.list)
+
+cpdef endList(): olEndList()
+
+cpdef callList(DisplayList dlist):
+	olCallList(dlist.list)
+
 _py_logcb = None
 cdef void _logcb(const_char_ptr msg):
 	global _py_logcb
@@ -571,6 +790,8 @@ IF BUILD_TRACER == "Y":
 			float sigma
 			unsigned int threshold
 			unsigned int threshold2
+			unsigned int threads
+			int incremental
 
 		ctypedef struct OLTracePoint:
 			uint32_t x
@@ -606,6 +827,8 @@ IF BUILD_TRACER == "Y":
 			self.params.sigma = 0
 			self.params.threshold = 128
 			self.params.threshold2 = 0
+			self.params.threads = 1
+			self.params.incremental = 0
 			olTraceInit(&self.ctx, &self.params)
 
 		def __del__(self):
@@ -670,6 +893,20 @@ IF BUILD_TRACER == "Y":
 				self.params.sigma = v
 				olTraceReInit(self.ctx, &self.params)
 
+		property threads:
+			def __get__(self):
+				return self.params.threads
+			def __set__(self, v):
+				self.params.threads = v
+				olTraceReInit(self.ctx, &self.params)
+
+		property incremental:
+			def __get__(self):
+				return bool(self.params.incremental)
+			def __set__(self, v):
+				self.params.incremental = bool(v)
+				olTraceReInit(self.ctx, &self.params)
+
 		property width:
 			def __get__(self):
 				return self.params.width
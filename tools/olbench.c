@@ -0,0 +1,402 @@
+/*
+        OpenLase - a realtime laser graphics toolkit
+
+Copyright (C) 2009-2011 Hector Martin "marcan" <hector@marcansoft.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 or version 3.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+/*
+Renders synthetic scenes through the offline backend as fast as possible and
+reports libol throughput. No JACK server is needed.
+*/
+
+#include "libol.h"
+#include "text.h"
+
+#include <stdio.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+
+static uint32_t seed;
+static int use_arrays;
+
+static float frand(void)
+{
+	seed = seed * 1103515245 + 12345;
+	return ((seed >> 8) & 0xffff) / 32768.0f - 1.0f;
+}
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void scene_lines(int objects)
+{
+	float v[3][2];
+	int i;
+	for (i = 0; i < objects; i++) {
+		float x = frand() * 0.95f;
+		float y = frand() * 0.95f;
+		v[0][0] = x;
+		v[0][1] = y;
+		v[1][0] = x + frand() * 0.05f;
+		v[1][1] = y + frand() * 0.05f;
+		v[2][0] = x + frand() * 0.05f;
+		v[2][1] = y + frand() * 0.05f;
+		if (use_arrays) {
+			olVertexArray(2, 0, &v[0][0]);
+			olDrawArrays(OL_LINESTRIP, 0, 3);
+		} else {
+			olBegin(OL_LINESTRIP);
+			olVertex(v[0][0], v[0][1], C_WHITE);
+			olVertex(v[1][0], v[1][1], C_WHITE);
+			olVertex(v[2][0], v[2][1], C_WHITE);
+			olEnd();
+		}
+	}
+}
+
+// Long point runs, like traced video frames
+#define WALK_POINTS 64
+static void scene_points(int objects)
+{
+	float v[WALK_POINTS][2];
+	int i, j;
+	for (i = 0; i < objects; i++) {
+		float x = frand() * 0.9f;
+		float y = frand() * 0.9f;
+		for (j = 0; j < WALK_POINTS; j++) {
+			x += frand() * 0.005f;
+			y += frand() * 0.005f;
+			v[j][0] = x;
+			v[j][1] = y;
+		}
+		if (use_arrays) {
+			olVertexArray(2, 0, &v[0][0]);
+			olDrawArrays(OL_POINTS, 0, WALK_POINTS);
+		} else {
+			olBegin(OL_POINTS);
+			for (j = 0; j < WALK_POINTS; j++)
+				olVertex(v[j][0], v[j][1], C_WHITE);
+			olEnd();
+		}
+	}
+}
+
+static void scene_text(int objects)
+{
+	static const char text[] = "The quick brown fox jumps over the lazy dog";
+	Font *font = olGetDefaultFont();
+	int i, lines = objects / 32 + 1;
+	float h = 2.0f / lines;
+
+	for (i = 0; i < lines; i++)
+		olDrawString(font, -1, 1 - i * h, h, C_WHITE, text);
+}
+
+// Every glyph of the default font over a range of sizes; almost all the work
+// is flattening the curves
+static void scene_glyphs(int objects)
+{
+	Font *font = olGetDefaultFont();
+	int i;
+
+	for (i = 0; i < objects; i++) {
+		float h = 0.05f + 0.95f * (i % 20) / 19.0f;
+		olDrawChar(font, frand() * 0.5f - 0.5f, frand() * 0.5f + 0.5f, h, C_WHITE, '!' + i % 94);
+	}
+}
+
+// Per-vertex olTransformVertex*() against the batch kernels on count vertices.
+// The input is restored before every pass so it never drifts into denormals.
+static void bench_transform(int count, int nframes)
+{
+	float *src = malloc(3 * count * sizeof(float));
+	float *x = malloc(count * sizeof(float));
+	float *y = malloc(count * sizeof(float));
+	float *z = malloc(count * sizeof(float));
+	double t0, t[4];
+	int i, j, k;
+
+	olLoadIdentity();
+	olRotate(0.3);
+	olScale(0.8, 0.9);
+	olPerspective(60, 1, 1, 100);
+	olTranslate3(0, 0, -3);
+
+	seed = 1;
+	for (i = 0; i < 3 * count; i++)
+		src[i] = frand();
+
+	for (j = 0; j < 4; j++) {
+		t0 = now();
+		for (i = 0; i < nframes; i++) {
+			memcpy(x, src, count * sizeof(float));
+			memcpy(y, src + count, count * sizeof(float));
+			memcpy(z, src + 2 * count, count * sizeof(float));
+			switch (j) {
+				case 0:
+					for (k = 0; k < count; k++)
+						olTransformVertex(&x[k], &y[k]);
+					break;
+				case 1:
+					olTransformVertices(x, y, count);
+					break;
+				case 2:
+					for (k = 0; k < count; k++)
+						olTransformVertex3(&x[k], &y[k], &z[k]);
+					break;
+				case 3:
+					olTransformVertices3(x, y, z, count);
+					break;
+			}
+		}
+		t[j] = (now() - t0) / ((double)nframes * count);
+	}
+
+	printf("transform %d vertices (OL_SIMD=%s)\n", count, getenv("OL_SIMD") ? getenv("OL_SIMD") : "");
+	printf("2D: %6.2f ns/vertex per call, %6.2f ns/vertex batched\n", t[0] * 1e9, t[1] * 1e9);
+	printf("3D: %6.2f ns/vertex per call, %6.2f ns/vertex batched\n", t[2] * 1e9, t[3] * 1e9);
+	free(src);
+	free(x);
+	free(y);
+	free(z);
+}
+
+static void usage(const char *argv0)
+{
+	printf("Usage: %s [options]\n\n", argv0);
+	printf("Options:\n");
+	printf("-s NAME   Scene (lines, points, text, glyphs)\n");
+	printf("-n INT    Number of frames to render\n");
+	printf("-o INT    Objects per frame (per output)\n");
+	printf("-m INT    Number of outputs\n");
+	printf("-r INT    Render flags\n");
+	printf("-t FLOAT  Path optimization time budget per frame (seconds)\n");
+	printf("-p INT    Point buffer limit (0 for none)\n");
+	printf("-d        Decimate instead of dropping objects over the limit\n");
+	printf("-f FLOAT  Target frame rate (lower the detail to keep up)\n");
+	printf("-g FLOAT  Plan moves with this maximum acceleration per sample\n");
+	printf("-e FLOAT  On speed (default 0.02)\n");
+	printf("-l        Record the scene once into a display list and replay it\n");
+	printf("-v        Submit the lines and points scenes as vertex arrays\n");
+	printf("-a FLOAT  Rotate the scene by this many radians per frame\n");
+	printf("-k INT    Benchmark the vertex transforms on this many vertices instead\n");
+	printf("-w FILE   Also write the output to a WAV file\n");
+}
+
+int main (int argc, char *argv[])
+{
+	OLConfig config;
+	OLRenderParams params;
+	OLFrameInfo info;
+	const char *scene = "lines";
+	int nframes = 200;
+	int objects = 500;
+	int use_list = 0;
+	int transform_count = 0;
+	float spin = 0;
+	int optchar;
+	int i, j;
+
+	memset(&config, 0, sizeof config);
+	config.buffer_count = 1;
+	config.max_points = 0;
+	config.num_outputs = 1;
+	config.backend = OL_BACKEND_NULL;
+
+	memset(&params, 0, sizeof params);
+	params.rate = 48000;
+	params.on_speed = 2.0/100.0;
+	params.off_speed = 2.0/20.0;
+	params.start_wait = 8;
+	params.start_dwell = 3;
+	params.curve_dwell = 0;
+	params.corner_dwell = 8;
+	params.curve_angle = cosf(30.0*(M_PI/180.0)); // 30 deg
+	params.end_dwell = 3;
+	params.end_wait = 7;
+	params.flatness = 0.00001;
+	params.snap = 1/100000.0;
+	params.render_flags = RENDER_GRAYSCALE;
+
+	while ((optchar = getopt(argc, argv, "hs:n:o:m:r:t:p:df:g:e:lva:k:w:")) != -1) {
+		switch (optchar) {
+			case 'h':
+			case '?':
+				usage(argv[0]);
+				return 0;
+			case 's':
+				scene = optarg;
+				break;
+			case 'n':
+				nframes = atoi(optarg);
+				break;
+			case 'o':
+				objects = atoi(optarg);
+				break;
+			case 'm':
+				config.num_outputs = atoi(optarg);
+				break;
+			case 'r':
+				params.render_flags = atoi(optarg);
+				break;
+			case 't':
+				params.optimize_time = atof(optarg);
+				break;
+			case 'p':
+				config.max_points = atoi(optarg);
+				break;
+			case 'd':
+				params.overflow = OL_OVERFLOW_DECIMATE;
+				break;
+			case 'f':
+				params.target_fps = atof(optarg);
+				break;
+			case 'g':
+				params.max_accel = atof(optarg);
+				break;
+			case 'e':
+				params.on_speed = atof(optarg);
+				break;
+			case 'l':
+				use_list = 1;
+				break;
+			case 'v':
+				use_arrays = 1;
+				break;
+			case 'a':
+				spin = atof(optarg);
+				break;
+			case 'k':
+				transform_count = atoi(optarg);
+				break;
+			case 'w':
+				config.backend = OL_BACKEND_FILE;
+				config.file_format = OL_FILE_WAV;
+				config.filename = optarg;
+				break;
+		}
+	}
+
+	void (*draw)(int) = NULL;
+	if (!strcmp(scene, "lines"))
+		draw = scene_lines;
+	else if (!strcmp(scene, "points"))
+		draw = scene_points;
+	else if (!strcmp(scene, "text"))
+		draw = scene_text;
+	else if (!strcmp(scene, "glyphs"))
+		draw = scene_glyphs;
+	if (!draw) {
+		fprintf(stderr, "Unknown scene %s\n", scene);
+		return 1;
+	}
+
+	if(olInit2(&config) < 0)
+		return 1;
+
+	olSetRenderParams(&params);
+
+	if (transform_count) {
+		bench_transform(transform_count, nframes);
+		olShutdown();
+		return 0;
+	}
+
+	long total_objects = 0, total_points = 0, total_blanks = 0, total_saved = 0;
+	long total_dropped = 0, total_decimated = 0, total_culled = 0;
+	long total_level = 0, over_budget = 0;
+	long total_hits = 0, total_misses = 0;
+	double stage[4] = {0};
+	double submit = 0, render = 0;
+
+	OLDisplayList *list = NULL;
+	seed = 1;
+	if (use_list) {
+		list = olNewList();
+		olBeginList(list);
+		draw(objects);
+		olEndList();
+	}
+
+	for (i = 0; i < nframes; i++) {
+		double t0 = now();
+		olLoadIdentity();
+		olRotate(spin * i);
+		for (j = 0; j < config.num_outputs; j++) {
+			olSetOutput(j);
+			if (list)
+				olCallList(list);
+			else
+				draw(objects);
+		}
+		double t1 = now();
+		olRenderFrame(1000);
+		double t2 = now();
+		olGetFrameInfo(&info);
+		submit += t1 - t0;
+		render += t2 - t1;
+		total_objects += info.objects;
+		total_points += info.points;
+		total_blanks += info.blank_points;
+		total_saved += info.blank_points_saved;
+		total_dropped += info.dropped_objects;
+		total_decimated += info.dropped_points;
+		total_culled += info.culled_objects;
+		total_level += info.detail_level;
+		total_hits += info.reuse_hits;
+		total_misses += info.reuse_misses;
+		stage[0] += info.reorder_time;
+		stage[1] += info.render_time;
+		stage[2] += info.resample_time;
+		stage[3] += info.output_time;
+		if (params.target_fps > 0 && info.points > params.rate / params.target_fps)
+			over_budget++;
+	}
+
+	olShutdown();
+	olDeleteList(list);
+
+	printf("scene %s: %d outputs, %d frames, %ld objects, %ld points\n", scene,
+	       config.num_outputs, nframes, total_objects, total_points);
+	printf("blank:  %ld points/frame, %ld saved by optimization\n",
+	       total_blanks / nframes, total_saved / nframes);
+	if (total_dropped || total_decimated)
+		printf("limit:  %ld objects/frame dropped, %ld points/frame decimated\n",
+		       total_dropped / nframes, total_decimated / nframes);
+	if (total_culled)
+		printf("culled: %ld objects/frame\n", total_culled / nframes);
+	if (total_hits)
+		printf("reuse:  %ld of %ld output frames copied from the last one\n",
+		       total_hits, total_hits + total_misses);
+	if (params.target_fps > 0)
+		printf("detail: level %.1f on average, %ld frames over budget\n",
+		       total_level / (double)nframes, over_budget);
+	printf("submit: %8.3f ms/frame\n", 1000 * submit / nframes);
+	printf("render: %8.3f ms/frame, %.0f objects/s, %.0f points/s\n",
+	       1000 * render / nframes, total_objects / render, total_points / render);
+	printf("stages: %8.3f reorder, %.3f render, %.3f resample, %.3f output ms/frame\n",
+	       1000 * stage[0] / nframes, 1000 * stage[1] / nframes,
+	       1000 * stage[2] / nframes, 1000 * stage[3] / nframes);
+	printf("total:  %8.1f frames/s\n", nframes / (submit + render));
+	return 0;
+}
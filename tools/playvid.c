@@ -256,6 +256,25 @@ int av_deinit(void)
 	return 0;
 }
 
+// Draws every decimate'th point of a traced object as one vertex array
+static void draw_traced(OLTraceObject *o, int decimate)
+{
+	static float *vbuf;
+	static unsigned int vbuf_size;
+	unsigned int j, n = 0;
+
+	if (o->count * 2 > vbuf_size) {
+		vbuf_size = o->count * 2;
+		vbuf = realloc(vbuf, vbuf_size * sizeof(float));
+	}
+	for (j = 0; j < o->count; j += decimate) {
+		vbuf[n++] = o->points[j].x;
+		vbuf[n++] = o->points[j].y;
+	}
+	olVertexArray(2, 0, vbuf);
+	olDrawArrays(OL_POINTS, 0, n / 2);
+}
+
 void usage(const char *argv0)
 {
 	printf("Usage: %s [options] inputfile\n\n", argv0);
@@ -279,8 +298,11 @@ void usage(const char *argv0)
 	printf("-a FLOAT  Force aspect ratio\n");
 	printf("-r FLOAT  Force framerate\n");
 	printf("-R FLOAT  Minimum framerate (resample slow frames to be faster)\n");
+	printf("-F FLOAT  Target framerate (lower the detail of slow frames)\n");
 	printf("-o FLOAT  Overscan factor (to get rid of borders etc.)\n");
 	printf("-v FLOAT  Audio volume\n");
+	printf("-j INT    Tracer threads\n");
+	printf("-i        Only retrace the parts of each frame that changed\n");
 }
 
 int main (int argc, char *argv[])
@@ -320,10 +342,11 @@ int main (int argc, char *argv[])
 	OLTraceParams tparams = {
 		.mode = OL_TRACE_THRESHOLD,
 		.sigma = 0,
-		.threshold2 = 50
+		.threshold2 = 50,
+		.threads = 1
 	};
 
-	while ((optchar = getopt(argc, argv, "hct:T:b:w:B:W:O:d:m:S:E:D:g:s:p:a:r:R:o:v:")) != -1) {
+	while ((optchar = getopt(argc, argv, "hct:T:b:w:B:W:O:d:m:S:E:D:g:s:p:a:r:R:F:o:v:j:i")) != -1) {
 		switch (optchar) {
 			case 'h':
 			case '?':
@@ -388,12 +411,21 @@ int main (int argc, char *argv[])
 			case 'R':
 				params.max_framelen = params.rate/atof(optarg);
 				break;
+			case 'F':
+				params.target_fps = atof(optarg);
+				break;
 			case 'o':
 				overscan = atof(optarg);
 				break;
 			case 'v':
 				volume = atof(optarg);
 				break;
+			case 'j':
+				tparams.threads = atoi(optarg);
+				break;
+			case 'i':
+				tparams.incremental = 1;
+				break;
 		}
 	}
 
@@ -456,6 +488,7 @@ int main (int argc, char *argv[])
 	int frames = 0;
 
 	OLFrameInfo info;
+	olGetFrameInfo(&info);
 
 	OLTraceCtx *trace_ctx;
 
@@ -508,18 +541,9 @@ int main (int argc, char *argv[])
 		olTrace(trace_ctx, frame->data[0], frame->linesize[0], &result);
 
 		do {
-			int i, j;
-			for (i = 0; i < result.count; i++) {
-				OLTraceObject *o = &result.objects[i];
-				olBegin(OL_POINTS);
-				OLTracePoint *p = o->points;
-				for (j = 0; j < o->count; j++) {
-					if (j % decimate == 0)
-						olVertex(p->x, p->y, C_WHITE);
-					p++;
-				}
-				olEnd();
-			}
+			int i;
+			for (i = 0; i < result.count; i++)
+				draw_traced(&result.objects[i], decimate * info.detail_scale + 0.5f);
 
 			ftime = olRenderFrame(200);
 			olGetFrameInfo(&info);
@@ -533,6 +557,8 @@ int main (int argc, char *argv[])
 				printf(" Rp %4d Bp %4d", info.resampled_points, info.resampled_blacks);
 			if (info.padding_points)
 				printf(" Pad %4d", info.padding_points);
+			if (info.detail_level)
+				printf(" Lvl %2d", info.detail_level);
 			printf("\n");
 		} while ((time+frametime) < vidtime);
 	}
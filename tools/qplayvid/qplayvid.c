@@ -781,6 +781,8 @@ void *display_thread(void *arg)
 	OLTraceCtx *trace_ctx;
 	OLTraceParams tparams;
 	OLTraceResult result;
+	float *vbuf = NULL;
+	unsigned int vbuf_size = 0;
 	memset(&result, 0, sizeof(result));
 	ctx->settings_changed = 1;
 
@@ -791,6 +793,8 @@ void *display_thread(void *arg)
 		tparams.mode = OL_TRACE_THRESHOLD;
 	tparams.width = ctx->width;
 	tparams.height = ctx->height;
+	tparams.threads = sysconf(_SC_NPROCESSORS_ONLN);
+	tparams.incremental = 0;
 
 	printf("Resolution: %dx%d\n", ctx->width, ctx->height);
 	olTraceInit(&trace_ctx, &tparams);
@@ -906,17 +910,25 @@ void *display_thread(void *arg)
 			last = ctx->cur_frame;
 		}
 
+		// every decimation'th point of each object, gathered into one vertex array
 		int i, j;
+		unsigned int n = 0, first;
+		for (i = 0; i < result.count; i++)
+			n += result.objects[i].count * 2;
+		if (n > vbuf_size) {
+			vbuf_size = n;
+			vbuf = realloc(vbuf, vbuf_size * sizeof(float));
+		}
+		olVertexArray(2, 0, vbuf);
+		n = 0;
 		for (i = 0; i < result.count; i++) {
 			OLTraceObject *o = &result.objects[i];
-			olBegin(OL_POINTS);
-			OLTracePoint *p = o->points;
-			for (j = 0; j < o->count; j++) {
-				if (j % settings.decimation == 0)
-					olVertex(p->x, p->y, C_WHITE);
-				p++;
+			first = n / 2;
+			for (j = 0; j < o->count; j += settings.decimation) {
+				vbuf[n++] = o->points[j].x;
+				vbuf[n++] = o->points[j].y;
 			}
-			olEnd();
+			olDrawArrays(OL_POINTS, first, n / 2 - first);
 		}
 
 		float ftime = olRenderFrame(80);
@@ -941,6 +953,7 @@ void *display_thread(void *arg)
 	}
 
 	olTraceDeinit(trace_ctx);
+	free(vbuf);
 
 	for(i = 0; i < OL_FRAMES_BUF; i++)
 		olRenderFrame(80);
@@ -0,0 +1,278 @@
+/*
+        OpenLase - a realtime laser graphics toolkit
+
+Copyright (C) 2009-2011 Hector Martin "marcan" <hector@marcansoft.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 or version 3.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+/*
+Traces synthetic frames with each set of image kernels and reports the time
+per frame. The first set in the list is the reference: it has to be available,
+and the traced output of every other set must match it bit for bit. With the
+default list this checks the C and intrinsics kernels against the assembly.
+*/
+
+#include <stdint.h>
+#include "trace.h"
+
+#include <stdio.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+#if defined(__i386__) || defined(__x86_64__)
+# define DEFAULT_KERNELS "sse2,c,avx2,avx512"
+#else
+# define DEFAULT_KERNELS "c,neon"
+#endif
+
+// Smooth gradient, a moving disc, a box, a checker band and a little noise.
+// The last frame is all noise, to feed the kernels every pixel value.
+static void gen_frame(uint8_t *img, int w, int h, int stride, int frame)
+{
+	uint32_t seed = 12345;
+	float cx = w * 0.5f + frame * 2, cy = h * 0.5f;
+	int x, y;
+
+	if (frame == 7) {
+		for (y = 0; y < h; y++) {
+			for (x = 0; x < w; x++) {
+				seed = seed * 1103515245 + 12345;
+				img[y * stride + x] = seed >> 24;
+			}
+		}
+		return;
+	}
+
+	for (y = 0; y < h; y++) {
+		for (x = 0; x < w; x++) {
+			float v = 100 + 60 * sinf(x * 0.013f + frame * 0.05f) * cosf(y * 0.021f);
+			float d = sqrtf((x - cx) * (x - cx) + (y - cy) * (y - cy));
+			if (d < h * 0.3f)
+				v = 220;
+			if (d < h * 0.15f)
+				v = 30;
+			if (x > w / 8 && x < w / 4 && y > h / 8 && y < h / 3)
+				v = 250;
+			if (((x / 37) + (y / 41)) % 5 == 0 && x > w * 0.6f)
+				v = 10;
+			seed = seed * 1103515245 + 12345;
+			v += (int)((seed >> 16) & 15) - 8;
+			img[y * stride + x] = v < 0 ? 0 : v > 255 ? 255 : v;
+		}
+	}
+}
+
+// For incremental tracing: the first frame, still, with a small box moving
+// across it
+static void gen_still_frame(uint8_t *img, int w, int h, int stride, int frame)
+{
+	int bx = w / 16 + frame * 4, by = h / 2;
+	int x, y;
+
+	gen_frame(img, w, h, stride, 0);
+	for (y = by; y < by + 24 && y < h; y++)
+		for (x = bx; x < bx + 24 && x < w; x++)
+			img[y * stride + x] = 240;
+}
+
+static double bench(OLTraceParams *params, const char *kernels, int nframes,
+                    uint8_t **frames, int stride, uint64_t *hash, long *points)
+{
+	OLTraceCtx *ctx;
+	OLTraceResult res;
+	double t0, t = 0;
+	int i;
+	unsigned int j, k;
+
+	setenv("OL_SIMD", kernels, 1);
+	if (olTraceInit(&ctx, params) < 0)
+		return -1;
+	// not built in, or not supported by this CPU
+	if (strcmp(olTraceKernels(ctx), kernels)) {
+		olTraceDeinit(ctx);
+		return 0;
+	}
+
+	*hash = 1469598103934665603ULL;
+	*points = 0;
+	for (i = 0; i < nframes; i++) {
+		t0 = now();
+		olTrace(ctx, frames[i % 8], stride, &res);
+		t += now() - t0;
+		for (j = 0; j < res.count; j++) {
+			for (k = 0; k < res.objects[j].count; k++) {
+				*hash = (*hash ^ res.objects[j].points[k].x) * 1099511628211ULL;
+				*hash = (*hash ^ res.objects[j].points[k].y) * 1099511628211ULL;
+			}
+			*hash = (*hash ^ 0xffff) * 1099511628211ULL;
+			*points += res.objects[j].count;
+		}
+		olTraceFree(&res);
+	}
+
+	olTraceDeinit(ctx);
+	return t / nframes;
+}
+
+static void usage(const char *argv0)
+{
+	printf("Usage: %s [options]\n", argv0);
+	printf("Options:\n");
+	printf("-n FRAMES   Frames to trace per size and kernel set (default 50)\n");
+	printf("-k LIST     Comma separated kernel sets (default %s)\n", DEFAULT_KERNELS);
+	printf("-s WxH      Only this frame size (default 640x480 and 1920x1080)\n");
+	printf("-m MODE     canny or threshold (default canny)\n");
+	printf("-S SIGMA    Blur sigma (default 1.0)\n");
+	printf("-j THREADS  Tracer threads (default 1)\n");
+	printf("-i          Incremental tracing, of a mostly still scene\n");
+	printf("-h          Show this help\n");
+}
+
+int main (int argc, char *argv[])
+{
+	int sizes[2][2] = {{640, 480}, {1920, 1080}};
+	int nsizes = 2;
+	int nframes = 50;
+	char *kernel_list = DEFAULT_KERNELS;
+	OLTraceParams params;
+	int optchar, i, s;
+
+	memset(&params, 0, sizeof(params));
+	params.mode = OL_TRACE_CANNY;
+	params.sigma = 1.0;
+	params.threshold = 40;
+	params.threshold2 = 20;
+	params.threads = 1;
+
+	while ((optchar = getopt(argc, argv, "hn:k:s:m:S:j:i")) != -1) {
+		switch (optchar) {
+			case 'h':
+			case '?':
+				usage(argv[0]);
+				return optchar == 'h' ? 0 : 1;
+			case 'n':
+				nframes = atoi(optarg);
+				break;
+			case 'k':
+				kernel_list = optarg;
+				break;
+			case 's':
+				if (sscanf(optarg, "%dx%d", &sizes[0][0], &sizes[0][1]) != 2) {
+					fprintf(stderr, "Bad frame size %s\n", optarg);
+					return 1;
+				}
+				nsizes = 1;
+				break;
+			case 'm':
+				if (!strcmp(optarg, "canny")) {
+					params.mode = OL_TRACE_CANNY;
+					params.threshold = 40;
+					params.threshold2 = 20;
+				} else if (!strcmp(optarg, "threshold")) {
+					params.mode = OL_TRACE_THRESHOLD;
+					params.threshold = 128;
+					params.threshold2 = 0;
+				} else {
+					fprintf(stderr, "Unknown mode %s\n", optarg);
+					return 1;
+				}
+				break;
+			case 'S':
+				params.sigma = atof(optarg);
+				break;
+			case 'j':
+				params.threads = atoi(optarg);
+				break;
+			case 'i':
+				params.incremental = 1;
+				break;
+		}
+	}
+
+	if (nframes < 1)
+		nframes = 1;
+
+	for (s = 0; s < nsizes; s++) {
+		int w = sizes[s][0], h = sizes[s][1];
+		int stride = (w + 15) & ~15;
+		uint8_t *frames[8];
+		uint64_t ref_hash = 0;
+		double ref_time = 0;
+		int have_ref = 0;
+		char *list, *name, *saveptr;
+
+		for (i = 0; i < 8; i++) {
+			frames[i] = malloc(stride * h);
+			if (params.incremental)
+				gen_still_frame(frames[i], w, h, stride, i);
+			else
+				gen_frame(frames[i], w, h, stride, i);
+		}
+
+		params.width = w;
+		params.height = h;
+		printf("%dx%d %s sigma %.1f, %d thread(s), %d frames%s\n", w, h,
+		       params.mode == OL_TRACE_CANNY ? "canny" : "threshold",
+		       params.sigma, params.threads, nframes,
+		       params.incremental ? ", incremental" : "");
+
+		list = strdup(kernel_list);
+		for (name = strtok_r(list, ",", &saveptr); name; name = strtok_r(NULL, ",", &saveptr)) {
+			uint64_t hash;
+			long points;
+			double t;
+
+			t = bench(&params, name, nframes, frames, stride, &hash, &points);
+			if (t < 0) {
+				fprintf(stderr, "olTraceInit failed\n");
+				return 1;
+			}
+			if (t == 0 && !have_ref) {
+				fprintf(stderr, "Reference kernels %s not available, nothing to check against\n", name);
+				return 1;
+			}
+			if (t == 0) {
+				printf("  %-8s not available\n", name);
+				continue;
+			}
+			if (!have_ref) {
+				ref_hash = hash;
+				ref_time = t;
+				have_ref = 1;
+			}
+			printf("  %-8s %8.3f ms/frame  %5.2fx  %ld points  %s\n", name,
+			       t * 1000, ref_time / t, points,
+			       name == list ? "reference" : hash == ref_hash ? "ok" : "MISMATCH");
+			if (hash != ref_hash)
+				return 1;
+		}
+		free(list);
+
+		for (i = 0; i < 8; i++)
+			free(frames[i]);
+	}
+
+	return 0;
+}